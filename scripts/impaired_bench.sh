@@ -0,0 +1,54 @@
+#!/bin/bash
+# 经过损伤代理 (`rtp_proxy`) 比较两种模式与不同窗口大小的完成时间与吞吐量.
+# 每种组合传同一个文件, 检查收到的文件一致, 每行输出一个结果.
+#
+# 用法: scripts/impaired_bench.sh [build 目录] [文件大小] [窗口大小列表]
+#                                 [其余参数都传给 rtp_proxy]
+# 例如: scripts/impaired_bench.sh build 10000000 "16 64 256" --loss=0.01 --delay=10
+# 环境变量 SENDER_OPTIONS 传给 sender, RECEIVER_OPTIONS 传给 receiver.
+
+set -u
+
+build=${1:-build}
+size=${2:-10000000}
+windows=${3:-"16 64 256"}
+shift $(($# < 3 ? $# : 3))
+
+work=$(mktemp -d)
+trap 'kill "$proxy" 2>/dev/null; rm -rf "$work"' EXIT
+head -c "$size" /dev/urandom > "$work/in"
+
+echo "mode window seconds MB/s proxy_lost proxy_forwarded"
+for mode in 0 1; do
+    for window in $windows; do
+        port=$((20000 + RANDOM % 20000))
+        rm -f "$work/out"
+        "$build/rtp_proxy" "$port" 127.0.0.1 $((port + 1)) "$@" \
+            --stats="$work/proxy.json" > "$work/proxy.log" 2>&1 &
+        proxy=$!
+        "$build/receiver" $((port + 1)) "$work/out" "$window" "$mode" \
+            ${RECEIVER_OPTIONS:-} > "$work/receiver.log" 2>&1 &
+        receiver=$!
+        sleep 0.2
+
+        start=$(date +%s.%N)
+        "$build/sender" 127.0.0.1 "$port" "$work/in" "$window" "$mode" \
+            ${SENDER_OPTIONS:-} > "$work/sender.log" 2>&1
+        status=$?
+        end=$(date +%s.%N)
+        wait "$receiver"
+        kill -INT "$proxy"
+        wait "$proxy"
+
+        if [ $status -ne 0 ] || ! cmp -s "$work/in" "$work/out"; then
+            echo "$mode $window failed"
+            continue
+        fi
+        # 用时包含握手后的 2 s 等待
+        stats=$(sed 's/.*"forward":{[^}]*"forwarded":\([0-9]*\),"lost":\([0-9]*\).*/\2 \1/' \
+            "$work/proxy.json")
+        awk -v mode="$mode" -v window="$window" -v start="$start" -v end="$end" \
+            -v size="$size" -v stats="$stats" \
+            'BEGIN { t = end - start; printf "%s %s %.3f %.2f %s\n", mode, window, t, size / t / 1e6, stats }'
+    done
+done
@@ -0,0 +1,60 @@
+#!/bin/bash
+# 服务器模式的负载测试: 启动一个 `receiver --server`, 同时运行多个 sender,
+# 最后检查每个收到的文件都与某个发出的文件相同.
+#
+# 用法: scripts/load_test.sh [build 目录] [sender 个数] [文件大小] [窗口大小] [模式]
+#                            [其余参数都传给 sender]
+# 例如: scripts/load_test.sh build 100 1000000 64 1 --sack
+# 环境变量 RECEIVER_OPTIONS 传给 receiver, PORT 指定端口.
+
+set -u
+
+build=${1:-build}
+n_senders=${2:-50}
+size=${3:-1000000}
+window=${4:-64}
+mode=${5:-1}
+shift $(($# < 5 ? $# : 5))
+port=${PORT:-$((20000 + RANDOM % 20000))}
+
+work=$(mktemp -d)
+trap 'kill "$server" 2>/dev/null; rm -rf "$work"' EXIT
+mkdir "$work/in" "$work/out"
+
+for i in $(seq "$n_senders"); do
+    head -c "$size" /dev/urandom > "$work/in/$i"
+done
+
+"$build/receiver" "$port" "$work/out" "$window" "$mode" --server \
+    --max-sessions="$n_senders" ${RECEIVER_OPTIONS:-} > "$work/receiver.log" 2>&1 &
+server=$!
+sleep 0.2
+
+start=$(date +%s.%N)
+pids=()
+for i in $(seq "$n_senders"); do
+    "$build/sender" 127.0.0.1 "$port" "$work/in/$i" "$window" "$mode" "$@" \
+        > "$work/sender_$i.log" 2>&1 &
+    pids+=($!)
+done
+failed=0
+for pid in "${pids[@]}"; do
+    wait "$pid" || failed=$((failed + 1))
+done
+end=$(date +%s.%N)
+
+# 等接收端挥手结束, 文件都已关闭
+sleep 2.5
+
+sent=$(cd "$work/in" && md5sum -- * | cut -d' ' -f1 | sort)
+received=$(cd "$work/out" && md5sum -- * 2>/dev/null | cut -d' ' -f1 | sort)
+elapsed=$(awk "BEGIN { print $end - $start }")
+echo "sender 个数: $n_senders, 每个 $size 字节, 用时 ${elapsed} s (含握手后的 2 s 等待)"
+echo "退出码非 0 的 sender: $failed"
+if [ "$sent" == "$received" ]; then
+    echo "全部文件一致"
+    exit $((failed > 0))
+fi
+echo "收到的文件与发出的不一致, 接收端日志: $work/receiver.log"
+trap 'kill "$server" 2>/dev/null' EXIT
+exit 1
@@ -0,0 +1,284 @@
+#include "batch_io.hxx"
+#include "error_process.hxx"
+#include "tools.hxx"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+// 每个报文的控制信息缓冲区: 一个 `UDP_SEGMENT` (uint16_t) 或 `UDP_GRO` (int)
+constexpr std::size_t CONTROL_WORDS{CMSG_SPACE(sizeof(int)) / sizeof(std::uint64_t)};
+
+namespace batch_io
+{
+    send_batch::send_batch(int fd, std::size_t capacity, bool gso, std::size_t payload_size)
+        : m_fd{fd}, m_gso{gso}, m_capacity{capacity},
+          m_segment_size{sizeof(rtp_header) + payload_size},
+          m_segments_max{std::min(65507 / m_segment_size, GSO_SEGMENTS_MAX)}
+    {
+        if (m_gso && m_segments_max < 2)
+        {
+            log_debug("一个 UDP 报文放不下两个满长包, 不使用 GSO");
+            m_gso = false;
+        }
+        if (m_gso)
+        {
+            int zero{0};
+            if (setsockopt(m_fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == -1)
+            {
+                log_debug("内核不支持 `UDP_SEGMENT`, 退回普通批量发送: ",
+                          std::strerror(errno));
+                m_gso = false;
+            }
+        }
+        m_iovs_max = 2 * m_capacity * (m_gso ? m_segments_max : 1);
+        m_iovs.reserve(m_iovs_max);
+        m_msgs.resize(m_capacity);
+        m_controls.resize(m_capacity * CONTROL_WORDS);
+    }
+
+    void send_batch::record_destination()
+    {
+        if (m_destination.length == 0)
+        {
+            m_packet_destinations.push_back(NO_DESTINATION);
+            return;
+        }
+        if (m_destination_changed || m_destinations.empty())
+        {
+            m_destinations.push_back(m_destination);
+            m_destination_changed = false;
+        }
+        m_packet_destinations.push_back(static_cast<std::uint32_t>(m_destinations.size() - 1));
+    }
+
+    void send_batch::push(const rtp_header &packet)
+    {
+        record_destination();
+        m_iovs.push_back(
+            {const_cast<rtp_header *>(&packet), sizeof(rtp_header) + packet.get_length()});
+        m_iovs.push_back({nullptr, 0});
+        if (m_iovs.size() == m_iovs_max)
+            flush();
+    }
+
+    void send_batch::push(const rtp_header &header, const void *payload)
+    {
+        record_destination();
+        m_iovs.push_back({const_cast<rtp_header *>(&header), sizeof(rtp_header)});
+        m_iovs.push_back({const_cast<void *>(payload), header.get_length()});
+        if (m_iovs.size() == m_iovs_max)
+            flush();
+    }
+
+    void send_batch::set_destination(const socket_address &destination)
+    {
+        if (destination == m_destination)
+            return;
+        m_destination = destination;
+        m_destination_changed = true;
+    }
+
+    // 从 `m_iovs[first]` 开始填充 `m_msgs`, 返回填充的报文数.
+    // GSO 要求除最后一段外每段都恰为段长, 且发往同一个地址, 所以只有满长包后面才能继续追加.
+    std::size_t send_batch::build_messages(std::size_t first)
+    {
+        std::size_t n_msgs{0};
+        for (std::size_t i{first}; i < m_iovs.size() && n_msgs < m_capacity; n_msgs++)
+        {
+            msghdr &hdr{m_msgs[n_msgs].msg_hdr};
+            hdr = {};
+            hdr.msg_iov = &m_iovs[i];
+            std::uint32_t destination{m_packet_destinations[i / 2]};
+            if (destination != NO_DESTINATION)
+            {
+                hdr.msg_name = &m_destinations[destination].storage;
+                hdr.msg_namelen = m_destinations[destination].length;
+            }
+
+            auto wire_size{[this](std::size_t k) {
+                return m_iovs[k].iov_len + m_iovs[k + 1].iov_len;
+            }};
+            std::size_t n_segments{0};
+            do
+                n_segments++;
+            while (m_gso && i + 2 * n_segments < m_iovs.size() &&
+                   n_segments < m_segments_max &&
+                   wire_size(i + 2 * (n_segments - 1)) == m_segment_size &&
+                   m_packet_destinations[i / 2 + n_segments] == destination);
+            hdr.msg_iovlen = 2 * n_segments;
+            i += 2 * n_segments;
+
+            if (n_segments > 1)
+            {
+                hdr.msg_control = &m_controls[n_msgs * CONTROL_WORDS];
+                hdr.msg_controllen = CMSG_SPACE(sizeof(std::uint16_t));
+                cmsghdr *cmsg{CMSG_FIRSTHDR(&hdr)};
+                cmsg->cmsg_level = SOL_UDP;
+                cmsg->cmsg_type = UDP_SEGMENT;
+                cmsg->cmsg_len = CMSG_LEN(sizeof(std::uint16_t));
+                auto segment_size{static_cast<std::uint16_t>(m_segment_size)};
+                std::memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+            }
+        }
+        return n_msgs;
+    }
+
+    void send_batch::flush()
+    {
+        std::size_t first{0};
+        while (first < m_iovs.size())
+        {
+            std::size_t n_msgs{build_messages(first)};
+            std::size_t sent{0};
+            while (sent < n_msgs)
+            {
+                int ret{sendmmsg(m_fd, m_msgs.data() + sent, n_msgs - sent, 0)};
+                if (ret == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    // 网卡不支持校验和卸载等情况下内核会拒绝 GSO 报文
+                    if (m_gso && (errno == EIO || errno == EINVAL))
+                    {
+                        log_debug("GSO 报文被拒绝, 退回普通批量发送: ",
+                                  std::strerror(errno));
+                        m_gso = false;
+                        break;
+                    }
+                    error_process::unix_error("发送包失败: ");
+                }
+                for (int i{0}; i < ret; i++)
+                    first += m_msgs[sent + i].msg_hdr.msg_iovlen;
+                sent += ret;
+            }
+        }
+        m_iovs.clear();
+        m_packet_destinations.clear();
+        m_destinations.clear();
+    }
+
+    bool send_batch::is_gso_enabled() const { return m_gso; }
+
+    recv_batch::recv_batch(int fd, std::size_t capacity, bool gro, packet_pool &pool)
+        : m_fd{fd}, m_gro{gro}, m_pool{pool}, m_iovs(capacity), m_msgs(capacity),
+          m_sources(capacity)
+    {
+        if (m_gro)
+        {
+            int one{1};
+            if (setsockopt(m_fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) == -1)
+            {
+                log_debug("内核不支持 `UDP_GRO`, 退回逐个接收: ", std::strerror(errno));
+                m_gro = false;
+            }
+        }
+        if (m_gro)
+        {
+            m_gro_buffers.resize(capacity * GRO_BUFFER_SIZE);
+            m_controls.resize(capacity * CONTROL_WORDS);
+            for (std::size_t i{0}; i < capacity; i++)
+                m_iovs[i] = {&m_gro_buffers[i * GRO_BUFFER_SIZE], GRO_BUFFER_SIZE};
+            return;
+        }
+        m_handles.resize(capacity);
+        for (std::size_t i{0}; i < capacity; i++)
+        {
+            m_handles[i] = m_pool.acquire();
+            m_iovs[i] = {m_pool.data(m_handles[i]), m_pool.buffer_size()};
+        }
+    }
+
+    recv_batch::~recv_batch()
+    {
+        for (packet_pool::handle h : m_handles)
+            m_pool.release(h);
+    }
+
+    std::size_t recv_batch::recv()
+    {
+        for (std::size_t i{0}; i < m_msgs.size(); i++)
+        {
+            msghdr &hdr{m_msgs[i].msg_hdr};
+            hdr = {};
+            hdr.msg_iov = &m_iovs[i];
+            hdr.msg_iovlen = 1;
+            hdr.msg_name = &m_sources[i].storage;
+            hdr.msg_namelen = sizeof(m_sources[i].storage);
+            if (m_gro)
+            {
+                hdr.msg_control = &m_controls[i * CONTROL_WORDS];
+                hdr.msg_controllen = CONTROL_WORDS * sizeof(std::uint64_t);
+            }
+        }
+
+        m_packets.clear();
+        m_lengths.clear();
+        m_messages.clear();
+        int ret{recvmmsg(m_fd, m_msgs.data(), m_msgs.size(), MSG_DONTWAIT, nullptr)};
+        if (ret == -1)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                return 0;
+            error_process::unix_error("接收包时发生了问题: ");
+        }
+
+        for (int i{0}; i < ret; i++)
+        {
+            msghdr &hdr{m_msgs[i].msg_hdr};
+            m_sources[i].length = hdr.msg_namelen;
+            char *data{static_cast<char *>(m_iovs[i].iov_base)};
+            std::size_t remain{m_msgs[i].msg_len};
+            std::size_t segment_size{remain};
+            if (m_gro)
+            {
+                for (cmsghdr *cmsg{CMSG_FIRSTHDR(&hdr)}; cmsg != nullptr;
+                     cmsg = CMSG_NXTHDR(&hdr, cmsg))
+                {
+                    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO)
+                    {
+                        int size;
+                        std::memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+                        segment_size = size;
+                    }
+                }
+            }
+            if (segment_size == 0)
+                segment_size = 1;
+            do
+            {
+                std::size_t length{remain < segment_size ? remain : segment_size};
+                m_packets.push_back(data);
+                m_lengths.push_back(length);
+                m_messages.push_back(i);
+                data += length;
+                remain -= length;
+            } while (remain > 0);
+        }
+        return m_packets.size();
+    }
+
+    packet_view recv_batch::operator[](std::size_t i) { return packet_view{m_packets[i]}; }
+
+    std::size_t recv_batch::length(std::size_t i) const { return m_lengths[i]; }
+
+    const socket_address &recv_batch::source(std::size_t i) const
+    {
+        return m_sources[m_messages[i]];
+    }
+
+    // 不合并时每个报文只有一个包, 换上新的缓冲区即可
+    packet_pool::handle recv_batch::take(std::size_t i)
+    {
+        if (m_gro)
+            return packet_pool::NO_HANDLE;
+        std::size_t message{m_messages[i]};
+        packet_pool::handle taken{m_handles[message]};
+        m_handles[message] = m_pool.acquire();
+        m_iovs[message].iov_base = m_pool.data(m_handles[message]);
+        return taken;
+    }
+
+    bool recv_batch::is_gro_enabled() const { return m_gro; }
+}
@@ -0,0 +1,108 @@
+#ifndef BATCH_IO_HXX
+#define BATCH_IO_HXX
+
+#include "packet_pool.hxx"
+#include "rtp_header.hxx"
+#include "socket_process.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <vector>
+
+// 基于 `sendmmsg()` / `recvmmsg()` 的批量收发. 两端的套接字在握手后通常都已
+// `connect()`; 服务器模式的套接字没有连接, 发送前要用 `set_destination()` 指定对端.
+namespace batch_io
+{
+    // 内核单个 GSO 报文最多切成 64 段, 且总长不超过一个 UDP 报文.
+    constexpr std::size_t GSO_SEGMENTS_MAX{64};
+    constexpr std::size_t GRO_BUFFER_SIZE{65536};
+
+    class send_batch
+    {
+    private:
+        int m_fd;
+        bool m_gso;
+        std::size_t m_capacity;
+        // 满长包的长度, 即 GSO 的段长, 以及一个 GSO 报文最多的段数
+        std::size_t m_segment_size;
+        std::size_t m_segments_max;
+        // 每个包占两个 iovec: 包头 (或整个连续的包) 与外部负载. 攒满 `m_iovs_max` 个就发送
+        std::size_t m_iovs_max;
+        std::vector<iovec> m_iovs;
+        std::vector<mmsghdr> m_msgs;
+        std::vector<std::uint64_t> m_controls;
+
+        // 当前的目的地址, 以及本批用到的各个目的地址和每个包对应的下标
+        static constexpr std::uint32_t NO_DESTINATION{~std::uint32_t{0}};
+        socket_address m_destination;
+        bool m_destination_changed{false};
+        std::vector<socket_address> m_destinations;
+        std::vector<std::uint32_t> m_packet_destinations;
+
+        void record_destination();
+        std::size_t build_messages(std::size_t first);
+
+    public:
+        send_batch &operator=(const send_batch &) = delete;
+        send_batch(const send_batch &) = delete;
+
+        // `gso` 为 true 时尝试用 `UDP_SEGMENT` 把连续的满长包 (负载为 `payload_size`)
+        // 合并成一个报文交给内核, 内核不支持或一个报文放不下两个包则退回普通的批量发送.
+        send_batch(int fd, std::size_t capacity, bool gso = false,
+                   std::size_t payload_size = PAYLOAD_MAX);
+
+        // 加入一个待发送的包, 攒满后自动发送.
+        // 包的内存在 `flush()` 之前必须保持有效.
+        void push(const rtp_header &packet);
+        // 同上, 但负载不紧跟在包头之后, 而是位于 `payload`
+        void push(const rtp_header &header, const void *payload);
+        void flush();
+
+        // 之后加入的包都发往 `destination`
+        void set_destination(const socket_address &destination);
+
+        bool is_gso_enabled() const;
+    };
+
+    class recv_batch
+    {
+    private:
+        int m_fd;
+        bool m_gro;
+        // 不合并时每个报文接收到池中的一个缓冲区, 合并时接收到 `m_gro_buffers`
+        packet_pool &m_pool;
+        std::vector<packet_pool::handle> m_handles;
+        std::vector<char> m_gro_buffers;
+        std::vector<iovec> m_iovs;
+        std::vector<mmsghdr> m_msgs;
+        std::vector<std::uint64_t> m_controls;
+        std::vector<socket_address> m_sources;
+
+        // 拆分之后的每个包, 以及它所在的报文
+        std::vector<char *> m_packets;
+        std::vector<std::size_t> m_lengths;
+        std::vector<std::size_t> m_messages;
+
+    public:
+        recv_batch &operator=(const recv_batch &) = delete;
+        recv_batch(const recv_batch &) = delete;
+
+        // `gro` 为 true 时尝试打开 `UDP_GRO`, 收到的合并报文会按段长拆回单个包.
+        // 不合并时每个报文直接接收到 `pool` 的一个缓冲区中.
+        recv_batch(int fd, std::size_t capacity, bool gro, packet_pool &pool);
+        ~recv_batch();
+
+        // 不阻塞地取出已到达的包, 最多 `capacity` 个报文, 返回拆分后的包数.
+        [[nodiscard]] std::size_t recv();
+
+        packet_view operator[](std::size_t i);
+        std::size_t length(std::size_t i) const;
+        const socket_address &source(std::size_t i) const;
+        // 见 `event_loop::take()`
+        packet_pool::handle take(std::size_t i);
+
+        bool is_gro_enabled() const;
+    };
+}
+
+#endif
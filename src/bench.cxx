@@ -0,0 +1,875 @@
+#include "checksum.hxx"
+#include "compression.hxx"
+#include "congestion.hxx"
+#include "error_process.hxx"
+#include "event_loop.hxx"
+#include "extension.hxx"
+#include "fec.hxx"
+#include "metrics.hxx"
+#include "options.hxx"
+#include "receive_session.hxx"
+#include "rto.hxx"
+#include "rtp_header.hxx"
+#include "sack.hxx"
+#include "timing_wheel.hxx"
+#include "tools.hxx"
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// 基准测试. 每个结果输出一行 JSON 到标准输出, 便于比较不同的构建:
+//   rtp_bench micro [--filter=子串] [--min-time=毫秒]
+//     库中热点函数的微基准, 结果为每次操作的纳秒数.
+//   rtp_bench e2e [--sizes=1M,100M] [--modes=0,1] [--windows=64] [--corpora=random,text]
+//                 [--dir=目录] [--sender-options="..."] [--receiver-options="..."]
+//                 [--losses=0,0.02] [--proxy-options="..."]
+//     在回环上用同目录下的 sender 与 receiver 传输生成的文件, 报告吞吐量、
+//     每字节的 CPU 时间、重传比例与线路上的负载字节数相对文件大小的比例.
+//     比较压缩时可以加上 `--sender-options="--compress"`. 给出 `--losses` 时中间
+//     夹一个按各丢包率丢包的 rtp_proxy, 例如用 `--proxy-options="--delay=25"` 与
+//     `--sender-options="--fec=16,2"` 比较 FEC 与单靠重传的完成时间.
+//
+// 发送端的 `process_ack()` 与发送窗口一起是 sender.cxx 中的全局状态, 无法单独调用;
+// 这里分别测它每个 ACK 用到的时间轮、拥塞控制、RTT 估计与选择确认解码.
+
+using bench_clock = std::chrono::steady_clock;
+
+[[noreturn]] static void usage(const char *program)
+{
+    logs::error("参数错误. 你可以这样使用: ", program,
+                " [micro|e2e] [--option=value ...], 选项见 `bench.cxx`");
+    std::exit(EXIT_FAILURE);
+}
+
+// 阻止编译器把被测的计算优化掉
+template <typename T> static void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static std::size_t parse_number(std::string_view key, std::string_view value)
+{
+    std::size_t result;
+    auto [ptr, ec]{std::from_chars(value.data(), value.data() + value.size(), result)};
+    if (ec != std::errc{} || ptr != value.data() + value.size())
+        logs::error("选项 `--", key, "` 的值 `", value, "` 不合法");
+    return result;
+}
+
+static double parse_probability(std::string_view key, std::string_view value)
+{
+    double result;
+    auto [ptr, ec]{std::from_chars(value.data(), value.data() + value.size(), result)};
+    if (ec != std::errc{} || ptr != value.data() + value.size() || !(result >= 0 && result <= 1))
+        logs::error("选项 `--", key, "` 的值 `", value, "` 不合法, 应在 0 与 1 之间");
+    return result;
+}
+
+// 可以带 K, M, G 后缀 (1024 的幂)
+static std::size_t parse_bytes(std::string_view key, std::string_view value)
+{
+    std::size_t shift{0};
+    if (!value.empty())
+    {
+        switch (value.back())
+        {
+        case 'K':
+            shift = 10;
+            break;
+        case 'M':
+            shift = 20;
+            break;
+        case 'G':
+            shift = 30;
+            break;
+        }
+        if (shift > 0)
+            value.remove_suffix(1);
+    }
+    return parse_number(key, value) << shift;
+}
+
+template <typename F>
+static auto parse_list(std::string_view key, std::string_view value, F parse)
+{
+    std::vector<decltype(parse(key, value))> result;
+    while (!value.empty())
+    {
+        std::size_t comma{value.find(',')};
+        result.push_back(parse(key, value.substr(0, comma)));
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+    }
+    if (result.empty())
+        logs::error("选项 `--", key, "` 不能为空");
+    return result;
+}
+
+// 把 `--key=value` 拆开交给 `parse`
+template <typename F> static void for_each_option(int argc, char **argv, F parse)
+{
+    for (int i{2}; i < argc; i++)
+    {
+        std::string_view arg{argv[i]};
+        if (!arg.starts_with("--"))
+            logs::error("选项 `", arg, "` 不合法, 应形如 `--key=value`");
+        arg.remove_prefix(2);
+        std::size_t pos{arg.find('=')};
+        parse(arg.substr(0, pos),
+              pos == std::string_view::npos ? std::string_view{} : arg.substr(pos + 1));
+    }
+}
+
+// 生成的数据: `random` 是随机字节, 压缩不了; `text` 轮流是日志行、CSV 行与 JSON 对象,
+// 字段取值随机, 接近需要压缩的那类文件
+enum class corpus_kind
+{
+    random,
+    text,
+};
+
+static corpus_kind parse_corpus(std::string_view key, std::string_view value)
+{
+    if (value == "random")
+        return corpus_kind::random;
+    if (value == "text")
+        return corpus_kind::text;
+    logs::error("选项 `--", key, "` 的值 `", value, "` 不合法, 应为 random 或 text");
+    return corpus_kind::random;
+}
+
+static const char *corpus_name(corpus_kind kind)
+{
+    return kind == corpus_kind::random ? "random" : "text";
+}
+
+// 在 `out` 后面追加大约 `n` 字节 (文本按整行追加, 会略多一些)
+static void append_corpus(std::string &out, corpus_kind kind, std::size_t n,
+                          std::mt19937_64 &random)
+{
+    std::size_t target{out.size() + n};
+    if (kind == corpus_kind::random)
+    {
+        while (out.size() < target)
+        {
+            std::uint64_t word{random()};
+            out.append(reinterpret_cast<const char *>(&word), sizeof(word));
+        }
+        out.resize(target);
+        return;
+    }
+
+    constexpr const char *LEVELS[]{"INFO", "WARN", "DEBUG", "ERROR"};
+    constexpr const char *PATHS[]{"/api/v1/users", "/api/v1/orders", "/static/app.js",
+                                  "/healthz"};
+    for (std::size_t line{0}; out.size() < target; line++)
+    {
+        auto id{random() % 1000000};
+        auto latency{random() % 5000};
+        const char *level{LEVELS[random() % 4]};
+        const char *path{PATHS[random() % 4]};
+        switch (line % 3)
+        {
+        case 0:
+            out += "2024-05-17T12:" + std::to_string(10 + random() % 50) + ':' +
+                   std::to_string(10 + random() % 50) + "Z [" + level + "] request_id=" +
+                   std::to_string(id) + " path=" + path + " latency_us=" + std::to_string(latency) +
+                   '\n';
+            break;
+        case 1:
+            out += std::to_string(id) + ',' + level + ',' + path + ',' + std::to_string(latency) +
+                   ",true\n";
+            break;
+        default:
+            out += "{\"id\":" + std::to_string(id) + ",\"level\":\"" + level + "\",\"path\":\"" +
+                   path + "\",\"latency_us\":" + std::to_string(latency) + "}\n";
+            break;
+        }
+    }
+}
+
+namespace micro
+{
+    std::string filter;
+    bench_clock::duration min_time{std::chrono::milliseconds{200}};
+
+    // 反复运行 `f`, 次数翻倍直到用时超过 `min_time`, 返回每次的纳秒数
+    template <typename F> double measure(F f)
+    {
+        for (std::size_t n{1};; n *= 2)
+        {
+            auto start{bench_clock::now()};
+            for (std::size_t i{0}; i < n; i++)
+                f();
+            auto elapsed{bench_clock::now() - start};
+            if (elapsed >= min_time || n >= std::size_t{1} << 40)
+                return std::chrono::duration<double, std::nano>{elapsed}.count() /
+                       static_cast<double>(n);
+        }
+    }
+
+    // `params` 是已经格式化好的 JSON 成员, 例如 `"window":64`. `bytes` 为 0 时不输出带宽.
+    template <typename F>
+    void run(std::string_view name, const std::string &params, std::size_t bytes, F f)
+    {
+        std::string full_name{std::string{name} + ' ' + params};
+        if (!filter.empty() && full_name.find(filter) == std::string::npos)
+            return;
+        double ns{measure(f)};
+        std::cout << "{\"bench\":\"" << name << '"' << (params.empty() ? "" : ",") << params
+                  << ",\"ns_per_op\":" << ns;
+        if (bytes > 0)
+            std::cout << ",\"bytes_per_s\":" << static_cast<double>(bytes) / ns * 1e9;
+        std::cout << '}' << std::endl;
+    }
+
+    // 不收发任何东西的事件循环, 只数调用次数. 接收缓冲区与真正的事件循环一样来自池.
+    class null_loop : public event_loop
+    {
+    public:
+        std::size_t m_n_pushed{0};
+        // 每轮收到一个包, 包头由调用者填入 `operator[](0)`
+        packet_pool m_pool{PAYLOAD_MAX, 1};
+        packet_pool::handle m_receiving{m_pool.acquire()};
+        packet_pool::handle m_delivered{packet_pool::NO_HANDLE};
+
+        using event_loop::start_timer;
+        void push(const rtp_header &) override { m_n_pushed++; }
+        void push(const rtp_header &, const void *) override { m_n_pushed++; }
+        void push_copy(const rtp_header &) override { m_n_pushed++; }
+        void flush() override {}
+        void set_destination(const socket_address &) override {}
+        void watch_readable(int) override {}
+        void start_timer(int, std::chrono::microseconds) override {}
+        void stop_timer(int) override {}
+        void write_file(int, const void *, std::size_t, off_t) override {}
+        void drain() override {}
+        void wait() override
+        {
+            m_delivered = m_receiving;
+            m_n_packets = 1;
+        }
+        packet_view operator[](std::size_t) override { return m_pool[m_delivered]; }
+        std::size_t length(std::size_t) const override { return 0; }
+        const socket_address *source(std::size_t) const override { return nullptr; }
+        packet_pool &pool() override { return m_pool; }
+
+        packet_pool::handle take(std::size_t) override
+        {
+            m_receiving = m_pool.acquire();
+            return m_delivered;
+        }
+    };
+
+    void bench_checksum()
+    {
+        std::vector<char> data(sizeof(rtp_header) + PAYLOAD_MAX);
+        std::mt19937 random{1};
+        for (auto &c : data)
+            c = static_cast<char>(random());
+        for (std::size_t bytes : {sizeof(rtp_header), data.size()})
+        {
+            run("compute_checksum", "\"bytes\":" + std::to_string(bytes), bytes,
+                [&] { keep(compute_checksum(data.data(), bytes)); });
+            for (auto engine : {checksum_engine::bytewise, checksum_engine::slicing_by_8,
+                                checksum_engine::slicing_by_16, checksum_engine::pclmul})
+            {
+                if (!checksum::is_supported(engine))
+                    continue;
+                std::ostringstream params;
+                params << "\"engine\":\"" << engine << "\",\"bytes\":" << bytes;
+                run("checksum_engine", params.str(), bytes,
+                    [&] { keep(checksum::compute(engine, data.data(), bytes)); });
+            }
+        }
+    }
+
+    void bench_packet()
+    {
+        rtp_packet packet;
+        std::memset(packet.get_buf(), 'x', PAYLOAD_MAX);
+        for (std::uint16_t length : {std::uint16_t{0}, static_cast<std::uint16_t>(PAYLOAD_MAX)})
+        {
+            std::string params{"\"payload\":" + std::to_string(length)};
+            std::uint32_t seq_num{0};
+            run("make_packet", params, sizeof(rtp_header) + length,
+                [&]
+                {
+                    packet.make_packet(seq_num++, length, 0);
+                    keep(packet);
+                });
+            packet.make_packet(1, length, 0);
+            run("is_valid", params, sizeof(rtp_header) + length,
+                [&] { keep(packet.is_valid()); });
+        }
+    }
+
+    // 接收端处理一个数据包 (`process_new_packet()` 现在是 `receive_session::process()`),
+    // 每 32 个包合并发出一次 ACK, 与主循环每批收包后的做法相同. 按顺序写出时窗口
+    // 接管收到包的缓冲区, 每个包只复制包头 (代替内核写入).
+    // `reordered` 时每两个包交换顺序, 走乱序缓存的路径.
+    template <mode_type mode> void bench_receive(std::size_t window_size, bool reordered)
+    {
+        constexpr std::size_t BATCH{32};
+        null_loop loop;
+        transfer_metrics metrics;
+        transfer_options options;
+        options.ack_every = BATCH;
+        handshake_extensions extensions;
+        extensions.sack = true;
+        receive_session<mode> session{loop, metrics, "/dev/null", window_size, 1, options,
+                                      extensions};
+
+        rtp_packet packet;
+        packet.make_packet(0, static_cast<std::uint16_t>(PAYLOAD_MAX), 0);
+        std::uint32_t next{1};
+        std::size_t n{0};
+        std::ostringstream params;
+        // 与命令行的 [mode] 一致: 0 为回退 N, 1 为选择重传
+        params << "\"mode\":" << static_cast<int>(mode) << ",\"window\":" << window_size
+               << ",\"reordered\":" << (reordered ? "true" : "false");
+        run("receive_packet", params.str(), PAYLOAD_MAX,
+            [&]
+            {
+                std::uint32_t seq_num{next};
+                if (reordered)
+                    seq_num = next % 2 == 1 ? next + 1 : next - 1;
+                next++;
+                // 会话不检查校验和, 直接改写包头第一个字段 `seq_num`
+                std::memcpy(reinterpret_cast<char *>(&packet), &seq_num, sizeof(seq_num));
+                loop.wait();
+                std::memcpy(loop[0].data(), &packet, sizeof(rtp_header));
+                keep(session.process(0));
+                if (++n % BATCH == 0)
+                    session.push_pending_ack(receive_session<mode>::clock::now());
+            });
+        keep(loop.m_n_pushed);
+    }
+
+    // 发送端每个 ACK 的开销: 选择重传取消一个重传定时器并为下一个包设定新的
+    void bench_timing_wheel(std::size_t window_size)
+    {
+        timing_wheel wheel{window_size};
+        auto now{timing_wheel::clock::now()};
+        for (std::size_t id{0}; id < window_size; id++)
+            wheel.schedule(id, now + std::chrono::milliseconds{100});
+        std::size_t id{0};
+        run("timing_wheel_ack", "\"window\":" + std::to_string(window_size), 0,
+            [&]
+            {
+                wheel.cancel(id);
+                keep(wheel.schedule(id, now + std::chrono::milliseconds{100}));
+                id = (id + 1) % window_size;
+            });
+    }
+
+    void bench_congestion()
+    {
+        for (auto algorithm : {congestion_algorithm::fixed, congestion_algorithm::reno,
+                               congestion_algorithm::cubic, congestion_algorithm::bbr})
+        {
+            auto congestion{make_congestion_control(algorithm, 1024)};
+            auto now{congestion_control::clock::now()};
+            std::ostringstream params;
+            params << "\"cc\":\"" << algorithm << '"';
+            run("congestion_on_ack", params.str(), 0,
+                [&]
+                {
+                    now += std::chrono::microseconds{10};
+                    congestion->on_ack(1, std::chrono::microseconds{1000}, now);
+                    keep(congestion->window());
+                });
+        }
+    }
+
+    void bench_rto()
+    {
+        rto_estimator rto{std::chrono::milliseconds{10}, std::chrono::milliseconds{5000}};
+        std::int64_t rtt{900};
+        run("rto_sample", "", 0,
+            [&]
+            {
+                rtt = rtt == 900 ? 1100 : 900;
+                rto.sample(std::chrono::microseconds{rtt});
+                keep(rto.timeout());
+            });
+    }
+
+    // 位图中一半的包已收到
+    void bench_sack_decode(std::size_t bitmap_bytes)
+    {
+        rtp_packet ack;
+        std::memset(ack.get_buf(), 0x55, bitmap_bytes);
+        ack.make_packet(1, static_cast<std::uint16_t>(bitmap_bytes), ACK);
+        run("sack_decode", "\"bitmap_bytes\":" + std::to_string(bitmap_bytes), 0,
+            [&]
+            {
+                std::size_t sum{0};
+                sack::for_each(ack, 1, [&](std::size_t seq_num) { sum += seq_num; });
+                keep(sum);
+            });
+    }
+
+    // 每个包单独压缩与解压, 与发送端和接收端的做法相同. `ratio` 是压缩后的总字节数
+    // (压缩不了的包按原长计) 与原长之比, 带宽按压缩前的字节数计.
+    void bench_compression(corpus_kind kind)
+    {
+        constexpr std::size_t N_PACKETS{64};
+        std::string data;
+        std::mt19937_64 random{1};
+        append_corpus(data, kind, N_PACKETS * PAYLOAD_MAX, random);
+
+        compression::compressor compressor;
+        std::vector<char> compressed(N_PACKETS * PAYLOAD_MAX);
+        std::vector<std::size_t> lengths(N_PACKETS);
+        std::size_t total{0};
+        for (std::size_t i{0}; i < N_PACKETS; i++)
+        {
+            lengths[i] = compressor.compress(data.data() + i * PAYLOAD_MAX, PAYLOAD_MAX,
+                                             compressed.data() + i * PAYLOAD_MAX);
+            total += lengths[i] > 0 ? lengths[i] : PAYLOAD_MAX;
+        }
+        std::ostringstream params;
+        params << "\"corpus\":\"" << corpus_name(kind)
+               << "\",\"ratio\":" << static_cast<double>(total) / (N_PACKETS * PAYLOAD_MAX);
+
+        std::vector<char> packet(PAYLOAD_MAX);
+        std::size_t i{0};
+        run("compress", params.str(), PAYLOAD_MAX,
+            [&]
+            {
+                keep(compressor.compress(data.data() + i * PAYLOAD_MAX, PAYLOAD_MAX,
+                                         packet.data()));
+                i = (i + 1) % N_PACKETS;
+            });
+
+        // 压缩不了的包接收端直接写出, 不经过解压
+        std::vector<std::size_t> decodable;
+        for (std::size_t j{0}; j < N_PACKETS; j++)
+            if (lengths[j] > 0)
+                decodable.push_back(j);
+        if (decodable.empty())
+            return;
+        i = 0;
+        run("decompress", params.str(), PAYLOAD_MAX,
+            [&]
+            {
+                std::size_t j{decodable[i]};
+                keep(compression::decompress(compressed.data() + j * PAYLOAD_MAX, lengths[j],
+                                             packet.data(), packet.size()));
+                i = (i + 1) % decodable.size();
+            });
+    }
+
+    void bench_gf_multiply_add()
+    {
+        std::vector<char> src(PAYLOAD_MAX, 0x5A), dst(PAYLOAD_MAX);
+        run("gf_multiply_add", "", PAYLOAD_MAX,
+            [&]
+            {
+                fec::multiply_add(0x8E, src.data(), dst.data(), src.size());
+                keep(dst[0]);
+            });
+    }
+
+    // 数据包的负载为协商了 FEC 时的最大长度. `fec_encode` 每次加入一个数据包, 组满时
+    // 作出校验包, 带宽按数据包的负载计; `fec_recover` 每次加入一组中除前 `parity` 个
+    // 以外的数据包与全部校验包, 再解出缺的包, 带宽按整组的负载计.
+    void bench_fec(std::size_t group_size, std::size_t n_parity)
+    {
+        fec::parameters parameters{static_cast<std::uint8_t>(group_size),
+                                   static_cast<std::uint8_t>(n_parity)};
+        constexpr std::size_t PAYLOAD_SIZE{PAYLOAD_MAX - fec::OVERHEAD};
+        std::vector<rtp_packet> data(group_size), parity(n_parity);
+        std::mt19937_64 random{1};
+        for (std::size_t i{0}; i < group_size; i++)
+        {
+            for (std::size_t k{0}; k < PAYLOAD_SIZE; k++)
+                data[i].get_buf()[k] = static_cast<char>(random());
+            data[i].make_packet(static_cast<std::uint32_t>(i), PAYLOAD_SIZE, 0);
+        }
+        std::string params{"\"group\":" + std::to_string(group_size) +
+                           ",\"parity\":" + std::to_string(n_parity)};
+
+        fec::encoder encoder{parameters, PAYLOAD_SIZE};
+        std::size_t i{0};
+        run("fec_encode", params, PAYLOAD_SIZE,
+            [&]
+            {
+                encoder.add(data[i], data[i].get_buf());
+                if (++i == group_size)
+                {
+                    for (std::size_t j{0}; j < n_parity; j++)
+                        encoder.make_parity(j, 0, parity[j]);
+                    encoder.reset();
+                    i = 0;
+                }
+            });
+
+        for (const auto &packet : data)
+            encoder.add(packet, packet.get_buf());
+        for (std::size_t j{0}; j < n_parity; j++)
+            encoder.make_parity(j, 0, parity[j]);
+
+        fec::decoder decoder{parameters, PAYLOAD_SIZE, 64, 0};
+        std::size_t first_seq_num{0};
+        run("fec_recover", params, group_size * PAYLOAD_SIZE,
+            [&]
+            {
+                for (std::size_t k{n_parity}; k < group_size; k++)
+                    decoder.add_data(first_seq_num + k, data[k], data[k].get_buf());
+                for (auto &packet : parity)
+                    decoder.add_parity(first_seq_num, packet);
+                keep(decoder.recover(first_seq_num).size());
+                first_seq_num += group_size;
+            });
+    }
+
+    void main(int argc, char **argv)
+    {
+        for_each_option(argc, argv,
+                        [](std::string_view key, std::string_view value)
+                        {
+                            if (key == "filter")
+                                filter = value;
+                            else if (key == "min-time")
+                                min_time = std::chrono::milliseconds{parse_number(key, value)};
+                            else
+                                logs::error("未知的选项 `--", key, '`');
+                        });
+
+        bench_checksum();
+        bench_packet();
+        for (std::size_t window_size : {16, 64, 256, 1024})
+            for (bool reordered : {false, true})
+            {
+                bench_receive<mode_type::go_back_n>(window_size, reordered);
+                bench_receive<mode_type::selective_repeat>(window_size, reordered);
+            }
+        for (std::size_t window_size : {16, 64, 256, 1024})
+            bench_timing_wheel(window_size);
+        bench_congestion();
+        bench_rto();
+        for (std::size_t bitmap_bytes : {8, 128})
+            bench_sack_decode(bitmap_bytes);
+        for (auto kind : {corpus_kind::text, corpus_kind::random})
+            bench_compression(kind);
+        bench_gf_multiply_add();
+        for (auto [group_size, n_parity] : {std::pair{16, 1}, {16, 2}, {16, 4}, {64, 4}})
+            bench_fec(group_size, n_parity);
+    }
+}
+
+namespace e2e
+{
+    std::vector<std::size_t> sizes{1 << 20, 100 << 20};
+    std::vector<std::size_t> modes{0, 1};
+    std::vector<std::size_t> windows{64};
+    std::vector<corpus_kind> corpora{corpus_kind::random};
+    std::filesystem::path directory{std::filesystem::temp_directory_path()};
+    std::vector<std::string> sender_options;
+    std::vector<std::string> receiver_options;
+    // 为空时 sender 直接发给 receiver
+    std::vector<double> losses;
+    std::vector<std::string> proxy_options;
+
+    // receiver 在 sender 结束后还要挥手, 超过这么久就认为它卡住了
+    constexpr std::chrono::seconds RECEIVER_GRACE{10};
+
+    std::vector<std::string> split(std::string_view value)
+    {
+        std::vector<std::string> result;
+        while (!value.empty())
+        {
+            std::size_t space{value.find(' ')};
+            if (space != 0)
+                result.emplace_back(value.substr(0, space));
+            value = space == std::string_view::npos ? std::string_view{} : value.substr(space + 1);
+        }
+        return result;
+    }
+
+    void generate_file(const std::filesystem::path &path, std::size_t size, corpus_kind kind)
+    {
+        std::ofstream ofs{path, std::ios::binary | std::ios::trunc};
+        if (ofs.fail())
+            logs::error("打开文件 `", path.string(), "` 时出现了问题");
+        std::mt19937_64 random{size};
+        std::string chunk;
+        for (std::size_t written{0}; written < size;)
+        {
+            chunk.clear();
+            append_corpus(chunk, kind, std::min<std::size_t>(size - written, 1 << 20), random);
+            std::size_t n{std::min(size - written, chunk.size())};
+            ofs.write(chunk.data(), static_cast<std::streamsize>(n));
+            written += n;
+        }
+        if (ofs.fail())
+            logs::error("写文件 `", path.string(), "` 时出现了问题");
+    }
+
+    bool same_file(const std::filesystem::path &lhs, const std::filesystem::path &rhs)
+    {
+        std::ifstream a{lhs, std::ios::binary}, b{rhs, std::ios::binary};
+        std::vector<char> buf_a(1 << 20), buf_b(1 << 20);
+        while (a && b)
+        {
+            a.read(buf_a.data(), static_cast<std::streamsize>(buf_a.size()));
+            b.read(buf_b.data(), static_cast<std::streamsize>(buf_b.size()));
+            if (a.gcount() != b.gcount() ||
+                std::memcmp(buf_a.data(), buf_b.data(), static_cast<std::size_t>(a.gcount())))
+                return false;
+        }
+        return a.eof() && b.eof();
+    }
+
+    // 输出写到 `log_path`
+    pid_t spawn(const std::vector<std::string> &args, const std::filesystem::path &log_path)
+    {
+        logs::flush();
+        pid_t pid{fork()};
+        if (pid == -1)
+            error_process::unix_error("`fork()` 错误: ");
+        if (pid == 0)
+        {
+            int fd{::open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+            if (fd >= 0)
+            {
+                dup2(fd, STDOUT_FILENO);
+                dup2(fd, STDERR_FILENO);
+            }
+            std::vector<char *> argv;
+            for (const auto &arg : args)
+                argv.push_back(const_cast<char *>(arg.c_str()));
+            argv.push_back(nullptr);
+            execv(argv[0], argv.data());
+            _exit(127);
+        }
+        return pid;
+    }
+
+    struct child_result
+    {
+        bool succeeded{false};
+        // 用户态与内核态时间之和
+        double cpu_seconds{0};
+    };
+
+    // `deadline` 为空时一直等待, 否则到时杀死子进程
+    child_result wait_child(pid_t pid, std::optional<bench_clock::time_point> deadline)
+    {
+        int status;
+        rusage usage{};
+        while (true)
+        {
+            pid_t ret{wait4(pid, &status, deadline ? WNOHANG : 0, &usage)};
+            if (ret == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                error_process::unix_error("`wait4()` 错误: ");
+            }
+            if (ret == pid)
+                break;
+            if (bench_clock::now() >= *deadline)
+            {
+                kill(pid, SIGKILL);
+                deadline.reset();
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }
+        auto seconds{[](const timeval &tv) { return tv.tv_sec + tv.tv_usec / 1e6; }};
+        return {WIFEXITED(status) && WEXITSTATUS(status) == 0,
+                seconds(usage.ru_utime) + seconds(usage.ru_stime)};
+    }
+
+    // 从统计 JSON (见 `metrics.hxx`) 中取出第一个 `"key":` 后面的数
+    double json_number(const std::string &text, std::string_view key)
+    {
+        std::string pattern{'"' + std::string{key} + "\":"};
+        std::size_t pos{text.find(pattern)};
+        if (pos == std::string::npos)
+            return 0;
+        return std::strtod(text.c_str() + pos + pattern.size(), nullptr);
+    }
+
+    std::string read_file(const std::filesystem::path &path)
+    {
+        std::ifstream ifs{path};
+        return {std::istreambuf_iterator<char>{ifs}, std::istreambuf_iterator<char>{}};
+    }
+
+    void run_one(const std::filesystem::path &bin, const std::filesystem::path &work,
+                 const std::filesystem::path &input, std::size_t size, corpus_kind kind,
+                 std::size_t mode, std::size_t window, std::optional<double> loss, int port)
+    {
+        auto output{work / "out"}, sender_stats{work / "sender.json"};
+        std::filesystem::remove(output);
+        std::filesystem::remove(sender_stats);
+
+        // 有代理时 receiver 监听下一个端口
+        int receiver_port{loss ? port + 1 : port};
+        std::optional<pid_t> proxy;
+        if (loss)
+        {
+            std::vector<std::string> proxy_args{(bin / "rtp_proxy").string(), std::to_string(port),
+                                                "127.0.0.1", std::to_string(receiver_port),
+                                                "--loss=" + std::to_string(*loss)};
+            proxy_args.insert(proxy_args.end(), proxy_options.begin(), proxy_options.end());
+            proxy = spawn(proxy_args, work / "proxy.log");
+        }
+        std::vector<std::string> receiver_args{
+            (bin / "receiver").string(), std::to_string(receiver_port), output.string(),
+            std::to_string(window), std::to_string(mode)};
+        receiver_args.insert(receiver_args.end(), receiver_options.begin(),
+                             receiver_options.end());
+        std::vector<std::string> sender_args{(bin / "sender").string(),
+                                             "127.0.0.1",
+                                             std::to_string(port),
+                                             input.string(),
+                                             std::to_string(window),
+                                             std::to_string(mode),
+                                             "--stats=" + sender_stats.string()};
+        sender_args.insert(sender_args.end(), sender_options.begin(), sender_options.end());
+
+        pid_t receiver{spawn(receiver_args, work / "receiver.log")};
+        std::this_thread::sleep_for(std::chrono::milliseconds{200});
+        auto start{bench_clock::now()};
+        pid_t sender{spawn(sender_args, work / "sender.log")};
+        auto sender_result{wait_child(sender, std::nullopt)};
+        std::chrono::duration<double> elapsed{bench_clock::now() - start};
+        auto receiver_result{wait_child(receiver, bench_clock::now() + RECEIVER_GRACE)};
+        if (proxy)
+        {
+            kill(*proxy, SIGINT);
+            wait_child(*proxy, bench_clock::now() + RECEIVER_GRACE);
+        }
+
+        bool ok{sender_result.succeeded && receiver_result.succeeded && same_file(input, output)};
+        std::string stats{read_file(sender_stats)};
+        double packets_sent{json_number(stats, "packets_sent")};
+        double retransmitted{json_number(stats, "packets_retransmitted")};
+        double payload_bytes{json_number(stats, "payload_bytes_sent")};
+        double parity_sent{json_number(stats, "parity_packets_sent")};
+        auto per_byte{[size](double seconds) { return size > 0 ? seconds * 1e9 / size : 0; }};
+
+        // `seconds` 含握手后与挥手时的等待, `goodput_bytes_per_s` 只算数据传输的部分
+        // `wire_ratio` 含重传与校验包, 压缩时约等于压缩率
+        std::cout << "{\"bench\":\"e2e\",\"corpus\":\"" << corpus_name(kind)
+                  << "\",\"mode\":" << mode << ",\"window\":" << window;
+        if (loss)
+            std::cout << ",\"loss\":" << *loss;
+        std::cout << ",\"bytes\":" << size << ",\"ok\":" << (ok ? "true" : "false")
+                  << ",\"seconds\":" << elapsed.count()
+                  << ",\"goodput_bytes_per_s\":" << json_number(stats, "goodput_bytes_per_s")
+                  << ",\"sender_cpu_ns_per_byte\":" << per_byte(sender_result.cpu_seconds)
+                  << ",\"receiver_cpu_ns_per_byte\":" << per_byte(receiver_result.cpu_seconds)
+                  << ",\"retransmission_ratio\":"
+                  << (packets_sent > 0 ? retransmitted / packets_sent : 0)
+                  << ",\"parity_ratio\":" << (packets_sent > 0 ? parity_sent / packets_sent : 0)
+                  << ",\"wire_ratio\":" << (size > 0 ? payload_bytes / size : 0) << '}'
+                  << std::endl;
+    }
+
+    void main(int argc, char **argv)
+    {
+        for_each_option(argc, argv,
+                        [](std::string_view key, std::string_view value)
+                        {
+                            if (key == "sizes")
+                                sizes = parse_list(key, value, parse_bytes);
+                            else if (key == "modes")
+                                modes = parse_list(key, value, parse_number);
+                            else if (key == "windows")
+                                windows = parse_list(key, value, parse_number);
+                            else if (key == "corpora")
+                                corpora = parse_list(key, value, parse_corpus);
+                            else if (key == "dir")
+                                directory = value;
+                            else if (key == "sender-options")
+                                sender_options = split(value);
+                            else if (key == "receiver-options")
+                                receiver_options = split(value);
+                            else if (key == "losses")
+                                losses = parse_list(key, value, parse_probability);
+                            else if (key == "proxy-options")
+                                proxy_options = split(value);
+                            else
+                                logs::error("未知的选项 `--", key, '`');
+                        });
+        for (std::size_t mode : modes)
+            if (mode > 1)
+                logs::error("`--modes` 只能包含 0 和 1");
+
+        auto bin{std::filesystem::read_symlink("/proc/self/exe").parent_path()};
+        auto work{directory / ("rtp_bench." + std::to_string(getpid()))};
+        std::vector<std::optional<double>> impairments{std::nullopt};
+        if (!losses.empty())
+            impairments.assign(losses.begin(), losses.end());
+        std::filesystem::create_directories(work);
+        std::mt19937 random{static_cast<unsigned>(getpid())};
+        int port{20000 + static_cast<int>(random() % 20000)};
+
+        try
+        {
+            auto input{work / "in"};
+            for (corpus_kind kind : corpora)
+                for (std::size_t size : sizes)
+                {
+                    generate_file(input, size, kind);
+                    for (std::size_t mode : modes)
+                        for (std::size_t window : windows)
+                            for (auto loss : impairments)
+                            {
+                                run_one(bin, work, input, size, kind, mode, window, loss, port);
+                                port += 2;
+                            }
+                }
+        }
+        catch (exceptions)
+        {
+            std::filesystem::remove_all(work);
+            throw;
+        }
+        std::filesystem::remove_all(work);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        if (argc < 2)
+            usage(argv[0]);
+        std::string_view command{argv[1]};
+        if (command == "micro")
+            micro::main(argc, argv);
+        else if (command == "e2e")
+            e2e::main(argc, argv);
+        else
+            usage(argv[0]);
+        return 0;
+    }
+    catch (exceptions)
+    {
+        return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,319 @@
+#include "checksum.hxx"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTP_HAVE_PCLMUL 1
+#endif
+
+// 原实现的表项是 `crc32_for_byte(i)`, 与标准 CRC-32 (0xEDB88320, 初值与结果异或
+// 0xFFFFFFFF) 的表恰好相差常量 `table[0]`. 把这个常量移到初值上即可得到:
+// 原校验和 == 标准 CRC-32. 因此下面的各个实现都只维护标准 CRC 的内部状态,
+// 由 `compute_checksum()` 负责取反.
+
+static std::uint32_t crc32_for_byte(std::uint32_t r)
+{
+    for (int i{0}; i < 8; i++)
+        r = (r & 1 ? 0 : 0xEDB88320U) ^ r >> 1;
+    return r ^ 0xFF000000U;
+}
+
+// 原始的逐字节实现, 作为其他实现的对照.
+static std::uint32_t crc32_bytewise(const void *data, std::size_t n_bytes)
+{
+    static std::uint32_t table[0x100];
+    if (table[0] == 0)
+    {
+        for (std::size_t i{0}; i < 0x100; i++)
+            table[i] = crc32_for_byte(i);
+    }
+    std::uint32_t crc{0};
+    for (std::size_t i{0}; i < n_bytes; i++)
+        crc = table[(std::uint8_t)crc ^ ((const std::uint8_t *)data)[i]] ^ crc >> 8;
+    return crc;
+}
+
+using slicing_table = std::array<std::array<std::uint32_t, 0x100>, 16>;
+
+static constexpr slicing_table make_slicing_table()
+{
+    slicing_table table{};
+    for (std::uint32_t i{0}; i < 0x100; i++)
+    {
+        std::uint32_t r{i};
+        for (int j{0}; j < 8; j++)
+            r = (r & 1 ? 0xEDB88320U : 0) ^ r >> 1;
+        table[0][i] = r;
+    }
+    for (std::size_t k{1}; k < 16; k++)
+        for (std::size_t i{0}; i < 0x100; i++)
+            table[k][i] = table[k - 1][i] >> 8 ^ table[0][table[k - 1][i] & 0xFF];
+    return table;
+}
+
+alignas(64) static constexpr slicing_table TABLE{make_slicing_table()};
+
+static std::uint32_t load_u32(const std::uint8_t *p)
+{
+    std::uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static std::uint32_t crc32_tail(std::uint32_t crc, const std::uint8_t *p, std::size_t n)
+{
+    while (n--)
+        crc = TABLE[0][(crc ^ *p++) & 0xFF] ^ crc >> 8;
+    return crc;
+}
+
+static std::uint32_t crc32_slicing_by_8(std::uint32_t crc, const std::uint8_t *p,
+                                        std::size_t n)
+{
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        std::uint32_t a{load_u32(p) ^ crc}, b{load_u32(p + 4)};
+        crc = TABLE[7][a & 0xFF] ^ TABLE[6][a >> 8 & 0xFF] ^ TABLE[5][a >> 16 & 0xFF] ^
+              TABLE[4][a >> 24] ^ TABLE[3][b & 0xFF] ^ TABLE[2][b >> 8 & 0xFF] ^
+              TABLE[1][b >> 16 & 0xFF] ^ TABLE[0][b >> 24];
+    }
+    return crc32_tail(crc, p, n);
+}
+
+static std::uint32_t crc32_slicing_by_16(std::uint32_t crc, const std::uint8_t *p,
+                                         std::size_t n)
+{
+    for (; n >= 16; n -= 16, p += 16)
+    {
+        std::uint32_t a{load_u32(p) ^ crc}, b{load_u32(p + 4)}, c{load_u32(p + 8)},
+            d{load_u32(p + 12)};
+        crc = TABLE[15][a & 0xFF] ^ TABLE[14][a >> 8 & 0xFF] ^ TABLE[13][a >> 16 & 0xFF] ^
+              TABLE[12][a >> 24] ^ TABLE[11][b & 0xFF] ^ TABLE[10][b >> 8 & 0xFF] ^
+              TABLE[9][b >> 16 & 0xFF] ^ TABLE[8][b >> 24] ^ TABLE[7][c & 0xFF] ^
+              TABLE[6][c >> 8 & 0xFF] ^ TABLE[5][c >> 16 & 0xFF] ^ TABLE[4][c >> 24] ^
+              TABLE[3][d & 0xFF] ^ TABLE[2][d >> 8 & 0xFF] ^ TABLE[1][d >> 16 & 0xFF] ^
+              TABLE[0][d >> 24];
+    }
+    return crc32_slicing_by_8(crc, p, n);
+}
+
+#ifdef RTP_HAVE_PCLMUL
+// 按 Intel "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ" 的
+// 反射域常量折叠. 要求 n >= 64 且为 16 的倍数, 其余部分由调用者用查表补齐.
+[[gnu::target("pclmul,sse4.1")]] static std::uint32_t
+crc32_pclmul_fold(std::uint32_t crc, const std::uint8_t *p, std::size_t n)
+{
+    alignas(16) static constexpr std::uint64_t k1k2[]{0x0154442bd4, 0x01c6e41596};
+    alignas(16) static constexpr std::uint64_t k3k4[]{0x01751997d0, 0x00ccaa009e};
+    alignas(16) static constexpr std::uint64_t k5k0[]{0x0163cd6124, 0x0000000000};
+    alignas(16) static constexpr std::uint64_t poly[]{0x01db710641, 0x01f7011641};
+
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+    x0 = _mm_load_si128((const __m128i *)k1k2);
+    p += 64;
+    n -= 64;
+
+    for (; n >= 64; n -= 64, p += 64)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(p + 0x30)));
+    }
+
+    // 4 路折叠为 128 位
+    x0 = _mm_load_si128((const __m128i *)k3k4);
+    for (__m128i next : {x2, x3, x4})
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, next), x5);
+    }
+
+    for (; n >= 16; n -= 16, p += 16)
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p)), x5);
+    }
+
+    // 128 位折叠为 64 位
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x3 = _mm_setr_epi32(~0, 0, ~0, 0);
+    x1 = _mm_srli_si128(x1, 8);
+    x1 = _mm_xor_si128(x1, x2);
+
+    x0 = _mm_loadl_epi64((const __m128i *)k5k0);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, x3);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett 约减到 32 位
+    x0 = _mm_load_si128((const __m128i *)poly);
+    x2 = _mm_and_si128(x1, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, x3);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return _mm_extract_epi32(x1, 1);
+}
+
+static std::uint32_t crc32_pclmul(std::uint32_t crc, const std::uint8_t *p, std::size_t n)
+{
+    if (n < 64)
+        return crc32_slicing_by_8(crc, p, n);
+    std::size_t folded{n & ~std::size_t{15}};
+    crc = crc32_pclmul_fold(crc, p, folded);
+    return crc32_tail(crc, p + folded, n - folded);
+}
+#endif
+
+using crc32_function = std::uint32_t (*)(std::uint32_t, const std::uint8_t *, std::size_t);
+
+static crc32_function to_function(checksum_engine engine)
+{
+    switch (engine)
+    {
+    case checksum_engine::slicing_by_8:
+        return crc32_slicing_by_8;
+    case checksum_engine::slicing_by_16:
+        return crc32_slicing_by_16;
+    case checksum_engine::pclmul:
+#ifdef RTP_HAVE_PCLMUL
+        return crc32_pclmul;
+#else
+        return nullptr;
+#endif
+    case checksum_engine::bytewise:
+        break;
+    }
+    return nullptr;
+}
+
+// 常量初始化, 保证其他翻译单元的静态初始化阶段也能安全调用 `compute_checksum()`.
+static crc32_function current_function{crc32_slicing_by_8};
+static checksum_engine current_engine{checksum_engine::slicing_by_8};
+
+// 与原实现对拍: 覆盖各种长度与起始对齐, 保证换用新实现后校验和逐位相同.
+static bool agrees_with_bytewise(checksum_engine engine)
+{
+    alignas(16) std::uint8_t buf[2048 + 16];
+    std::uint32_t x{0x12345678};
+    for (auto &byte : buf)
+    {
+        x = x * 1103515245 + 12345;
+        byte = x >> 24;
+    }
+    for (std::size_t offset{0}; offset < 16; offset += 5)
+        for (std::size_t n{0}; n <= 2048; n += n < 160 ? 1 : 61)
+            if (checksum::compute(engine, buf + offset, n) !=
+                crc32_bytewise(buf + offset, n))
+                return false;
+    return true;
+}
+
+[[maybe_unused]] static const bool engine_selected{[] {
+    for (checksum_engine engine : {checksum_engine::pclmul, checksum_engine::slicing_by_16})
+        if (checksum::set_engine(engine))
+            return true;
+    return false;
+}()};
+
+namespace checksum
+{
+    bool is_supported(checksum_engine engine)
+    {
+        switch (engine)
+        {
+        case checksum_engine::pclmul:
+#ifdef RTP_HAVE_PCLMUL
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#else
+            return false;
+#endif
+        default:
+            return true;
+        }
+    }
+
+    bool set_engine(checksum_engine engine)
+    {
+        if (engine == checksum_engine::bytewise)
+            return false;
+        if (!is_supported(engine) || !agrees_with_bytewise(engine))
+            return false;
+        current_function = to_function(engine);
+        current_engine = engine;
+        return true;
+    }
+
+    checksum_engine get_engine() { return current_engine; }
+
+    std::uint32_t compute(checksum_engine engine, const void *data, std::size_t n_bytes)
+    {
+        if (engine == checksum_engine::bytewise)
+            return crc32_bytewise(data, n_bytes);
+        return ~to_function(engine)(~0U, (const std::uint8_t *)data, n_bytes);
+    }
+
+    std::uint32_t extend(std::uint32_t checksum, const void *data, std::size_t n_bytes)
+    {
+        return ~current_function(~checksum, (const std::uint8_t *)data, n_bytes);
+    }
+}
+
+std::uint32_t compute_checksum(const void *pkt, std::size_t n_bytes)
+{
+    return ~current_function(~0U, (const std::uint8_t *)pkt, n_bytes);
+}
+
+std::uint32_t compute_checksum(const void *head, std::size_t head_bytes, const void *tail,
+                               std::size_t tail_bytes)
+{
+    std::uint32_t crc{current_function(~0U, (const std::uint8_t *)head, head_bytes)};
+    return ~current_function(crc, (const std::uint8_t *)tail, tail_bytes);
+}
+
+std::ostream &operator<<(std::ostream &os, const checksum_engine &engine)
+{
+    switch (engine)
+    {
+    case checksum_engine::bytewise:
+        os << "bytewise";
+        break;
+    case checksum_engine::slicing_by_8:
+        os << "slicing-by-8";
+        break;
+    case checksum_engine::slicing_by_16:
+        os << "slicing-by-16";
+        break;
+    case checksum_engine::pclmul:
+        os << "pclmul";
+        break;
+    }
+    return os;
+}
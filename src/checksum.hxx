@@ -0,0 +1,50 @@
+#ifndef CHECKSUM_HXX
+#define CHECKSUM_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+
+enum class checksum_engine
+{
+    bytewise,
+    slicing_by_8,
+    slicing_by_16,
+    pclmul
+};
+
+std::ostream &operator<<(std::ostream &os, const checksum_engine &engine);
+
+namespace checksum
+{
+    // 当前 CPU 是否能运行该实现.
+    bool is_supported(checksum_engine engine);
+
+    // 切换 `compute_checksum()` 使用的实现. 不支持时返回 false, 保持原实现.
+    bool set_engine(checksum_engine engine);
+    checksum_engine get_engine();
+
+    // 用指定实现计算校验和, 供对拍与基准测试使用.
+    std::uint32_t compute(checksum_engine engine, const void *data, std::size_t n_bytes);
+
+    // 接着前面数据的校验和 `checksum` (没有数据时为 0) 计算拼接上 `data` 之后的校验和,
+    // 用于分段计算整个文件的校验和.
+    std::uint32_t extend(std::uint32_t checksum, const void *data, std::size_t n_bytes);
+}
+
+// Computes checksum for `n_bytes` of data
+//
+// Hint 1: Before computing the checksum, you should set everything up
+// and set the "checksum" field to 0. And when checking if a packet
+// has the correct check sum, don't forget to set the "checksum" field
+// back to 0 before invoking this function.
+//
+// Hint 2: `len + sizeof(rtp_header_t)` is the real length of a rtp
+// data packet.
+std::uint32_t compute_checksum(const void *pkt, std::size_t n_bytes);
+
+// 对不连续的两段数据 (例如包头与映射中的负载) 计算与拼接后相同的校验和
+std::uint32_t compute_checksum(const void *head, std::size_t head_bytes, const void *tail,
+                               std::size_t tail_bytes);
+
+#endif
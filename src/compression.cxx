@@ -0,0 +1,184 @@
+#include "compression.hxx"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr unsigned HASH_LOG{12};
+    constexpr std::size_t MIN_MATCH{4};
+    // 与 LZ4 相同: 最后 5 字节总是字面量, 最后一个匹配在结尾前至少 12 字节处开始
+    constexpr std::size_t LAST_LITERALS{5};
+    constexpr std::size_t MATCH_LIMIT{12};
+    constexpr std::size_t MAX_DISTANCE{65535};
+    // 表中的位置超过它时清空重来, 位置加上一块的长度也不会回绕
+    constexpr std::uint32_t BASE_LIMIT{0x80000000};
+
+    std::uint32_t read32(const char *p)
+    {
+        std::uint32_t value;
+        std::memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    std::uint32_t hash(std::uint32_t sequence) { return sequence * 2654435761U >> (32 - HASH_LOG); }
+
+    // 长度字段放不下的部分: 若干个 255 与一个余数
+    std::size_t extra_length_bytes(std::size_t length)
+    {
+        return length >= 15 ? (length - 15) / 255 + 1 : 0;
+    }
+
+    char *put_extra_length(char *op, std::size_t length)
+    {
+        for (length -= 15; length >= 255; length -= 255)
+            *op++ = static_cast<char>(255);
+        *op++ = static_cast<char>(length);
+        return op;
+    }
+
+    // 写出一个序列, `match_length` 为 0 表示只有字面量的最后一个序列.
+    // 写出后会超过 `end` 时返回空指针.
+    char *put_sequence(char *op, const char *end, const char *literals, std::size_t n_literals,
+                       std::size_t distance, std::size_t match_length)
+    {
+        std::size_t need{1 + extra_length_bytes(n_literals) + n_literals};
+        if (match_length > 0)
+            need += 2 + extra_length_bytes(match_length - MIN_MATCH);
+        if (need > static_cast<std::size_t>(end - op))
+            return nullptr;
+
+        char *token{op++};
+        auto token_value{static_cast<std::uint8_t>(std::min<std::size_t>(n_literals, 15) << 4)};
+        if (n_literals >= 15)
+            op = put_extra_length(op, n_literals);
+        std::memcpy(op, literals, n_literals);
+        op += n_literals;
+        if (match_length > 0)
+        {
+            *op++ = static_cast<char>(distance & 0xFF);
+            *op++ = static_cast<char>(distance >> 8);
+            std::size_t length{match_length - MIN_MATCH};
+            token_value |= static_cast<std::uint8_t>(std::min<std::size_t>(length, 15));
+            if (length >= 15)
+                op = put_extra_length(op, length);
+        }
+        *token = static_cast<char>(token_value);
+        return op;
+    }
+
+    // 读出长度字段放不下的部分, 加到 `length` 上. 数据不完整时返回 false.
+    bool get_extra_length(const std::uint8_t *&ip, const std::uint8_t *end, std::size_t &length)
+    {
+        std::uint8_t byte;
+        do
+        {
+            if (ip == end)
+                return false;
+            byte = *ip++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+}
+
+namespace compression
+{
+    compressor::compressor() : m_table(std::size_t{1} << HASH_LOG, 0) {}
+
+    // 贪心匹配, 与 LZ4 的快速模式类似: 连续找不到匹配时逐渐加大步长
+    std::size_t compressor::compress(const char *src, std::size_t n, char *dst)
+    {
+        if (n <= MATCH_LIMIT)
+            return 0;
+        if (m_base >= BASE_LIMIT)
+        {
+            std::fill(m_table.begin(), m_table.end(), 0);
+            m_base = 1;
+        }
+        std::uint32_t base{m_base};
+        m_base += static_cast<std::uint32_t>(n);
+
+        char *op{dst};
+        // 至少要短 1 字节才值得压缩
+        const char *end{dst + n - 1};
+        std::size_t anchor{0};
+        std::size_t ip{0};
+        while (ip < n - MATCH_LIMIT)
+        {
+            std::uint32_t sequence{read32(src + ip)};
+            std::uint32_t &slot{m_table[hash(sequence)]};
+            std::uint32_t candidate{slot};
+            slot = base + static_cast<std::uint32_t>(ip);
+            if (candidate < base || base + ip - candidate > MAX_DISTANCE ||
+                read32(src + (candidate - base)) != sequence)
+            {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+
+            std::size_t match{candidate - base};
+            while (ip > anchor && match > 0 && src[ip - 1] == src[match - 1])
+            {
+                ip--;
+                match--;
+            }
+            std::size_t length{MIN_MATCH};
+            while (ip + length < n - LAST_LITERALS && src[ip + length] == src[match + length])
+                length++;
+            op = put_sequence(op, end, src + anchor, ip - anchor, ip - match, length);
+            if (op == nullptr)
+                return 0;
+            ip += length;
+            anchor = ip;
+        }
+        op = put_sequence(op, end, src + anchor, n - anchor, 0, 0);
+        if (op == nullptr)
+            return 0;
+        return static_cast<std::size_t>(op - dst);
+    }
+
+    std::optional<std::size_t> decompress(const char *src, std::size_t n, char *dst,
+                                          std::size_t capacity)
+    {
+        const auto *ip{reinterpret_cast<const std::uint8_t *>(src)};
+        const auto *end{ip + n};
+        std::size_t op{0};
+        while (ip < end)
+        {
+            std::uint8_t token{*ip++};
+            std::size_t n_literals{static_cast<std::size_t>(token >> 4)};
+            if (n_literals == 15 && !get_extra_length(ip, end, n_literals))
+                return std::nullopt;
+            if (n_literals > static_cast<std::size_t>(end - ip) || n_literals > capacity - op)
+                return std::nullopt;
+            std::memcpy(dst + op, ip, n_literals);
+            ip += n_literals;
+            op += n_literals;
+            // 只有最后一个序列没有匹配
+            if (ip == end)
+                return op;
+
+            if (end - ip < 2)
+                return std::nullopt;
+            std::size_t distance{static_cast<std::size_t>(ip[0] | ip[1] << 8)};
+            ip += 2;
+            if (distance == 0 || distance > op)
+                return std::nullopt;
+            std::size_t length{static_cast<std::size_t>(token & 15)};
+            if (length == 15 && !get_extra_length(ip, end, length))
+                return std::nullopt;
+            length += MIN_MATCH;
+            if (length > capacity - op)
+                return std::nullopt;
+            // 距离小于长度时源与目的重叠, 只能逐字节复制
+            const char *match{dst + op - distance};
+            if (distance >= length)
+                std::memcpy(dst + op, match, length);
+            else
+                for (std::size_t i{0}; i < length; i++)
+                    dst[op + i] = match[i];
+            op += length;
+        }
+        return std::nullopt;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef COMPRESSION_HXX
+#define COMPRESSION_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// 数据包负载的压缩. 每个包单独压缩、单独解压, 不依赖别的包, 所以重传与乱序都不受影响.
+//
+// 格式与 LZ4 的块格式相同: 一串序列, 每个序列是一个标记字节 (高 4 位为字面量长度,
+// 低 4 位为匹配长度减 4, 等于 15 时后面跟着若干个 255 与一个余数), 字面量,
+// 2 字节小端的匹配距离与匹配长度的余下部分. 最后一个序列只有字面量.
+namespace compression
+{
+    class compressor
+    {
+    private:
+        // 4 字节序列的哈希到它最近一次出现的位置. 位置加上 `m_base`, 每压缩一块
+        // `m_base` 就越过这一块, 表中之前的位置自然失效, 不必每次清空.
+        std::vector<std::uint32_t> m_table;
+        std::uint32_t m_base{1};
+
+    public:
+        compressor();
+
+        // 把 `src` 的 `n` 字节压缩到 `dst`, 返回压缩后的字节数. 压缩后不比原来短时
+        // 返回 0, 此时 `dst` 的内容无意义. `dst` 至少要有 `n` 字节.
+        std::size_t compress(const char *src, std::size_t n, char *dst);
+    };
+
+    // 解压 `src` 的 `n` 字节到 `dst`, 返回解压后的字节数. 数据不合法或解压后超过
+    // `capacity` 字节时返回空.
+    std::optional<std::size_t> decompress(const char *src, std::size_t n, char *dst,
+                                          std::size_t capacity);
+}
+
+#endif
@@ -0,0 +1,278 @@
+#include "congestion.hxx"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+congestion_control::congestion_control(std::size_t max_window) : m_max_window{max_window} {}
+
+void congestion_control::on_loss(std::size_t seq_num, std::size_t next_seq_num,
+                                 clock::time_point now)
+{
+    if (seq_num < m_recovery_end)
+        return;
+    m_recovery_end = next_seq_num;
+    on_congestion(now);
+}
+
+double congestion_control::pacing_rate(clock::duration srtt) const
+{
+    if (srtt == clock::duration::zero())
+        return 0;
+    return 1.25 * window() / std::chrono::duration<double>(srtt).count();
+}
+
+namespace
+{
+    constexpr double INITIAL_WINDOW{10};
+    constexpr double MIN_WINDOW{2};
+
+    double to_seconds(congestion_control::clock::duration d)
+    {
+        return std::chrono::duration<double>(d).count();
+    }
+
+    // 不做拥塞控制, 窗口固定为命令行给出的大小
+    class fixed_window : public congestion_control
+    {
+    protected:
+        void on_congestion(clock::time_point) override {}
+
+    public:
+        using congestion_control::congestion_control;
+
+        void on_ack(std::size_t, std::optional<clock::duration>, clock::time_point) override {}
+        std::size_t window() const override { return m_max_window; }
+    };
+
+    // 基于丢包的控制器的公共部分: 窗口以浮点数记录, 取整后给出
+    class loss_based : public congestion_control
+    {
+    protected:
+        double m_cwnd;
+        double m_ssthresh;
+
+        void clamp_window()
+        {
+            m_cwnd = std::clamp(m_cwnd, MIN_WINDOW, static_cast<double>(m_max_window));
+        }
+
+    public:
+        explicit loss_based(std::size_t max_window)
+            : congestion_control{max_window}, m_cwnd{INITIAL_WINDOW},
+              m_ssthresh{static_cast<double>(max_window)}
+        {
+            clamp_window();
+        }
+
+        std::size_t window() const override { return static_cast<std::size_t>(m_cwnd); }
+
+        // 与 Linux 相同: 慢启动时两倍, 拥塞避免时 1.2 倍
+        double pacing_rate(clock::duration srtt) const override
+        {
+            if (srtt == clock::duration::zero())
+                return 0;
+            return (m_cwnd < m_ssthresh ? 2 : 1.2) * m_cwnd /
+                   std::chrono::duration<double>(srtt).count();
+        }
+    };
+
+    // RFC 5681 的慢启动与拥塞避免. 丢包由逐包的重传超时发现, RTO 已经跟随
+    // 实测 RTT, 因此拥塞时按快速恢复减半, 而不是回到 1.
+    class reno : public loss_based
+    {
+    protected:
+        void on_congestion(clock::time_point) override
+        {
+            m_ssthresh = std::max(m_cwnd / 2, MIN_WINDOW);
+            m_cwnd = m_ssthresh;
+        }
+
+    public:
+        using loss_based::loss_based;
+
+        void on_ack(std::size_t n_acked, std::optional<clock::duration>,
+                    clock::time_point) override
+        {
+            if (m_cwnd < m_ssthresh)
+                m_cwnd += n_acked;
+            else
+                m_cwnd += n_acked / m_cwnd;
+            clamp_window();
+        }
+    };
+
+    // RFC 9438
+    class cubic : public loss_based
+    {
+    private:
+        static constexpr double C{0.4};
+        static constexpr double BETA{0.7};
+
+        double m_w_max{0};
+        double m_k{0};
+        // 与 Reno 同速增长时的窗口, 窗口不低于它
+        double m_w_est{0};
+        std::optional<clock::time_point> m_epoch;
+        clock::duration m_rtt{std::chrono::milliseconds{100}};
+
+    protected:
+        void on_congestion(clock::time_point) override
+        {
+            // 快速收敛: 上次的最大值还没达到就又丢包, 让出一部分带宽
+            m_w_max = m_cwnd < m_w_max ? m_cwnd * (1 + BETA) / 2 : m_cwnd;
+            m_cwnd = std::max(m_cwnd * BETA, MIN_WINDOW);
+            m_ssthresh = m_cwnd;
+            m_k = std::cbrt(m_w_max * (1 - BETA) / C);
+            m_w_est = m_cwnd;
+            m_epoch.reset();
+        }
+
+    public:
+        using loss_based::loss_based;
+
+        void on_ack(std::size_t n_acked, std::optional<clock::duration> rtt,
+                    clock::time_point now) override
+        {
+            if (rtt)
+                m_rtt = *rtt;
+            if (m_cwnd < m_ssthresh)
+            {
+                m_cwnd += n_acked;
+                clamp_window();
+                return;
+            }
+
+            if (!m_epoch)
+            {
+                m_epoch = now;
+                // 慢启动结束时还没有丢过包, 以当前窗口为平台
+                if (m_w_max < m_cwnd)
+                {
+                    m_w_max = m_cwnd;
+                    m_k = 0;
+                }
+                m_w_est = m_cwnd;
+            }
+
+            double t{to_seconds(now - *m_epoch + m_rtt) - m_k};
+            double target{std::clamp(C * t * t * t + m_w_max, m_cwnd, 1.5 * m_cwnd)};
+            m_w_est += n_acked * 3 * (1 - BETA) / (1 + BETA) / m_cwnd;
+            if (m_w_est > target)
+                m_cwnd = m_w_est;
+            else
+                m_cwnd += n_acked * (target - m_cwnd) / m_cwnd;
+            clamp_window();
+        }
+    };
+
+    // 仿照 BBR 的基于模型的控制器: 估计瓶颈带宽与最小 RTT, 窗口取两倍 BDP,
+    // 发送速率取带宽乘以增益. 带宽按每个不短于最小 RTT 的区间内确认的包数估计.
+    // 丢包不作为拥塞信号.
+    class bbr : public congestion_control
+    {
+    private:
+        static constexpr double CWND_GAIN{2};
+        // 慢启动时每轮速率翻倍所需的增益 2 / ln 2
+        static constexpr double STARTUP_GAIN{2.89};
+        // 之后每 8 轮中先多发 1/4 探测带宽, 再少发 1/4 排空队列
+        static constexpr std::array<double, 8> PROBE_GAINS{1.25, 0.75, 1, 1, 1, 1, 1, 1};
+        // 带宽取最近这么多个区间的最大值
+        static constexpr std::size_t BW_ROUNDS{10};
+        static constexpr clock::duration MIN_RTT_EXPIRY{std::chrono::seconds{10}};
+
+        bool m_startup{true};
+        std::size_t m_cycle_index{0};
+        double m_cwnd{INITIAL_WINDOW};
+
+        std::optional<clock::duration> m_min_rtt;
+        clock::time_point m_min_rtt_time;
+
+        std::array<double, BW_ROUNDS> m_bw_rounds{};
+        std::size_t m_round{0};
+        std::optional<clock::time_point> m_interval_start;
+        std::size_t m_interval_delivered{0};
+
+        // 慢启动阶段连续多少个区间带宽增长不到 25%
+        double m_full_bw{0};
+        int m_full_bw_count{0};
+
+        double max_bw() const { return *std::max_element(m_bw_rounds.begin(), m_bw_rounds.end()); }
+
+        void end_round(clock::time_point now)
+        {
+            double bw{m_interval_delivered / to_seconds(now - *m_interval_start)};
+            m_bw_rounds[m_round++ % BW_ROUNDS] = bw;
+            m_cycle_index++;
+            m_interval_start = now;
+            m_interval_delivered = 0;
+
+            if (!m_startup)
+                return;
+            if (bw >= m_full_bw * 1.25)
+            {
+                m_full_bw = bw;
+                m_full_bw_count = 0;
+            }
+            else if (++m_full_bw_count >= 3)
+                m_startup = false;
+        }
+
+    protected:
+        void on_congestion(clock::time_point) override {}
+
+    public:
+        explicit bbr(std::size_t max_window) : congestion_control{max_window} {}
+
+        void on_ack(std::size_t n_acked, std::optional<clock::duration> rtt,
+                    clock::time_point now) override
+        {
+            if (rtt && (!m_min_rtt || *rtt <= *m_min_rtt || now - m_min_rtt_time > MIN_RTT_EXPIRY))
+            {
+                m_min_rtt = *rtt;
+                m_min_rtt_time = now;
+            }
+            if (!m_interval_start)
+                m_interval_start = now;
+            m_interval_delivered += n_acked;
+            if (m_min_rtt && now - *m_interval_start >= *m_min_rtt)
+                end_round(now);
+
+            if (m_startup)
+                m_cwnd += n_acked;
+            else
+                m_cwnd = CWND_GAIN * max_bw() * to_seconds(*m_min_rtt);
+            m_cwnd = std::clamp(m_cwnd, MIN_WINDOW, static_cast<double>(m_max_window));
+        }
+
+        std::size_t window() const override { return static_cast<std::size_t>(m_cwnd); }
+
+        double pacing_rate(clock::duration srtt) const override
+        {
+            // 还没有带宽估计时按窗口与 RTT 估计
+            if (max_bw() == 0)
+                return srtt == clock::duration::zero()
+                           ? 0
+                           : STARTUP_GAIN * m_cwnd / std::chrono::duration<double>(srtt).count();
+            if (m_startup)
+                return STARTUP_GAIN * max_bw();
+            return PROBE_GAINS[m_cycle_index % PROBE_GAINS.size()] * max_bw();
+        }
+    };
+}
+
+std::unique_ptr<congestion_control> make_congestion_control(congestion_algorithm algorithm,
+                                                            std::size_t max_window)
+{
+    switch (algorithm)
+    {
+    case congestion_algorithm::reno:
+        return std::make_unique<reno>(max_window);
+    case congestion_algorithm::cubic:
+        return std::make_unique<cubic>(max_window);
+    case congestion_algorithm::bbr:
+        return std::make_unique<bbr>(max_window);
+    case congestion_algorithm::fixed:
+        break;
+    }
+    return std::make_unique<fixed_window>(max_window);
+}
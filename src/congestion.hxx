@@ -0,0 +1,46 @@
+#ifndef CONGESTION_HXX
+#define CONGESTION_HXX
+
+#include "options.hxx"
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <optional>
+
+// 发送端的拥塞控制. 控制器给出拥塞窗口 (包数), 发送端在途的包不超过
+// 它与命令行窗口中较小的一个.
+class congestion_control
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    // 本轮恢复结束的位置: 在它之前发出的包再丢失算作同一次拥塞事件
+    std::size_t m_recovery_end{0};
+
+protected:
+    std::size_t m_max_window;
+
+    // 一次拥塞事件只调用一次
+    virtual void on_congestion(clock::time_point now) = 0;
+
+public:
+    explicit congestion_control(std::size_t max_window);
+    virtual ~congestion_control() = default;
+
+    // `n_acked` 个包被新确认. `rtt` 是按 Karn 算法得到的样本, 可能没有.
+    virtual void on_ack(std::size_t n_acked, std::optional<clock::duration> rtt,
+                        clock::time_point now) = 0;
+    // 序号为 `seq_num` 的包被判定丢失, `next_seq_num` 是下一个要发送的新包的序号
+    void on_loss(std::size_t seq_num, std::size_t next_seq_num, clock::time_point now);
+
+    virtual std::size_t window() const = 0;
+    // 发送速率 (包每秒), 供 pacing 使用. 默认每个 `srtt` 发出 1.25 个窗口,
+    // 留出余量让窗口能增长. 还没有 RTT 样本时返回 0, 即不限速.
+    virtual double pacing_rate(clock::duration srtt) const;
+};
+
+std::unique_ptr<congestion_control> make_congestion_control(congestion_algorithm algorithm,
+                                                            std::size_t max_window);
+
+#endif
@@ -0,0 +1,195 @@
+#include "event_loop.hxx"
+#include "batch_io.hxx"
+#include "error_process.hxx"
+#include "file_process.hxx"
+#include "tools.hxx"
+#include "uring_loop.hxx"
+#include <cerrno>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <vector>
+
+bool event_loop::is_expired(int timer) const { return m_expired_timers & 1U << timer; }
+std::size_t event_loop::size() const { return m_n_packets; }
+
+void event_loop::start_timer(int timer, std::int64_t time_ms)
+{
+    start_timer(timer, std::chrono::milliseconds{time_ms});
+}
+
+namespace
+{
+    class epoll_loop : public event_loop
+    {
+    private:
+        int m_socket_fd;
+        file_process::fd_wrapper m_epoll_wrapper{-1};
+        file_process::fd_wrapper m_timer_wrappers[TIMERS_MAX]{-1, -1, -1, -1};
+        batch_io::send_batch m_send_batch;
+        packet_pool m_pool;
+        batch_io::recv_batch m_recv_batch;
+
+        // `push_copy()` 复制出的包头, 在 `flush()` 之前保持有效
+        std::vector<rtp_header> m_headers;
+        std::size_t m_n_headers{0};
+
+        // `watch_readable()` 的 fd, 以 `EPOLLONESHOT` 加入
+        int m_watched_fd{-1};
+
+        void add(int fd)
+        {
+            epoll_event ep_event;
+            ep_event.events = EPOLLIN;
+            ep_event.data.fd = fd;
+            if (epoll_ctl(m_epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD, fd,
+                          &ep_event) == -1)
+                error_process::unix_error("`epoll_ctl()` 错误: ");
+        }
+
+    public:
+        epoll_loop(int socket_fd, const transfer_options &options, std::size_t payload_size)
+            : m_socket_fd{socket_fd},
+              m_send_batch{socket_fd, options.batch_size, options.gso, payload_size},
+              m_pool{payload_size, options.batch_size, options.hugepages},
+              m_recv_batch{socket_fd, options.batch_size, options.gro, m_pool},
+              m_headers(options.batch_size)
+        {
+            m_epoll_wrapper.open(epoll_create1(0));
+            if (!m_epoll_wrapper.is_valid())
+                error_process::unix_error("`epoll_create1()` 错误: ");
+            add(m_socket_fd);
+        }
+
+        void push(const rtp_header &packet) override { m_send_batch.push(packet); }
+
+        void push(const rtp_header &header, const void *payload) override
+        {
+            m_send_batch.push(header, payload);
+        }
+
+        void push_copy(const rtp_header &header) override
+        {
+            if (m_n_headers == m_headers.size())
+                flush();
+            m_headers[m_n_headers] = header;
+            m_send_batch.push(m_headers[m_n_headers++]);
+        }
+
+        void flush() override
+        {
+            m_send_batch.flush();
+            m_n_headers = 0;
+        }
+
+        void set_destination(const socket_address &destination) override
+        {
+            m_send_batch.set_destination(destination);
+        }
+
+        void watch_readable(int fd) override
+        {
+            epoll_event ep_event;
+            ep_event.events = EPOLLIN | EPOLLONESHOT;
+            ep_event.data.fd = fd;
+            int op{fd == m_watched_fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD};
+            if (epoll_ctl(m_epoll_wrapper.get_file_descriptor(), op, fd, &ep_event) == -1)
+                error_process::unix_error("`epoll_ctl()` 错误: ");
+            m_watched_fd = fd;
+        }
+
+        void start_timer(int timer, std::chrono::microseconds time) override
+        {
+            if (!m_timer_wrappers[timer].is_valid())
+            {
+                m_timer_wrappers[timer].open(timerfd_create(CLOCK_MONOTONIC, 0));
+                if (!m_timer_wrappers[timer].is_valid())
+                    error_process::unix_error("`timerfd_create()` 错误: ");
+                add(m_timer_wrappers[timer].get_file_descriptor());
+            }
+            itimerspec spec{{0, 0},
+                            {static_cast<time_t>(time.count() / 1000'000),
+                             static_cast<long>(time.count() % 1000'000 * 1000)}};
+            if (timerfd_settime(m_timer_wrappers[timer].get_file_descriptor(), 0, &spec,
+                                nullptr) == -1)
+                error_process::unix_error("`timerfd_settime()` 错误: ");
+        }
+
+        void stop_timer(int timer) override
+        {
+            if (m_timer_wrappers[timer].is_valid())
+                ::start_timer(m_timer_wrappers[timer].get_file_descriptor(), 0);
+        }
+
+        void write_file(int fd, const void *data, std::size_t n_bytes, off_t offset) override
+        {
+            if (pwrite(fd, data, n_bytes, offset) != static_cast<ssize_t>(n_bytes))
+                error_process::unix_error("`pwrite()` 错误: ");
+        }
+
+        void drain() override { flush(); }
+
+        void wait() override
+        {
+            flush();
+            m_expired_timers = 0;
+            m_n_packets = 0;
+
+            // 套接字、定时器与 `m_watched_fd`
+            epoll_event ep_events[TIMERS_MAX + 2];
+            int n_events;
+            do
+                n_events = epoll_wait(m_epoll_wrapper.get_file_descriptor(), ep_events,
+                                      TIMERS_MAX + 2, -1);
+            while (n_events == -1 && errno == EINTR);
+            if (n_events == -1)
+                error_process::unix_error("`epoll_wait()` 错误: ");
+
+            for (int i{0}; i < n_events; i++)
+            {
+                int fd{ep_events[i].data.fd};
+                if (fd == m_socket_fd)
+                {
+                    m_n_packets = m_recv_batch.recv();
+                    continue;
+                }
+                for (int timer{0}; timer < TIMERS_MAX; timer++)
+                {
+                    if (m_timer_wrappers[timer].is_valid() &&
+                        m_timer_wrappers[timer].get_file_descriptor() == fd)
+                    {
+                        // 读出到期次数, 否则水平触发的 epoll 会一直报告它
+                        std::uint64_t n_expirations;
+                        if (read(fd, &n_expirations, sizeof(n_expirations)) > 0)
+                            m_expired_timers |= 1U << timer;
+                    }
+                }
+            }
+        }
+
+        packet_view operator[](std::size_t i) override { return m_recv_batch[i]; }
+        std::size_t length(std::size_t i) const override { return m_recv_batch.length(i); }
+
+        const socket_address *source(std::size_t i) const override
+        {
+            return &m_recv_batch.source(i);
+        }
+
+        packet_pool &pool() override { return m_pool; }
+        packet_pool::handle take(std::size_t i) override { return m_recv_batch.take(i); }
+    };
+}
+
+std::unique_ptr<event_loop> make_event_loop(int socket_fd, const transfer_options &options,
+                                            std::size_t payload_size)
+{
+    if (options.backend == io_backend::io_uring)
+    {
+        std::unique_ptr<event_loop> loop{make_uring_loop(socket_fd, options, payload_size)};
+        if (loop)
+            return loop;
+        log_debug("io_uring 不可用, 退回 epoll");
+    }
+    return std::make_unique<epoll_loop>(socket_fd, options, payload_size);
+}
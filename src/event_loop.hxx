@@ -0,0 +1,74 @@
+#ifndef EVENT_LOOP_HXX
+#define EVENT_LOOP_HXX
+
+#include "options.hxx"
+#include "packet_pool.hxx"
+#include "rtp_header.hxx"
+#include "socket_process.hxx"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <sys/types.h>
+
+// 发送端与接收端主循环使用的收发与定时器接口. 握手完成后, 主循环只通过它
+// 与套接字打交道, 以便在 epoll + timerfd 与 io_uring 两种实现之间切换.
+class event_loop
+{
+protected:
+    unsigned m_expired_timers{0};
+    std::size_t m_n_packets{0};
+
+public:
+    static constexpr int TIMERS_MAX{4};
+
+    virtual ~event_loop() = default;
+
+    // 加入一个待发送的包. 包的内存在 `flush()` 之后的下一次 `wait()` 返回前必须保持有效.
+    virtual void push(const rtp_header &packet) = 0;
+    // 同上, 但负载不紧跟在包头之后, 而是位于 `payload`
+    virtual void push(const rtp_header &header, const void *payload) = 0;
+    // 复制一份只有包头的包 (例如 ACK) 再加入发送队列, 调用者不必保留它
+    virtual void push_copy(const rtp_header &header) = 0;
+    virtual void flush() = 0;
+    // 之后加入的包都发往 `destination`. 套接字没有 `connect()` 时 (服务器模式) 必须先设定.
+    virtual void set_destination(const socket_address &destination) = 0;
+
+    // 下一次 `wait()` 在 `fd` (管道、终端等, 不能是普通文件) 可读时也返回. 只生效一次,
+    // 之后需要再次调用.
+    virtual void watch_readable(int fd) = 0;
+
+    // 定时器到期后只触发一次; 重新启动会覆盖之前的设定
+    virtual void start_timer(int timer, std::chrono::microseconds time) = 0;
+    void start_timer(int timer, std::int64_t time_ms);
+    virtual void stop_timer(int timer) = 0;
+
+    // 写文件. `data` 必须是本轮 `operator[]` 得到的包内的地址.
+    virtual void write_file(int fd, const void *data, std::size_t n_bytes, off_t offset) = 0;
+    // 发送已加入的包, 并等待之前的写文件操作全部完成
+    virtual void drain() = 0;
+
+    // 发送已加入的包, 然后阻塞直到收到包、有定时器到期或 `watch_readable()` 的 fd 可读.
+    // 上一轮收到的包在此之后失效.
+    virtual void wait() = 0;
+
+    bool is_expired(int timer) const;
+    std::size_t size() const;
+    virtual packet_view operator[](std::size_t i) = 0;
+    virtual std::size_t length(std::size_t i) const = 0;
+    // 本轮第 `i` 个包的来源地址. 拿不到来源地址的实现返回空指针.
+    virtual const socket_address *source(std::size_t i) const = 0;
+
+    // 接收缓冲区所在的池. 由 `take()` 取走的缓冲区用完后还给它.
+    virtual packet_pool &pool() = 0;
+    // 取走本轮第 `i` 个包所在的缓冲区, 换一个空闲缓冲区接收之后的包, 省去复制.
+    // `operator[](i)` 仍指向取走的缓冲区. 每个包最多取一次, 交给 `write_file()` 的包不能取.
+    // 包与别的包共用缓冲区 (GRO 合并的报文) 时返回 `packet_pool::NO_HANDLE`.
+    virtual packet_pool::handle take(std::size_t i) = 0;
+};
+
+// 创建事件循环, 接收缓冲区放得下负载为 `payload_size` 的包. io_uring 不可用时退回 epoll.
+std::unique_ptr<event_loop> make_event_loop(int socket_fd, const transfer_options &options,
+                                            std::size_t payload_size = PAYLOAD_MAX);
+
+#endif
@@ -0,0 +1,169 @@
+#include "extension.hxx"
+#include <algorithm>
+#include <cstring>
+
+bool handshake_extensions::empty() const
+{
+    return !file_size && !sack && !stripe_offset && !payload_size && !compression && !fec &&
+           !resume && !resume_offset;
+}
+
+template <typename T>
+static std::uint16_t put_option(char *buf, std::uint16_t pos, extension_type type, T value)
+{
+    buf[pos] = static_cast<char>(type);
+    buf[pos + 1] = sizeof(T);
+    std::memcpy(buf + pos + 2, &value, sizeof(T));
+    return pos + 2 + sizeof(T);
+}
+
+static std::uint16_t put_flag(char *buf, std::uint16_t pos, extension_type type)
+{
+    buf[pos] = static_cast<char>(type);
+    buf[pos + 1] = 0;
+    return pos + 2;
+}
+
+template <typename T> static std::optional<T> get_option(const char *value, std::size_t length)
+{
+    if (length != sizeof(T))
+        return std::nullopt;
+    T result;
+    std::memcpy(&result, value, sizeof(T));
+    return result;
+}
+
+std::uint16_t encode_extensions(const handshake_extensions &extensions, char *buf)
+{
+    std::uint16_t pos{0};
+    if (extensions.file_size)
+        pos = put_option(buf, pos, extension_type::file_size, *extensions.file_size);
+    if (extensions.sack)
+        pos = put_flag(buf, pos, extension_type::sack);
+    if (extensions.stripe_offset)
+        pos = put_option(buf, pos, extension_type::stripe_offset, *extensions.stripe_offset);
+    if (extensions.payload_size)
+        pos = put_option(buf, pos, extension_type::payload_size, *extensions.payload_size);
+    if (extensions.compression)
+        pos = put_flag(buf, pos, extension_type::compression);
+    if (extensions.fec)
+        pos = put_option(buf, pos, extension_type::fec, *extensions.fec);
+    if (extensions.resume)
+        pos = put_option(buf, pos, extension_type::resume, *extensions.resume);
+    if (extensions.resume_offset)
+        pos = put_option(buf, pos, extension_type::resume_offset, *extensions.resume_offset);
+    return pos;
+}
+
+std::uint16_t pad_extensions(char *buf, std::uint16_t length, std::uint16_t target)
+{
+    while (target - length >= 2)
+    {
+        std::size_t value_length{std::min<std::size_t>(target - length - 2, 0xFF)};
+        // 不能只剩 1 字节, 选项至少 2 字节
+        if (target - length - 2 - value_length == 1)
+            value_length--;
+        buf[length] = static_cast<char>(extension_type::padding);
+        buf[length + 1] = static_cast<char>(value_length);
+        std::memset(buf + length + 2, 0, value_length);
+        length += static_cast<std::uint16_t>(2 + value_length);
+    }
+    return length;
+}
+
+handshake_extensions decode_extensions(const char *buf, std::size_t n_bytes)
+{
+    handshake_extensions extensions;
+    std::size_t pos{0};
+    while (pos + 2 <= n_bytes)
+    {
+        auto type{static_cast<extension_type>(buf[pos])};
+        std::size_t length{static_cast<std::uint8_t>(buf[pos + 1])};
+        const char *value{buf + pos + 2};
+        if (pos + 2 + length > n_bytes)
+            break;
+        pos += 2 + length;
+
+        switch (type)
+        {
+        case extension_type::file_size:
+            extensions.file_size = get_option<std::uint64_t>(value, length);
+            break;
+        case extension_type::sack:
+            extensions.sack = true;
+            break;
+        case extension_type::stripe_offset:
+            extensions.stripe_offset = get_option<std::uint64_t>(value, length);
+            break;
+        case extension_type::payload_size:
+            extensions.payload_size = get_option<std::uint16_t>(value, length);
+            break;
+        case extension_type::padding:
+            break;
+        case extension_type::compression:
+            extensions.compression = true;
+            break;
+        case extension_type::fec:
+            extensions.fec = get_option<fec::parameters>(value, length);
+            break;
+        case extension_type::resume:
+            extensions.resume = get_option<journal::file_identity>(value, length);
+            break;
+        case extension_type::resume_offset:
+            extensions.resume_offset = get_option<std::uint64_t>(value, length);
+            break;
+        }
+    }
+    return extensions;
+}
+
+std::ostream &operator<<(std::ostream &os, const handshake_extensions &extensions)
+{
+    os << "file_size=";
+    if (extensions.file_size)
+        os << *extensions.file_size;
+    else
+        os << '-';
+    os << " sack=" << extensions.sack << " stripe_offset=";
+    if (extensions.stripe_offset)
+        os << *extensions.stripe_offset;
+    else
+        os << '-';
+    os << " payload_size=";
+    if (extensions.payload_size)
+        os << *extensions.payload_size;
+    else
+        os << '-';
+    os << " compression=" << extensions.compression << " fec=";
+    if (extensions.fec)
+        os << static_cast<int>(extensions.fec->group_size) << ','
+           << static_cast<int>(extensions.fec->n_parity);
+    else
+        os << '-';
+    os << " resume=";
+    if (extensions.resume)
+        os << extensions.resume->size << ',' << extensions.resume->modified_ns;
+    else
+        os << '-';
+    os << " resume_offset=";
+    if (extensions.resume_offset)
+        os << *extensions.resume_offset;
+    else
+        os << '-';
+    return os;
+}
+
+handshake_extensions accept_extensions(const handshake_extensions &requested,
+                                       std::size_t payload_limit)
+{
+    handshake_extensions accepted;
+    accepted.sack = requested.sack;
+    accepted.compression = requested.compression;
+    if (requested.fec && fec::is_valid(*requested.fec))
+        accepted.fec = requested.fec;
+    // 长度为 0 的请求不合法, 不接受
+    if (requested.payload_size && *requested.payload_size > 0)
+        accepted.payload_size = static_cast<std::uint16_t>(
+            std::min<std::size_t>(*requested.payload_size, payload_limit));
+    return accepted;
+}
@@ -0,0 +1,70 @@
+#ifndef EXTENSION_HXX
+#define EXTENSION_HXX
+
+#include "fec.hxx"
+#include "journal.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+// 握手扩展. SYN 与 SYN ACK 可以在负载中携带一串 TLV 选项:
+// 类型 1 字节, 长度 1 字节, 之后是值 (小端). 未知的类型会被跳过.
+// 双方都不携带负载时, 握手与原协议完全相同.
+enum class extension_type : std::uint8_t
+{
+    file_size = 1,
+    sack = 2,
+    stripe_offset = 3,
+    payload_size = 4,
+    padding = 5,
+    compression = 6,
+    fec = 7,
+    resume = 8,
+    resume_offset = 9
+};
+
+struct handshake_extensions
+{
+    // 发送端告知的文件大小, 接收端可据此预先分配空间
+    std::optional<std::uint64_t> file_size;
+    // 使用选择确认 (见 `sack.hxx`). 发送端在 SYN 中请求, 接收端同意时在 SYN ACK 中回应.
+    // 没有值.
+    bool sack{false};
+    // 分条传输: 这个连接发送的是文件中从此偏移开始的一段. 接收端只有同意时才回应,
+    // 不认识它的接收端会把数据写到文件开头, 所以发送端必须确认对端同意.
+    std::optional<std::uint64_t> stripe_offset;
+    // 数据包的最大负载长度. 发送端请求, 接收端回应不超过请求的值; 没有回应时为
+    // `PAYLOAD_MAX`. 接收端按它计算每个包在文件中的偏移.
+    std::optional<std::uint16_t> payload_size;
+    // 数据包的负载可以压缩 (见 `compression.hxx`). 发送端请求, 接收端同意时回应.
+    // 没有值.
+    bool compression{false};
+    // 前向纠错的分组 (见 `fec.hxx`), 2 字节: 每组的数据包数与校验包数. 发送端请求,
+    // 接收端支持且参数合法时原样回应. 协商了 FEC 时数据包的负载比协商的负载长度
+    // 短 `fec::OVERHEAD` 字节.
+    std::optional<::fec::parameters> fec;
+    // 续传 (见 `journal.hxx`): 发送端在 SYN 中给出文件的标识, 16 字节. 接收端同意时在
+    // SYN ACK 中回应 `resume_offset`, 即从文件的哪个字节开始发送, 是数据包负载长度的
+    // 整数倍. 协商了续传时 FIN 的负载是整个文件的校验和 (4 字节), FIN ACK 的负载是
+    // 1 字节的核对结果, 非 0 表示一致.
+    std::optional<journal::file_identity> resume;
+    std::optional<std::uint64_t> resume_offset;
+
+    bool empty() const;
+};
+
+std::ostream &operator<<(std::ostream &os, const handshake_extensions &extensions);
+
+// 编码到 `buf` 中, 返回编码后的字节数. `buf` 至少要有 `PAYLOAD_MAX` 字节.
+std::uint16_t encode_extensions(const handshake_extensions &extensions, char *buf);
+// 在 `length` 字节的编码之后追加填充选项, 使总长恰为 `target` 字节, 用于探测路径 MTU
+std::uint16_t pad_extensions(char *buf, std::uint16_t length, std::uint16_t target);
+handshake_extensions decode_extensions(const char *buf, std::size_t n_bytes);
+
+// 接收端对 SYN 中请求的扩展的回应, 放在 SYN ACK 中. 负载长度不超过接收端的
+// `payload_limit`. 不包括分条偏移与续传位置, 它们只在分条接收或有输出文件时才同意.
+handshake_extensions accept_extensions(const handshake_extensions &requested,
+                                       std::size_t payload_limit);
+
+#endif
@@ -0,0 +1,376 @@
+#include "fec.hxx"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RTP_HAVE_X86_SIMD 1
+#endif
+
+namespace
+{
+    // GF(2^8), 本原多项式 x^8 + x^4 + x^3 + x^2 + 1, 生成元为 2
+    constexpr unsigned POLYNOMIAL{0x11D};
+
+    struct gf_tables
+    {
+        // 指数表重复一遍, 两个对数相加不必取模
+        std::array<std::uint8_t, 510> exp;
+        std::array<std::uint8_t, 256> log;
+    };
+
+    constexpr gf_tables make_gf_tables()
+    {
+        gf_tables tables{};
+        unsigned x{1};
+        for (std::size_t i{0}; i < 255; i++)
+        {
+            tables.exp[i] = static_cast<std::uint8_t>(x);
+            tables.exp[i + 255] = static_cast<std::uint8_t>(x);
+            tables.log[x] = static_cast<std::uint8_t>(i);
+            x <<= 1;
+            if (x & 0x100)
+                x ^= POLYNOMIAL;
+        }
+        return tables;
+    }
+
+    constexpr gf_tables GF{make_gf_tables()};
+
+    std::uint8_t multiply(std::uint8_t a, std::uint8_t b)
+    {
+        if (a == 0 || b == 0)
+            return 0;
+        return GF.exp[GF.log[a] + GF.log[b]];
+    }
+
+    std::uint8_t inverse(std::uint8_t a) { return GF.exp[255 - GF.log[a]]; }
+
+    // 第 j 行 (校验包) 第 i 列 (数据包) 的系数. Cauchy 矩阵取 x_j = j, y_i = PARITY_MAX + i,
+    // 元素为 1 / (x_j + y_i); 每列除以第一行的元素 1 / y_i 后为 y_i / (x_j + y_i).
+    std::uint8_t coefficient(std::size_t j, std::size_t i)
+    {
+        auto y{static_cast<std::uint8_t>(fec::PARITY_MAX + i)};
+        return multiply(y, inverse(static_cast<std::uint8_t>(j ^ y)));
+    }
+
+    std::vector<std::uint8_t> coefficient_matrix(const fec::parameters &parameters)
+    {
+        std::vector<std::uint8_t> matrix(parameters.n_parity * parameters.group_size);
+        for (std::size_t j{0}; j < parameters.n_parity; j++)
+            for (std::size_t i{0}; i < parameters.group_size; i++)
+                matrix[j * parameters.group_size + i] = coefficient(j, i);
+        return matrix;
+    }
+
+    // 乘以 c 的半字节表: 前 16 项为 c * x, 后 16 项为 c * (x << 4)
+    using nibble_tables = std::array<std::uint8_t, 32>;
+    using region_function = void (*)(const nibble_tables &, const char *, char *, std::size_t);
+
+    void multiply_add_bytewise(const nibble_tables &tables, const char *src, char *dst,
+                               std::size_t n)
+    {
+        for (std::size_t i{0}; i < n; i++)
+        {
+            auto s{static_cast<std::uint8_t>(src[i])};
+            dst[i] = static_cast<char>(dst[i] ^ tables[s & 0xF] ^ tables[16 + (s >> 4)]);
+        }
+    }
+
+#ifdef RTP_HAVE_X86_SIMD
+    // `pshufb` 一次查 16 个半字节
+    [[gnu::target("ssse3")]] void multiply_add_ssse3(const nibble_tables &tables,
+                                                     const char *src, char *dst, std::size_t n)
+    {
+        __m128i low{_mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.data()))};
+        __m128i high{_mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.data() + 16))};
+        __m128i mask{_mm_set1_epi8(0xF)};
+        std::size_t i{0};
+        for (; i + 16 <= n; i += 16)
+        {
+            __m128i s{_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))};
+            __m128i product{
+                _mm_xor_si128(_mm_shuffle_epi8(low, _mm_and_si128(s, mask)),
+                              _mm_shuffle_epi8(high, _mm_and_si128(_mm_srli_epi64(s, 4), mask)))};
+            auto *d{reinterpret_cast<__m128i *>(dst + i)};
+            _mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(d), product));
+        }
+        multiply_add_bytewise(tables, src + i, dst + i, n - i);
+    }
+
+    [[gnu::target("avx2")]] void multiply_add_avx2(const nibble_tables &tables, const char *src,
+                                                   char *dst, std::size_t n)
+    {
+        __m256i low{_mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.data())))};
+        __m256i high{_mm256_broadcastsi128_si256(
+            _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables.data() + 16)))};
+        __m256i mask{_mm256_set1_epi8(0xF)};
+        std::size_t i{0};
+        for (; i + 32 <= n; i += 32)
+        {
+            __m256i s{_mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i))};
+            __m256i product{_mm256_xor_si256(
+                _mm256_shuffle_epi8(low, _mm256_and_si256(s, mask)),
+                _mm256_shuffle_epi8(high, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)))};
+            auto *d{reinterpret_cast<__m256i *>(dst + i)};
+            _mm256_storeu_si256(d, _mm256_xor_si256(_mm256_loadu_si256(d), product));
+        }
+        multiply_add_bytewise(tables, src + i, dst + i, n - i);
+    }
+#endif
+
+    const region_function multiply_add_region{[]() -> region_function
+                                              {
+#ifdef RTP_HAVE_X86_SIMD
+                                                  __builtin_cpu_init();
+                                                  if (__builtin_cpu_supports("avx2"))
+                                                      return multiply_add_avx2;
+                                                  if (__builtin_cpu_supports("ssse3"))
+                                                      return multiply_add_ssse3;
+#endif
+                                                  return multiply_add_bytewise;
+                                              }()};
+}
+
+namespace fec
+{
+    bool is_valid(const parameters &parameters)
+    {
+        return parameters.group_size >= 1 && parameters.group_size <= GROUP_MAX &&
+               parameters.n_parity >= 1 && parameters.n_parity <= PARITY_MAX &&
+               parameters.n_parity <= parameters.group_size;
+    }
+
+    void multiply_add(std::uint8_t c, const char *src, char *dst, std::size_t n)
+    {
+        if (c == 0)
+            return;
+        if (c == 1)
+        {
+            for (std::size_t i{0}; i < n; i++)
+                dst[i] ^= src[i];
+            return;
+        }
+        nibble_tables tables;
+        for (std::uint8_t x{0}; x < 16; x++)
+        {
+            tables[x] = multiply(c, x);
+            tables[16 + x] = multiply(c, static_cast<std::uint8_t>(x << 4));
+        }
+        multiply_add_region(tables, src, dst, n);
+    }
+
+    encoder::encoder(const parameters &parameters, std::size_t payload_size)
+        : m_parameters{parameters}, m_symbol_size{SYMBOL_HEADER_SIZE + payload_size},
+          m_coefficients(coefficient_matrix(parameters)),
+          m_symbols(parameters.n_parity * m_symbol_size, 0)
+    {
+    }
+
+    void encoder::add(const rtp_header &header, const char *payload)
+    {
+        std::uint16_t length{header.get_length()};
+        const char symbol_header[SYMBOL_HEADER_SIZE]{static_cast<char>(length & 0xFF),
+                                                     static_cast<char>(length >> 8),
+                                                     static_cast<char>(header.get_flag())};
+        for (std::size_t j{0}; j < m_parameters.n_parity; j++)
+        {
+            std::uint8_t c{m_coefficients[j * m_parameters.group_size + m_n_members]};
+            char *symbol{m_symbols.data() + j * m_symbol_size};
+            multiply_add(c, symbol_header, symbol, SYMBOL_HEADER_SIZE);
+            multiply_add(c, payload, symbol + SYMBOL_HEADER_SIZE, length);
+        }
+        m_length = std::max(m_length, SYMBOL_HEADER_SIZE + length);
+        m_n_members++;
+    }
+
+    bool encoder::is_full() const { return m_n_members == m_parameters.group_size; }
+    std::size_t encoder::size() const { return m_n_members; }
+
+    void encoder::make_parity(std::size_t j, std::uint32_t seq_num, packet_view packet) const
+    {
+        char *buf{packet.get_buf()};
+        buf[0] = static_cast<char>(j);
+        buf[1] = static_cast<char>(m_n_members);
+        std::memcpy(buf + HEADER_SIZE, m_symbols.data() + j * m_symbol_size, m_length);
+        packet.make_packet(seq_num, static_cast<std::uint16_t>(HEADER_SIZE + m_length), PARITY);
+    }
+
+    void encoder::reset()
+    {
+        for (std::size_t j{0}; j < m_parameters.n_parity; j++)
+            std::memset(m_symbols.data() + j * m_symbol_size, 0, m_length);
+        m_n_members = 0;
+        m_length = 0;
+    }
+
+    decoder::decoder(const parameters &parameters, std::size_t payload_size,
+                     std::size_t window_size, std::size_t start_seq_num)
+        : m_parameters{parameters}, m_payload_size{payload_size},
+          m_symbol_size{SYMBOL_HEADER_SIZE + payload_size}, m_start_seq_num{start_seq_num},
+          m_coefficients(coefficient_matrix(parameters)),
+          m_groups(window_size / parameters.group_size + 2),
+          m_symbols(m_groups.size() * parameters.n_parity * m_symbol_size),
+          m_recovered_symbols(parameters.n_parity * m_symbol_size)
+    {
+        m_recovered.reserve(parameters.n_parity);
+    }
+
+    decoder::group *decoder::find_group(std::size_t number)
+    {
+        group &g{m_groups[number % m_groups.size()]};
+        if (g.number == number)
+            return &g;
+        if (g.number != NO_GROUP && g.number > number)
+            return nullptr;
+        g = {number, 0, 0, 0, 0};
+        std::memset(symbol(g, 0), 0, m_parameters.n_parity * m_symbol_size);
+        return &g;
+    }
+
+    char *decoder::symbol(const group &group, std::size_t j)
+    {
+        auto slot{static_cast<std::size_t>(&group - m_groups.data())};
+        return m_symbols.data() + (slot * m_parameters.n_parity + j) * m_symbol_size;
+    }
+
+    void decoder::add_data(std::size_t seq_num, const rtp_header &header, const char *payload)
+    {
+        if (seq_num < m_start_seq_num)
+            return;
+        std::size_t offset{seq_num - m_start_seq_num};
+        std::size_t member{offset % m_parameters.group_size};
+        group *g{find_group(offset / m_parameters.group_size)};
+        if (g == nullptr || (g->data_received >> member & 1))
+            return;
+        g->data_received |= std::uint64_t{1} << member;
+
+        std::uint16_t length{header.get_length()};
+        if (SYMBOL_HEADER_SIZE + length > m_symbol_size)
+            return;
+        const char symbol_header[SYMBOL_HEADER_SIZE]{static_cast<char>(length & 0xFF),
+                                                     static_cast<char>(length >> 8),
+                                                     static_cast<char>(header.get_flag())};
+        for (std::size_t j{0}; j < m_parameters.n_parity; j++)
+        {
+            std::uint8_t c{m_coefficients[j * m_parameters.group_size + member]};
+            char *s{symbol(*g, j)};
+            multiply_add(c, symbol_header, s, SYMBOL_HEADER_SIZE);
+            multiply_add(c, payload, s + SYMBOL_HEADER_SIZE, length);
+        }
+    }
+
+    bool decoder::add_parity(std::size_t first_seq_num, packet_view parity)
+    {
+        const char *buf{parity.get_buf()};
+        std::size_t length{parity.get_length()};
+        if (length < OVERHEAD || length > HEADER_SIZE + m_symbol_size)
+            return false;
+        auto j{static_cast<std::uint8_t>(buf[0])};
+        auto n_members{static_cast<std::uint8_t>(buf[1])};
+        if (j >= m_parameters.n_parity || n_members == 0 ||
+            n_members > m_parameters.group_size || first_seq_num < m_start_seq_num ||
+            (first_seq_num - m_start_seq_num) % m_parameters.group_size != 0)
+            return false;
+
+        group *g{find_group((first_seq_num - m_start_seq_num) / m_parameters.group_size)};
+        if (g == nullptr || (g->parity_received >> j & 1))
+            return true;
+        // 同一组的校验包一样长
+        std::size_t symbol_length{length - HEADER_SIZE};
+        if (g->n_members != 0 && (g->n_members != n_members || g->length != symbol_length))
+            return false;
+        g->n_members = n_members;
+        g->length = symbol_length;
+        g->parity_received |= 1U << j;
+        multiply_add(1, buf + HEADER_SIZE, symbol(*g, j), symbol_length);
+        return true;
+    }
+
+    std::size_t decoder::group_size() const { return m_parameters.group_size; }
+
+    // 设缺的数据包为 x, 所选的校验包累积的符号为 b, 系数矩阵中对应的方阵为 A,
+    // 则 A x = b. 用 Gauss-Jordan 消元求出 A 的逆, x = A^-1 b.
+    const std::vector<recovered_packet> &decoder::recover(std::size_t seq_num)
+    {
+        m_recovered.clear();
+        if (seq_num < m_start_seq_num)
+            return m_recovered;
+        std::size_t number{(seq_num - m_start_seq_num) / m_parameters.group_size};
+        group &g{m_groups[number % m_groups.size()]};
+        if (g.number != number || g.n_members == 0)
+            return m_recovered;
+        std::uint64_t all{g.n_members == 64 ? ~std::uint64_t{0}
+                                            : (std::uint64_t{1} << g.n_members) - 1};
+        std::uint64_t missing{all & ~g.data_received};
+        auto n_missing{static_cast<std::size_t>(std::popcount(missing))};
+        auto n_parity{static_cast<std::size_t>(std::popcount(g.parity_received))};
+        if (n_missing == 0 || n_missing > n_parity)
+            return m_recovered;
+
+        std::array<std::size_t, PARITY_MAX> rows, columns;
+        for (std::size_t j{0}, r{0}; r < n_missing; j++)
+            if (g.parity_received >> j & 1)
+                rows[r++] = j;
+        for (std::size_t i{0}, c{0}; c < n_missing; i++)
+            if (missing >> i & 1)
+                columns[c++] = i;
+
+        std::array<std::array<std::uint8_t, PARITY_MAX>, PARITY_MAX> a{}, inv{};
+        for (std::size_t r{0}; r < n_missing; r++)
+        {
+            for (std::size_t c{0}; c < n_missing; c++)
+                a[r][c] = m_coefficients[rows[r] * m_parameters.group_size + columns[c]];
+            inv[r][r] = 1;
+        }
+        for (std::size_t col{0}; col < n_missing; col++)
+        {
+            std::size_t pivot{col};
+            while (pivot < n_missing && a[pivot][col] == 0)
+                pivot++;
+            if (pivot == n_missing)
+                return m_recovered;
+            std::swap(a[pivot], a[col]);
+            std::swap(inv[pivot], inv[col]);
+            std::uint8_t scale{inverse(a[col][col])};
+            for (std::size_t c{0}; c < n_missing; c++)
+            {
+                a[col][c] = multiply(a[col][c], scale);
+                inv[col][c] = multiply(inv[col][c], scale);
+            }
+            for (std::size_t r{0}; r < n_missing; r++)
+            {
+                std::uint8_t factor{a[r][col]};
+                if (r == col || factor == 0)
+                    continue;
+                for (std::size_t c{0}; c < n_missing; c++)
+                {
+                    a[r][c] ^= multiply(factor, a[col][c]);
+                    inv[r][c] ^= multiply(factor, inv[col][c]);
+                }
+            }
+        }
+
+        std::size_t first_seq_num{m_start_seq_num + number * m_parameters.group_size};
+        for (std::size_t c{0}; c < n_missing; c++)
+        {
+            char *out{m_recovered_symbols.data() + c * m_symbol_size};
+            std::memset(out, 0, g.length);
+            for (std::size_t r{0}; r < n_missing; r++)
+                multiply_add(inv[c][r], symbol(g, rows[r]), out, g.length);
+            auto length{static_cast<std::uint16_t>(static_cast<std::uint8_t>(out[0]) |
+                                                   static_cast<std::uint8_t>(out[1]) << 8)};
+            // 校验包与数据包对不上 (例如对端有误) 时解出的长度没有意义
+            if (SYMBOL_HEADER_SIZE + length > g.length || length > m_payload_size)
+                continue;
+            m_recovered.push_back({first_seq_num + columns[c], length,
+                                   static_cast<std::uint8_t>(out[2]),
+                                   out + SYMBOL_HEADER_SIZE});
+        }
+        g.data_received |= missing;
+        return m_recovered;
+    }
+}
@@ -0,0 +1,131 @@
+#ifndef FEC_HXX
+#define FEC_HXX
+
+#include "rtp_header.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 前向纠错. 从第一个数据包起每 `group_size` 个数据包为一组, 发送端第一次发完一组
+// (或文件的最后一个包) 后紧接着发出 `n_parity` 个校验包. 接收端收到的校验包不少于组中
+// 缺的数据包时直接解出它们, 不必等超时与重传.
+//
+// 编码是 GF(2^8) 上的系统 Cauchy Reed-Solomon 码. 每个数据包看作一个符号:
+// 2 字节小端的负载长度、1 字节的标志与负载, 短的符号补 0 到组中最长的长度.
+// 第 j 个校验包的符号是各数据包的符号乘以系数 c[j][i] 之和 (加法即异或). Cauchy 矩阵的
+// 任意方阵都可逆, 每列同乘一个数也不变, 所以把每列都除以第一行的系数: 第一个校验包
+// 就是各符号的异或, 只用一个校验包时即是 XOR 奇偶校验.
+//
+// 校验包带 `PARITY` 标志, `seq_num` 为组中第一个数据包的序号 (低 32 位), 负载是
+// FEC 头 (校验包在组中的编号、组中数据包的个数, 各 1 字节) 与符号. 校验包不确认也不重传.
+namespace fec
+{
+    constexpr std::size_t GROUP_MAX{64};
+    constexpr std::size_t PARITY_MAX{16};
+    constexpr std::size_t HEADER_SIZE{2};
+    constexpr std::size_t SYMBOL_HEADER_SIZE{3};
+    // 校验包的负载比组中最长的数据包多这么多字节. 协商了 FEC 时数据包的负载
+    // 相应缩短, 校验包就不会超过协商的负载长度.
+    constexpr std::size_t OVERHEAD{HEADER_SIZE + SYMBOL_HEADER_SIZE};
+
+    struct [[gnu::packed]] parameters
+    {
+        std::uint8_t group_size;
+        std::uint8_t n_parity;
+
+        friend bool operator==(const parameters &, const parameters &) = default;
+    };
+
+    // 每组 1 到 `GROUP_MAX` 个数据包, 1 到 `PARITY_MAX` 个且不多于数据包的校验包
+    bool is_valid(const parameters &parameters);
+
+    // `dst` 的 `n` 字节加上 `src` 的 `n` 字节乘以 `c`. 支持时用 AVX2 或 SSSE3 的
+    // 半字节查表, 否则逐字节查表.
+    void multiply_add(std::uint8_t c, const char *src, char *dst, std::size_t n);
+
+    // 发送端: 按顺序加入一组中每个数据包第一次发出时的包头与负载, 组满或文件结束时
+    // 作出校验包
+    class encoder
+    {
+    private:
+        parameters m_parameters;
+        std::size_t m_symbol_size;
+        std::vector<std::uint8_t> m_coefficients;
+        // 各校验包的符号, 每个 `m_symbol_size` 字节
+        std::vector<char> m_symbols;
+        std::size_t m_n_members{0};
+        // 组中最长的符号
+        std::size_t m_length{0};
+
+    public:
+        // `payload_size` 是数据包的最大负载
+        encoder(const parameters &parameters, std::size_t payload_size);
+
+        void add(const rtp_header &header, const char *payload);
+        bool is_full() const;
+        std::size_t size() const;
+        // 把第 `j` 个校验包作成到 `packet`, 负载长度为 `size()` 个符号中最长的加上
+        // `OVERHEAD`. `seq_num` 是组中第一个数据包的序号.
+        void make_parity(std::size_t j, std::uint32_t seq_num, packet_view packet) const;
+        // 开始新的一组
+        void reset();
+    };
+
+    struct recovered_packet
+    {
+        std::size_t seq_num;
+        std::uint16_t length;
+        std::uint8_t flag;
+        const char *payload;
+    };
+
+    // 接收端: 为与接收窗口重叠的每一组累积 "校验包的符号减去已收到的数据包乘以系数"
+    // (即缺的数据包乘以系数之和), 缺的数据包不多于收到的校验包时解出它们.
+    // 每个数据包与校验包只能加入一次.
+    class decoder
+    {
+    private:
+        static constexpr std::size_t NO_GROUP{~std::size_t{0}};
+
+        struct group
+        {
+            // 从第一个数据包起算的组号
+            std::size_t number{NO_GROUP};
+            std::uint64_t data_received;
+            std::uint32_t parity_received;
+            // 组中数据包的个数与最长的符号, 收到校验包之前不知道 (为 0)
+            std::size_t n_members;
+            std::size_t length;
+        };
+
+        parameters m_parameters;
+        std::size_t m_payload_size;
+        std::size_t m_symbol_size;
+        std::size_t m_start_seq_num;
+        std::vector<std::uint8_t> m_coefficients;
+        // 窗口最多与 `window_size / group_size + 2` 组重叠, 第 n 组放在 n 除以组数的余数处
+        std::vector<group> m_groups;
+        // 每组 `n_parity` 个累积的符号
+        std::vector<char> m_symbols;
+        std::vector<char> m_recovered_symbols;
+        std::vector<recovered_packet> m_recovered;
+
+        // 第 `number` 组, 位置被更新的组占用时返回空指针, 被更旧的组占用时清空重用
+        group *find_group(std::size_t number);
+        char *symbol(const group &group, std::size_t j);
+
+    public:
+        // `payload_size` 是数据包的最大负载, `start_seq_num` 是第一个数据包的序号
+        decoder(const parameters &parameters, std::size_t payload_size, std::size_t window_size,
+                std::size_t start_seq_num);
+
+        void add_data(std::size_t seq_num, const rtp_header &header, const char *payload);
+        // 加入组中第一个数据包序号为 `first_seq_num` 的校验包. 校验包不合法时返回 false.
+        bool add_parity(std::size_t first_seq_num, packet_view parity);
+        // 解出 `seq_num` 所在组中缺的数据包, 不能解出时为空. 结果在下一次调用前有效.
+        const std::vector<recovered_packet> &recover(std::size_t seq_num);
+        std::size_t group_size() const;
+    };
+}
+
+#endif
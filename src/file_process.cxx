@@ -1,6 +1,11 @@
 #include "file_process.hxx"
 #include "error_process.hxx"
 #include "tools.hxx"
+#include <cerrno>
+#include <fcntl.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 namespace file_process
@@ -35,4 +40,119 @@ namespace file_process
 
     bool fd_wrapper::is_valid() const { return m_file_descriptor >= 0; }
     int fd_wrapper::get_file_descriptor() { return m_file_descriptor; }
+
+    mapped_file::mapped_file(const char *file_path)
+    {
+        fd_wrapper file{::open(file_path, O_RDONLY)};
+        if (!file.is_valid())
+            error_process::unix_error("`open()` 错误: ");
+
+        struct stat st;
+        if (fstat(file.get_file_descriptor(), &st) == -1)
+            error_process::unix_error("`fstat()` 错误: ");
+        m_size = st.st_size;
+        if (m_size == 0)
+            return;
+
+        void *addr{mmap(nullptr, m_size, PROT_READ, MAP_SHARED, file.get_file_descriptor(), 0)};
+        if (addr == MAP_FAILED)
+            error_process::unix_error("`mmap()` 错误: ");
+        m_data = static_cast<const char *>(addr);
+
+        if (madvise(addr, m_size, MADV_SEQUENTIAL) == -1)
+            log_debug("`madvise(MADV_SEQUENTIAL)` 失败");
+    }
+
+    mapped_file::~mapped_file()
+    {
+        if (m_data != nullptr)
+            munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    const char *mapped_file::data() const { return m_data; }
+    std::size_t mapped_file::size() const { return m_size; }
+
+    static const std::size_t page_size{static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+
+    // `madvise()` 要求起点按页对齐. 预读时向外取整, 释放时向内取整,
+    // 以免释放掉仍在窗口内的页.
+    static void advise(const char *data, std::size_t size, std::size_t begin,
+                       std::size_t end, bool outward, int advice)
+    {
+        if (end > size)
+            end = size;
+        if (outward)
+        {
+            begin -= begin % page_size;
+            end += (page_size - end % page_size) % page_size;
+        }
+        else
+        {
+            begin += (page_size - begin % page_size) % page_size;
+            end -= end % page_size;
+        }
+        if (begin < end)
+            madvise(const_cast<char *>(data) + begin, end - begin, advice);
+    }
+
+    void mapped_file::prefetch(std::size_t offset, std::size_t length) const
+    {
+        if (offset < m_size)
+            advise(m_data, m_size, offset, offset + length, true, MADV_WILLNEED);
+    }
+
+    void mapped_file::release(std::size_t offset, std::size_t length) const
+    {
+        if (offset < m_size)
+            advise(m_data, m_size, offset, offset + length, false, MADV_DONTNEED);
+    }
+
+    bool is_stream(const char *file_path)
+    {
+        if (std::string_view{file_path} == "-")
+            return true;
+        struct stat st;
+        return stat(file_path, &st) == 0 && !S_ISREG(st.st_mode);
+    }
+
+    stream_input::stream_input(const char *file_path)
+    {
+        if (std::string_view{file_path} == "-")
+            m_fd = STDIN_FILENO;
+        else
+        {
+            // 以阻塞方式打开, 命名管道要等到有写端
+            m_wrapper.open(::open(file_path, O_RDONLY | O_CLOEXEC));
+            if (!m_wrapper.is_valid())
+                error_process::unix_error("`open()` 错误: ");
+            m_fd = m_wrapper.get_file_descriptor();
+        }
+
+        int flags{fcntl(m_fd, F_GETFL)};
+        if (flags == -1 || fcntl(m_fd, F_SETFL, flags | O_NONBLOCK) == -1)
+            error_process::unix_error("`fcntl()` 错误: ");
+        m_saved_flags = flags;
+    }
+
+    stream_input::~stream_input()
+    {
+        if (m_saved_flags != -1)
+            fcntl(m_fd, F_SETFL, m_saved_flags);
+    }
+
+    int stream_input::get_file_descriptor() const { return m_fd; }
+
+    std::optional<std::size_t> stream_input::read(char *buf, std::size_t n_bytes)
+    {
+        while (true)
+        {
+            ssize_t n{::read(m_fd, buf, n_bytes)};
+            if (n >= 0)
+                return static_cast<std::size_t>(n);
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return std::nullopt;
+            if (errno != EINTR)
+                error_process::unix_error("`read()` 错误: ");
+        }
+    }
 }
@@ -1,6 +1,9 @@
 #ifndef FILE_PROCESS_H
 #define FILE_PROCESS_H
 
+#include <cstddef>
+#include <optional>
+
 namespace file_process
 {
     void close(int fd);
@@ -25,6 +28,52 @@ namespace file_process
         bool is_valid() const;
         int get_file_descriptor();
     };
+
+    // 只读映射整个文件, 供发送端直接从映射中取负载, 省去一次拷贝.
+    class mapped_file
+    {
+    private:
+        const char *m_data{nullptr};
+        std::size_t m_size{0};
+
+    public:
+        mapped_file &operator=(const mapped_file &) = delete;
+        mapped_file(const mapped_file &) = delete;
+
+        mapped_file(const char *file_path);
+        ~mapped_file();
+
+        const char *data() const;
+        std::size_t size() const;
+
+        // 提示内核即将读取 [offset, offset + length)
+        void prefetch(std::size_t offset, std::size_t length) const;
+        // 提示内核 [offset, offset + length) 不再需要, 释放其占用的驻留内存
+        void release(std::size_t offset, std::size_t length) const;
+    };
+
+    // `file_path` 是 `-` (标准输入) 或存在且不是普通文件 (管道、终端等), 大小事先未知
+    bool is_stream(const char *file_path);
+
+    // 以非阻塞方式读的流. 标准输入的状态标志与其他进程共享, 析构时恢复.
+    class stream_input
+    {
+    private:
+        fd_wrapper m_wrapper{-1};
+        int m_fd{-1};
+        int m_saved_flags{-1};
+
+    public:
+        stream_input &operator=(const stream_input &) = delete;
+        stream_input(const stream_input &) = delete;
+
+        stream_input(const char *file_path);
+        ~stream_input();
+
+        int get_file_descriptor() const;
+        // 返回读到的字节数, 0 表示读完; 暂时没有数据时返回空
+        std::optional<std::size_t> read(char *buf, std::size_t n_bytes);
+    };
 }
 
 #endif
@@ -0,0 +1,112 @@
+#include "impairment.hxx"
+#include <algorithm>
+
+// 不用 `std::uniform_real_distribution`: 它的结果随标准库实现而不同
+static double uniform(std::mt19937_64 &random) { return (random() >> 11) * 0x1.0p-53; }
+
+static impairment::clock::duration milliseconds(double ms)
+{
+    return std::chrono::duration_cast<impairment::clock::duration>(
+        std::chrono::duration<double, std::milli>{ms});
+}
+
+impairment::impairment(const impairment_options &options, bool enabled, std::uint64_t stream)
+    : m_options{options}, m_enabled{enabled}
+{
+    std::seed_seq seed{static_cast<std::uint32_t>(options.seed),
+                       static_cast<std::uint32_t>(options.seed >> 32),
+                       static_cast<std::uint32_t>(stream)};
+    m_random.seed(seed);
+}
+
+bool impairment::chance(double probability)
+{
+    return probability > 0 && uniform(m_random) < probability;
+}
+
+bool impairment::lose()
+{
+    if (m_options.ge_p == 0)
+        return chance(m_options.loss);
+
+    if (m_bad_state)
+        m_bad_state = !chance(m_options.ge_r);
+    else
+        m_bad_state = chance(m_options.ge_p);
+    return chance(m_bad_state ? m_options.ge_bad_loss : m_options.ge_good_loss);
+}
+
+impairment::verdict impairment::decide(clock::time_point now, std::size_t length)
+{
+    verdict result;
+    result.release = now;
+    m_counters.packets++;
+    m_counters.bytes += length;
+    if (!m_enabled)
+    {
+        m_counters.forwarded++;
+        return result;
+    }
+
+    if (lose())
+    {
+        m_counters.lost++;
+        result.result = fate::lost;
+        return result;
+    }
+
+    if (m_options.rate > 0)
+    {
+        auto start{std::max(now, m_link_free)};
+        std::chrono::duration<double> backlog{start - now};
+        if (backlog.count() * static_cast<double>(m_options.rate) + static_cast<double>(length) >
+            static_cast<double>(m_options.queue_bytes))
+        {
+            m_counters.queue_dropped++;
+            result.result = fate::queue_dropped;
+            return result;
+        }
+        m_link_free = start + milliseconds(1000.0 * static_cast<double>(length) /
+                                           static_cast<double>(m_options.rate));
+        result.release = m_link_free;
+    }
+
+    double delay{m_options.delay_ms};
+    if (m_options.jitter_ms > 0)
+        delay += (2 * uniform(m_random) - 1) * m_options.jitter_ms;
+    result.release = std::max(result.release + milliseconds(delay), m_last_release);
+    if (chance(m_options.reorder))
+    {
+        // 不更新 `m_last_release`, 之后的包可以先发出
+        result.reordered = true;
+        result.release += milliseconds(m_options.reorder_delay_ms);
+        m_counters.reordered++;
+    }
+    else
+        m_last_release = result.release;
+
+    if (chance(m_options.duplicate))
+    {
+        result.duplicated = true;
+        m_counters.duplicated++;
+    }
+    if (length > 0 && chance(m_options.corrupt))
+    {
+        result.corrupt_bit = m_random() % (length * 8);
+        m_counters.corrupted++;
+    }
+    m_counters.forwarded++;
+    return result;
+}
+
+const impairment::counters &impairment::get_counters() const { return m_counters; }
+
+std::ostream &operator<<(std::ostream &os, const impairment::counters &counters)
+{
+    os << "{\"packets\":" << counters.packets << ",\"bytes\":" << counters.bytes
+       << ",\"forwarded\":" << counters.forwarded << ",\"lost\":" << counters.lost
+       << ",\"queue_dropped\":" << counters.queue_dropped
+       << ",\"reordered\":" << counters.reordered << ",\"duplicated\":" << counters.duplicated
+       << ",\"corrupted\":" << counters.corrupted << '}';
+    return os;
+}
@@ -0,0 +1,77 @@
+#ifndef IMPAIRMENT_HXX
+#define IMPAIRMENT_HXX
+
+#include "options.hxx"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <random>
+
+// 单向链路的损伤模型, 供损伤代理 (`proxy.cxx`) 使用. 每个经过的包依次经过:
+// 丢包 (伯努利或 Gilbert-Elliott) -> 瓶颈带宽与队列 -> 时延与抖动 -> 乱序,
+// 然后决定是否重复、是否翻转一位. 随机数只取决于种子与包的先后顺序.
+class impairment
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    enum class fate
+    {
+        forwarded,
+        lost,
+        // 瓶颈队列已满
+        queue_dropped
+    };
+
+    struct verdict
+    {
+        fate result{fate::forwarded};
+        // 该在什么时候发出
+        clock::time_point release;
+        bool reordered{false};
+        bool duplicated{false};
+        // 要翻转的位, 从包的第一个字节的最低位数起
+        std::optional<std::size_t> corrupt_bit;
+    };
+
+    // 这个方向做过的事
+    struct counters
+    {
+        std::uint64_t packets{0};
+        std::uint64_t bytes{0};
+        std::uint64_t forwarded{0};
+        std::uint64_t lost{0};
+        std::uint64_t queue_dropped{0};
+        std::uint64_t reordered{0};
+        std::uint64_t duplicated{0};
+        std::uint64_t corrupted{0};
+    };
+
+private:
+    const impairment_options &m_options;
+    // 为 false 时只转发, 不做任何损伤
+    bool m_enabled;
+    std::mt19937_64 m_random;
+    bool m_bad_state{false};
+    // 瓶颈链路空闲的时间, 以及上一个不乱序的包的发出时间 (之后的包不早于它)
+    clock::time_point m_link_free{};
+    clock::time_point m_last_release{};
+    counters m_counters;
+
+    bool chance(double probability);
+    bool lose();
+
+public:
+    // `stream` 区分同一个种子下的不同方向
+    impairment(const impairment_options &options, bool enabled, std::uint64_t stream);
+
+    verdict decide(clock::time_point now, std::size_t length);
+    const counters &get_counters() const;
+};
+
+// 一个 JSON 对象, 不含换行
+std::ostream &operator<<(std::ostream &os, const impairment::counters &counters);
+
+#endif
@@ -0,0 +1,108 @@
+#include "journal.hxx"
+#include "checksum.hxx"
+#include "error_process.hxx"
+#include "tools.hxx"
+#include <cerrno>
+#include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::uint32_t MAGIC{0x4A505452}; // "RTPJ"
+
+    // 日志只有这一条记录, 每次原地覆盖. 校验和覆盖之前的字段, 写了一半的记录因而作废.
+    struct [[gnu::packed]] record
+    {
+        std::uint32_t magic;
+        journal::file_identity identity;
+        std::uint64_t committed;
+        std::uint32_t checksum;
+    };
+
+    std::string journal_path(const char *output_path)
+    {
+        return std::string{output_path} + ".journal";
+    }
+
+    std::uint32_t record_checksum(const record &r)
+    {
+        return compute_checksum(&r, offsetof(record, checksum));
+    }
+}
+
+namespace journal
+{
+    file_identity identify(const char *file_path)
+    {
+        struct stat st;
+        if (stat(file_path, &st) == -1)
+            error_process::unix_error("`stat()` 错误: ");
+        return {static_cast<std::uint64_t>(st.st_size),
+                static_cast<std::uint64_t>(st.st_mtim.tv_sec) * 1'000'000'000 +
+                    static_cast<std::uint64_t>(st.st_mtim.tv_nsec)};
+    }
+
+    std::uint64_t committed_bytes(const char *output_path, const file_identity &identity)
+    {
+        std::string path{journal_path(output_path)};
+        file_process::fd_wrapper file{::open(path.c_str(), O_RDONLY)};
+        if (!file.is_valid())
+        {
+            log_debug("没有续传日志 `", path, '`');
+            return 0;
+        }
+        record r;
+        if (pread(file.get_file_descriptor(), &r, sizeof(r), 0) != sizeof(r) ||
+            r.magic != MAGIC || r.checksum != record_checksum(r))
+        {
+            log_debug("续传日志 `", path, "` 已损坏");
+            return 0;
+        }
+        if (r.identity != identity || r.committed > identity.size)
+        {
+            log_debug("续传日志记录的不是同一个文件, 从头接收");
+            return 0;
+        }
+        struct stat st;
+        if (stat(output_path, &st) == -1 || !S_ISREG(st.st_mode) ||
+            static_cast<std::uint64_t>(st.st_size) < r.committed)
+        {
+            log_debug("输出比续传日志记录的短, 从头接收");
+            return 0;
+        }
+        return r.committed;
+    }
+
+    writer::writer(const char *output_path, const file_identity &identity,
+                   std::uint64_t committed)
+        : m_path{journal_path(output_path)}, m_identity{identity}
+    {
+        m_wrapper.open(::open(m_path.c_str(), O_WRONLY | O_CREAT, 0644));
+        if (!m_wrapper.is_valid())
+            logs::error("打开续传日志 `", m_path, "` 时出现了问题");
+        m_fd = m_wrapper.get_file_descriptor();
+        store(committed);
+    }
+
+    void writer::store(std::uint64_t committed)
+    {
+        record r{MAGIC, m_identity, committed, 0};
+        r.checksum = record_checksum(r);
+        if (pwrite(m_fd, &r, sizeof(r), 0) != sizeof(r))
+            error_process::unix_error("写续传日志错误: ");
+        if (fdatasync(m_fd) == -1)
+            error_process::unix_error("`fdatasync()` 错误: ");
+        log_debug("续传日志: 已写入 ", committed, " 字节");
+    }
+
+    void writer::remove()
+    {
+        m_wrapper.open(-1);
+        if (unlink(m_path.c_str()) == -1 && errno != ENOENT)
+            error_process::unix_error("`unlink()` 错误: ");
+    }
+
+    const file_identity &writer::identity() const { return m_identity; }
+}
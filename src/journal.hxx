@@ -0,0 +1,56 @@
+#ifndef JOURNAL_HXX
+#define JOURNAL_HXX
+
+#include "file_process.hxx"
+#include <cstdint>
+#include <string>
+
+// 续传日志. 协商了续传 (发送端的 `--resume`) 时, 接收端在输出文件旁的 `<输出>.journal`
+// 中记下发送端文件的标识与输出中已持久写入的前缀长度. 输出 `fdatasync()` 之后日志才前进,
+// 日志本身同步写入并带校验和, 所以传输中断 (超时、崩溃、断电) 后日志记录的前缀一定已在
+// 盘上. 窗口中乱序收到的包不记, 续传时最多重发一个窗口.
+//
+// 发送端以同一个文件再次连接时, 接收端在 SYN ACK 中告知从哪个字节开始发送. 收完后
+// 按 FIN 中整个文件的校验和核对输出, 之后删除日志.
+namespace journal
+{
+    // 发送端文件的标识: 大小与修改时间 (纳秒). 两者都没变就认为是同一个文件,
+    // 结束时整个文件的核对兜底.
+    struct [[gnu::packed]] file_identity
+    {
+        std::uint64_t size;
+        std::uint64_t modified_ns;
+
+        friend bool operator==(const file_identity &, const file_identity &) = default;
+    };
+
+    file_identity identify(const char *file_path);
+
+    // 日志记录的 `identity` 文件已持久写入 `output_path` 的字节数. 没有日志、日志损坏、
+    // 记录的是别的文件或输出比记录的短时为 0.
+    std::uint64_t committed_bytes(const char *output_path, const file_identity &identity);
+
+    class writer
+    {
+    private:
+        std::string m_path;
+        file_process::fd_wrapper m_wrapper{-1};
+        int m_fd;
+        file_identity m_identity;
+
+    public:
+        writer &operator=(const writer &) = delete;
+        writer(const writer &) = delete;
+
+        // 打开 (没有时新建) `output_path` 的日志, 记下已写入 `committed` 字节
+        writer(const char *output_path, const file_identity &identity, std::uint64_t committed);
+
+        // 调用者已同步了输出的前 `committed` 字节
+        void store(std::uint64_t committed);
+        // 整个文件核对完后删除日志
+        void remove();
+        const file_identity &identity() const;
+    };
+}
+
+#endif
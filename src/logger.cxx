@@ -0,0 +1,252 @@
+#include "logger.hxx"
+#include "error_process.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::size_t SLOT_SIZE{512};
+    constexpr std::size_t N_SLOTS{4096};
+    constexpr std::chrono::milliseconds IDLE_SLEEP{1};
+
+    thread_local std::ostringstream line_stream;
+
+    void write_all(int fd, std::string_view text)
+    {
+        while (!text.empty())
+        {
+            ssize_t n{::write(fd, text.data(), text.size())};
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return;
+            }
+            text.remove_prefix(static_cast<std::size_t>(n));
+        }
+    }
+
+    // 有界多生产者队列 (按 Vyukov 的做法, 每个槽位一个序号). 槽位 `i` 的序号为
+    // `pos` 时可以写入第 `pos` 条, 为 `pos + 1` 时可以读出; 读出后加上 `N_SLOTS`.
+    struct slot
+    {
+        std::atomic<std::size_t> sequence;
+        std::uint16_t length;
+        char text[SLOT_SIZE];
+    };
+
+    class async_logger
+    {
+    private:
+        std::unique_ptr<slot[]> m_slots{new slot[N_SLOTS]};
+        alignas(64) std::atomic<std::size_t> m_write_pos{0};
+        alignas(64) std::atomic<std::size_t> m_read_pos{0};
+        std::atomic<std::size_t> m_n_dropped{0};
+        std::atomic<int> m_fd{STDERR_FILENO};
+
+        // 后台线程在第一条日志时启动, 进程退出时停止; 停止后的日志直接写出
+        std::mutex m_start_mutex;
+        std::atomic<bool> m_running{false};
+        std::atomic<bool> m_stopping{false};
+        std::atomic<bool> m_stopped{false};
+        std::unique_ptr<std::thread> m_thread;
+
+        void start();
+        void run();
+        std::size_t drain(std::string &buffer);
+
+    public:
+        async_logger();
+
+        void push(std::string_view line, bool must_deliver);
+        void set_fd(int fd);
+        void flush();
+        void stop();
+        void after_fork();
+    };
+
+    async_logger &instance()
+    {
+        // 故意不析构: 其它全局对象析构时还会写日志
+        static async_logger *logger{new async_logger};
+        return *logger;
+    }
+
+    async_logger::async_logger()
+    {
+        for (std::size_t i{0}; i < N_SLOTS; i++)
+            m_slots[i].sequence.store(i, std::memory_order_relaxed);
+        std::atexit([] { instance().stop(); });
+        pthread_atfork(nullptr, nullptr, [] { instance().after_fork(); });
+    }
+
+    void async_logger::push(std::string_view line, bool must_deliver)
+    {
+        if (m_stopped.load(std::memory_order_acquire))
+        {
+            write_all(m_fd.load(std::memory_order_relaxed), line);
+            return;
+        }
+        if (!m_running.load(std::memory_order_acquire))
+            start();
+
+        std::size_t pos{m_write_pos.load(std::memory_order_relaxed)};
+        slot *target;
+        while (true)
+        {
+            target = &m_slots[pos % N_SLOTS];
+            std::size_t sequence{target->sequence.load(std::memory_order_acquire)};
+            auto difference{static_cast<std::ptrdiff_t>(sequence - pos)};
+            if (difference == 0)
+            {
+                if (m_write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (difference < 0)
+            {
+                // 队列已满
+                if (must_deliver)
+                    write_all(m_fd.load(std::memory_order_relaxed), line);
+                else
+                    m_n_dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            else
+                pos = m_write_pos.load(std::memory_order_relaxed);
+        }
+
+        std::size_t length{line.size()};
+        if (length > SLOT_SIZE)
+        {
+            // 截断过长的行, 保留换行
+            length = SLOT_SIZE;
+            target->text[SLOT_SIZE - 1] = '\n';
+            std::memcpy(target->text, line.data(), SLOT_SIZE - 1);
+        }
+        else
+            std::memcpy(target->text, line.data(), length);
+        target->length = static_cast<std::uint16_t>(length);
+        target->sequence.store(pos + 1, std::memory_order_release);
+    }
+
+    std::size_t async_logger::drain(std::string &buffer)
+    {
+        std::size_t n{0};
+        std::size_t pos{m_read_pos.load(std::memory_order_relaxed)};
+        while (true)
+        {
+            slot &source{m_slots[pos % N_SLOTS]};
+            if (source.sequence.load(std::memory_order_acquire) != pos + 1)
+                break;
+            buffer.append(source.text, source.length);
+            source.sequence.store(pos + N_SLOTS, std::memory_order_release);
+            pos++;
+            n++;
+        }
+        if (n == 0)
+            return 0;
+
+        std::size_t n_dropped{m_n_dropped.exchange(0, std::memory_order_relaxed)};
+        if (n_dropped > 0)
+            buffer += "[日志] 队列已满, 丢弃了 " + std::to_string(n_dropped) + " 条日志\n";
+        write_all(m_fd.load(std::memory_order_relaxed), buffer);
+        buffer.clear();
+        m_read_pos.store(pos, std::memory_order_release);
+        return n;
+    }
+
+    void async_logger::run()
+    {
+        std::string buffer;
+        while (true)
+        {
+            if (drain(buffer) > 0)
+                continue;
+            if (m_stopping.load(std::memory_order_acquire))
+            {
+                drain(buffer);
+                return;
+            }
+            std::this_thread::sleep_for(IDLE_SLEEP);
+        }
+    }
+
+    void async_logger::start()
+    {
+        std::lock_guard lock{m_start_mutex};
+        if (m_running.load(std::memory_order_relaxed))
+            return;
+        m_thread = std::make_unique<std::thread>([this] { run(); });
+        m_running.store(true, std::memory_order_release);
+    }
+
+    void async_logger::set_fd(int fd)
+    {
+        flush();
+        m_fd.store(fd, std::memory_order_relaxed);
+    }
+
+    void async_logger::flush()
+    {
+        if (!m_running.load(std::memory_order_acquire))
+            return;
+        std::size_t target{m_write_pos.load(std::memory_order_acquire)};
+        while (m_read_pos.load(std::memory_order_acquire) < target)
+            std::this_thread::sleep_for(std::chrono::microseconds{100});
+    }
+
+    void async_logger::stop()
+    {
+        std::lock_guard lock{m_start_mutex};
+        if (m_thread)
+        {
+            m_stopping.store(true, std::memory_order_release);
+            m_thread->join();
+            m_thread.reset();
+        }
+        m_stopped.store(true, std::memory_order_release);
+    }
+
+    // 子进程中没有后台线程, 丢掉父进程的线程对象, 下一条日志时重新启动
+    void async_logger::after_fork()
+    {
+        new (&m_start_mutex) std::mutex;
+        (void)m_thread.release();
+        m_running.store(false, std::memory_order_relaxed);
+    }
+}
+
+namespace logs
+{
+    std::ostream &begin_line()
+    {
+        line_stream.str({});
+        return line_stream;
+    }
+
+    void end_line(bool must_deliver) { instance().push(line_stream.view(), must_deliver); }
+
+    void set_output_file(const char *file_path)
+    {
+        int fd{::open(file_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+        if (fd < 0)
+            error_process::unix_error("打开日志文件错误: ");
+        instance().set_fd(fd);
+    }
+
+    void flush() { instance().flush(); }
+}
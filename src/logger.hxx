@@ -0,0 +1,32 @@
+#ifndef LOGGER_HXX
+#define LOGGER_HXX
+
+#include <ostream>
+
+// 日志级别. 低于编译时 `LOG_LEVEL` (由 CMake 的同名选项设定) 的日志连同参数求值
+// 一起被编译掉.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERROR 2
+#define LOG_LEVEL_NONE 3
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// 异步日志: 各线程把格式化好的一行放入无锁环形队列, 由后台线程写到 stderr 或
+// `set_output_file()` 指定的文件. 队列满时丢弃 (并在之后报告丢弃的条数),
+// 不让数据通路等待终端或磁盘; 错误日志则直接写出, 不会丢失.
+namespace logs
+{
+    // 取得调用线程的行缓冲 (已清空), 写完一行后调用 `end_line()` 提交
+    std::ostream &begin_line();
+    void end_line(bool must_deliver);
+
+    // 之后的日志写到 `file_path`
+    void set_output_file(const char *file_path);
+    // 等待已提交的日志都写出. `fork()` 之前调用, 避免子进程重复输出.
+    void flush();
+}
+
+#endif
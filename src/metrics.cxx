@@ -0,0 +1,243 @@
+#include "metrics.hxx"
+#include "error_process.hxx"
+#include "tools.hxx"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static constexpr std::string_view COUNTER_NAMES[]{
+    "packets_sent",        "packets_retransmitted", "payload_bytes_sent",
+    "packets_compressed",  "parity_packets_sent",   "timeouts",
+    "fast_retransmits",    "acks_received",         "duplicate_acks",
+    "out_of_window_acks",  "packets_received",      "duplicate_packets",
+    "out_of_window_packets", "acks_sent",           "packets_recovered",
+    "checksum_failures"};
+static_assert(std::size(COUNTER_NAMES) == static_cast<std::size_t>(counter::count));
+
+// 计数器由哪一端更新. 输出时只写本端的计数器, 免得另一端的计数器以 0 出现.
+enum class counter_side
+{
+    sender,
+    receiver,
+    both
+};
+static constexpr counter_side COUNTER_SIDES[]{
+    counter_side::sender,   counter_side::sender,   counter_side::sender,
+    counter_side::sender,   counter_side::sender,   counter_side::sender,
+    counter_side::sender,   counter_side::sender,   counter_side::sender,
+    counter_side::sender,   counter_side::receiver, counter_side::receiver,
+    counter_side::receiver, counter_side::receiver, counter_side::receiver,
+    counter_side::both};
+static_assert(std::size(COUNTER_SIDES) == static_cast<std::size_t>(counter::count));
+
+static bool counter_applies(std::size_t i, std::string_view role)
+{
+    switch (COUNTER_SIDES[i])
+    {
+    case counter_side::sender:
+        return role != "receiver";
+    case counter_side::receiver:
+        return role != "sender";
+    default:
+        return true;
+    }
+}
+
+std::size_t histogram::bucket_of(std::uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+        return static_cast<std::size_t>(value);
+    std::size_t shift{static_cast<std::size_t>(std::bit_width(value)) - 4};
+    return SUB_BUCKETS + shift * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+std::uint64_t histogram::upper_bound_of(std::size_t bucket)
+{
+    if (bucket < SUB_BUCKETS)
+        return bucket;
+    std::size_t shift{(bucket - SUB_BUCKETS) / SUB_BUCKETS};
+    std::uint64_t sub{(bucket - SUB_BUCKETS) % SUB_BUCKETS};
+    return ((SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void histogram::record(std::uint64_t value)
+{
+    m_buckets[bucket_of(value)]++;
+    m_count++;
+    m_sum += value;
+    m_min = std::min(m_min, value);
+    m_max = std::max(m_max, value);
+}
+
+void histogram::merge(const histogram &other)
+{
+    for (std::size_t i{0}; i < N_BUCKETS; i++)
+        m_buckets[i] += other.m_buckets[i];
+    m_count += other.m_count;
+    m_sum += other.m_sum;
+    m_min = std::min(m_min, other.m_min);
+    m_max = std::max(m_max, other.m_max);
+}
+
+std::uint64_t histogram::count() const { return m_count; }
+
+std::uint64_t histogram::percentile(double p) const
+{
+    if (m_count == 0)
+        return 0;
+    auto rank{static_cast<std::uint64_t>(p * static_cast<double>(m_count - 1)) + 1};
+    std::uint64_t seen{0};
+    for (std::size_t i{0}; i < N_BUCKETS; i++)
+    {
+        seen += m_buckets[i];
+        if (seen >= rank)
+            return std::min(upper_bound_of(i), m_max);
+    }
+    return m_max;
+}
+
+void histogram::write_json(std::ostream &os) const
+{
+    os << "{\"count\":" << m_count;
+    if (m_count > 0)
+        os << ",\"min\":" << m_min << ",\"mean\":" << m_sum / m_count
+           << ",\"p50\":" << percentile(0.5) << ",\"p90\":" << percentile(0.9)
+           << ",\"p99\":" << percentile(0.99) << ",\"max\":" << m_max;
+    os << '}';
+}
+
+transfer_metrics::transfer_metrics()
+    : m_start{clock::now()}, m_next_sample{m_start + GOODPUT_INTERVAL}
+{
+}
+
+std::uint64_t transfer_metrics::get(counter which) const
+{
+    return m_counters[static_cast<std::size_t>(which)];
+}
+
+void transfer_metrics::sample(clock::time_point now)
+{
+    while (now >= m_next_sample)
+    {
+        m_goodput_samples.push_back(m_interval_bytes);
+        m_interval_bytes = 0;
+        m_next_sample += GOODPUT_INTERVAL;
+    }
+}
+
+void transfer_metrics::stop() { m_end = clock::now(); }
+
+// 吞吐量曲线按各自的开始时间对齐后逐项相加
+void transfer_metrics::merge(const transfer_metrics &other)
+{
+    for (std::size_t i{0}; i < m_counters.size(); i++)
+        m_counters[i] += other.m_counters[i];
+    if (other.m_goodput_bytes > 0 &&
+        (m_goodput_bytes == 0 || other.m_first_progress < m_first_progress))
+        m_first_progress = other.m_first_progress;
+    m_start = std::min(m_start, other.m_start);
+    if (other.m_end && (!m_end || *m_end < *other.m_end))
+        m_end = other.m_end;
+    m_goodput_bytes += other.m_goodput_bytes;
+    m_interval_bytes += other.m_interval_bytes;
+    if (m_goodput_samples.size() < other.m_goodput_samples.size())
+        m_goodput_samples.resize(other.m_goodput_samples.size(), 0);
+    for (std::size_t i{0}; i < other.m_goodput_samples.size(); i++)
+        m_goodput_samples[i] += other.m_goodput_samples[i];
+    rtt.merge(other.rtt);
+    window_occupancy.merge(other.window_occupancy);
+}
+
+void transfer_metrics::write_json(std::ostream &os, std::string_view role, int worker) const
+{
+    auto end{m_end.value_or(clock::now())};
+    std::chrono::duration<double> elapsed{end - m_start};
+    std::chrono::duration<double> active{end - m_first_progress};
+    os << "{\"role\":\"" << role << '"';
+    if (worker >= 0)
+        os << ",\"worker\":" << worker;
+    os << ",\"elapsed_s\":" << elapsed.count() << ",\"counters\":{";
+    bool first{true};
+    for (std::size_t i{0}; i < m_counters.size(); i++)
+    {
+        if (!counter_applies(i, role))
+            continue;
+        os << (first ? "" : ",") << '"' << COUNTER_NAMES[i] << "\":" << m_counters[i];
+        first = false;
+    }
+    os << "},\"goodput_bytes\":" << m_goodput_bytes << ",\"goodput_bytes_per_s\":"
+       << (m_goodput_bytes > 0 && active.count() > 0
+               ? static_cast<double>(m_goodput_bytes) / active.count()
+               : 0)
+       << ",\"goodput_timeline\":{\"interval_s\":" << GOODPUT_INTERVAL.count()
+       << ",\"bytes\":[";
+    for (std::size_t i{0}; i < m_goodput_samples.size(); i++)
+        os << (i > 0 ? "," : "") << m_goodput_samples[i];
+    os << "]},\"rtt_us\":";
+    rtt.write_json(os);
+    os << ",\"window_occupancy\":";
+    window_occupancy.write_json(os);
+    os << '}';
+}
+
+stats_sink::stats_sink(const std::string &path)
+{
+    constexpr std::string_view UNIX_PREFIX{"unix:"};
+    if (path == "-")
+        m_fd = STDOUT_FILENO;
+    else if (path.starts_with(UNIX_PREFIX))
+    {
+        m_socket_path = path.substr(UNIX_PREFIX.size());
+        if (m_socket_path.size() >= sizeof(sockaddr_un::sun_path))
+            logs::error("Unix 套接字路径 `", m_socket_path, "` 太长");
+        m_wrapper.open(socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+        if (!m_wrapper.is_valid())
+            error_process::unix_error("`socket()` 错误: ");
+        m_fd = m_wrapper.get_file_descriptor();
+    }
+    else
+    {
+        m_wrapper.open(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                              0644));
+        if (!m_wrapper.is_valid())
+            logs::error("打开统计文件 `", path, "` 时出现了问题");
+        m_fd = m_wrapper.get_file_descriptor();
+    }
+}
+
+void stats_sink::write(std::string_view line)
+{
+    if (m_socket_path.empty())
+    {
+        // 统计只是辅助信息, 写不出去时不中断传输
+        while (!line.empty())
+        {
+            ssize_t n{::write(m_fd, line.data(), line.size())};
+            if (n <= 0)
+                return;
+            line.remove_prefix(static_cast<std::size_t>(n));
+        }
+        return;
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, m_socket_path.data(), m_socket_path.size());
+    if (sendto(m_fd, line.data(), line.size(), 0, reinterpret_cast<sockaddr *>(&address),
+               sizeof(address)) == -1)
+        log_debug("发送统计失败: ", std::strerror(errno));
+}
+
+void write_stats(stats_sink &sink, const transfer_metrics &metrics, std::string_view role,
+                 int worker)
+{
+    std::ostringstream line;
+    metrics.write_json(line, role, worker);
+    line << '\n';
+    sink.write(line.view());
+}
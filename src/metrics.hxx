@@ -0,0 +1,150 @@
+#ifndef METRICS_HXX
+#define METRICS_HXX
+
+#include "file_process.hxx"
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// 传输统计. 每个线程 (发送端进程、接收端的每个事件循环) 各有一份 `transfer_metrics`,
+// 只在本线程内更新, 不用原子操作; 需要汇总时用 `merge()`.
+enum class counter : std::size_t
+{
+    // 发送端
+    packets_sent,
+    packets_retransmitted,
+    payload_bytes_sent,
+    // 负载经过压缩的包 (首次发送), `payload_bytes_sent` 计的是压缩后的字节数
+    packets_compressed,
+    // 前向纠错的校验包, 它们的负载也计入 `payload_bytes_sent`
+    parity_packets_sent,
+    // 重传超时 (选择重传只计窗口左端的超时)
+    timeouts,
+    fast_retransmits,
+    acks_received,
+    // 没有确认新数据的 ACK, 以及超出窗口而被丢弃的 ACK
+    duplicate_acks,
+    out_of_window_acks,
+    // 接收端
+    packets_received,
+    duplicate_packets,
+    out_of_window_packets,
+    acks_sent,
+    // 由校验包恢复出的数据包, 不计入 `packets_received`
+    packets_recovered,
+    // 两端: 长度或校验和不对的包, 以及解压失败的包
+    checksum_failures,
+    count
+};
+
+// 对数分桶: 小于 8 的值各占一个桶, 之后每个 2 的幂区间分成 8 个桶,
+// 分位数的相对误差不超过 1/8
+class histogram
+{
+public:
+    static constexpr std::size_t SUB_BUCKETS{8};
+    static constexpr std::size_t N_BUCKETS{SUB_BUCKETS + (64 - 3) * SUB_BUCKETS};
+
+private:
+    std::array<std::uint64_t, N_BUCKETS> m_buckets{};
+    std::uint64_t m_count{0};
+    std::uint64_t m_sum{0};
+    std::uint64_t m_min{std::numeric_limits<std::uint64_t>::max()};
+    std::uint64_t m_max{0};
+
+    static std::size_t bucket_of(std::uint64_t value);
+    static std::uint64_t upper_bound_of(std::size_t bucket);
+
+public:
+    void record(std::uint64_t value);
+    void merge(const histogram &other);
+
+    std::uint64_t count() const;
+    // 第 `p` (0 到 1) 分位所在桶的上界, 不超过最大值
+    std::uint64_t percentile(double p) const;
+    void write_json(std::ostream &os) const;
+};
+
+class transfer_metrics
+{
+public:
+    using clock = std::chrono::steady_clock;
+    // 有效吞吐量曲线的采样间隔
+    static constexpr std::chrono::seconds GOODPUT_INTERVAL{1};
+
+private:
+    std::array<std::uint64_t, static_cast<std::size_t>(counter::count)> m_counters{};
+    clock::time_point m_start;
+    // 数据传完的时间, 之后的挥手不计入用时
+    std::optional<clock::time_point> m_end;
+    // 已确认 (发送端) 或已收到 (接收端) 的不重复负载字节, 以及第一次有进展的时间.
+    // 平均有效吞吐量从第一次进展算起, 不含握手后等待数据的时间.
+    std::uint64_t m_goodput_bytes{0};
+    clock::time_point m_first_progress;
+    std::uint64_t m_interval_bytes{0};
+    clock::time_point m_next_sample;
+    // 每个 `GOODPUT_INTERVAL` 内的有效负载字节数
+    std::vector<std::uint64_t> m_goodput_samples;
+
+public:
+    // 微秒
+    histogram rtt;
+    // 发送端每次发送后在途的包数
+    histogram window_occupancy;
+
+    transfer_metrics();
+
+    void add(counter which, std::uint64_t n = 1)
+    {
+        m_counters[static_cast<std::size_t>(which)] += n;
+    }
+    std::uint64_t get(counter which) const;
+
+    void add_goodput(std::uint64_t n_bytes)
+    {
+        if (m_goodput_bytes == 0)
+            m_first_progress = clock::now();
+        m_goodput_bytes += n_bytes;
+        m_interval_bytes += n_bytes;
+    }
+    // 事件循环每醒来一次调用一次, 把过去的采样间隔记入吞吐量曲线
+    void sample(clock::time_point now);
+    // 记下数据传完的时间; 多次调用时以最后一次为准
+    void stop();
+
+    void merge(const transfer_metrics &other);
+    // 一行 JSON, 不含换行. `role` 为 `sender` 或 `receiver`, 只输出这一端的计数器;
+    // `worker` 为负时不输出.
+    void write_json(std::ostream &os, std::string_view role, int worker = -1) const;
+};
+
+// 统计的输出位置: `-` 为标准输出, `unix:<path>` 为 Unix 数据报套接字 (没有人接收时
+// 丢弃, 不阻塞传输), 其它为文件 (每条一行).
+class stats_sink
+{
+private:
+    file_process::fd_wrapper m_wrapper{-1};
+    int m_fd{-1};
+    std::string m_socket_path;
+
+public:
+    stats_sink &operator=(const stats_sink &) = delete;
+    stats_sink(const stats_sink &) = delete;
+
+    explicit stats_sink(const std::string &path);
+
+    void write(std::string_view line);
+};
+
+// 写出一行 JSON 统计
+void write_stats(stats_sink &sink, const transfer_metrics &metrics, std::string_view role,
+                 int worker = -1);
+
+#endif
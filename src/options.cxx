@@ -0,0 +1,404 @@
+#include "options.hxx"
+#include "fec.hxx"
+#include "tools.hxx"
+#include <charconv>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+
+static std::size_t parse_size(std::string_view key, std::string_view value)
+{
+    std::size_t result;
+    auto [ptr, ec]{std::from_chars(value.data(), value.data() + value.size(), result)};
+    if (ec != std::errc{} || ptr != value.data() + value.size())
+        logs::error("选项 `--", key, "` 的值 `", value, "` 不合法");
+    return result;
+}
+
+static double parse_double(std::string_view key, std::string_view value)
+{
+    double result;
+    auto [ptr, ec]{std::from_chars(value.data(), value.data() + value.size(), result)};
+    if (ec != std::errc{} || ptr != value.data() + value.size() || !(result >= 0))
+        logs::error("选项 `--", key, "` 的值 `", value, "` 不合法");
+    return result;
+}
+
+static double parse_probability(std::string_view key, std::string_view value)
+{
+    double result{parse_double(key, value)};
+    if (result > 1)
+        logs::error("选项 `--", key, "` 是概率, 不能大于 1");
+    return result;
+}
+
+// 逗号分隔的 CPU 编号或范围, 例如 `0,2-5`
+static std::vector<int> parse_cpus(std::string_view key, std::string_view value)
+{
+    std::vector<int> cpus;
+    while (!value.empty())
+    {
+        std::size_t comma{value.find(',')};
+        std::string_view item{value.substr(0, comma)};
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+
+        std::size_t dash{item.find('-')};
+        std::size_t first{parse_size(key, item.substr(0, dash))};
+        std::size_t last{dash == std::string_view::npos ? first
+                                                        : parse_size(key, item.substr(dash + 1))};
+        if (last < first)
+            logs::error("选项 `--", key, "` 的范围 `", item, "` 不合法");
+        for (std::size_t cpu{first}; cpu <= last; cpu++)
+            cpus.push_back(static_cast<int>(cpu));
+    }
+    return cpus;
+}
+
+static bool parse_bool(std::string_view key, std::string_view value)
+{
+    if (value.empty() || value == "1" || value == "true")
+        return true;
+    if (value == "0" || value == "false")
+        return false;
+    logs::error("选项 `--", key, "` 的值 `", value, "` 不合法");
+    return false;
+}
+
+static void parse_option(transfer_options &options, std::string_view key,
+                         std::string_view value)
+{
+    if (key == "batch")
+    {
+        options.batch_size = parse_size(key, value);
+        if (options.batch_size == 0)
+            logs::error("`--batch` 至少为 1");
+    }
+    else if (key == "gso")
+        options.gso = parse_bool(key, value);
+    else if (key == "gro")
+        options.gro = parse_bool(key, value);
+    else if (key == "mmap")
+        options.mmap = parse_bool(key, value);
+    else if (key == "send-size")
+        options.send_size = parse_bool(key, value);
+    else if (key == "sack")
+        options.sack = parse_bool(key, value);
+    else if (key == "pwrite")
+        options.pwrite = parse_bool(key, value);
+    else if (key == "io")
+    {
+        if (value == "epoll")
+            options.backend = io_backend::epoll;
+        else if (value == "uring")
+            options.backend = io_backend::io_uring;
+        else
+            logs::error("`--io` 只能是 `epoll` 或 `uring`");
+    }
+    else if (key == "rto-min")
+        options.rto_min_ms = parse_size(key, value);
+    else if (key == "rto-max")
+        options.rto_max_ms = parse_size(key, value);
+    else if (key == "pacing")
+        options.pacing = parse_bool(key, value);
+    else if (key == "max-rate")
+        options.max_rate = parse_size(key, value);
+    else if (key == "ack-every")
+    {
+        options.ack_every = parse_size(key, value);
+        if (options.ack_every == 0)
+            logs::error("`--ack-every` 至少为 1");
+    }
+    else if (key == "ack-delay")
+        options.ack_delay_us = parse_size(key, value);
+    else if (key == "dupack")
+        options.dupack_threshold = parse_size(key, value);
+    else if (key == "server")
+        options.server = parse_bool(key, value);
+    else if (key == "max-sessions")
+    {
+        options.max_sessions = parse_size(key, value);
+        if (options.max_sessions == 0)
+            logs::error("`--max-sessions` 至少为 1");
+    }
+    else if (key == "stripes")
+    {
+        options.stripes = parse_size(key, value);
+        if (options.stripes == 0)
+            logs::error("`--stripes` 至少为 1");
+    }
+    else if (key == "cpus")
+        options.cpus = parse_cpus(key, value);
+    else if (key == "stats")
+    {
+        if (value.empty())
+            logs::error("`--stats` 需要文件路径或 `-`");
+        options.stats = value;
+    }
+    else if (key == "stats-snapshot")
+    {
+        if (value.empty())
+            logs::error("`--stats-snapshot` 需要文件路径或 `unix:<path>`");
+        options.stats_snapshot = value;
+    }
+    else if (key == "stats-interval")
+    {
+        options.stats_interval_ms = parse_size(key, value);
+        if (options.stats_interval_ms == 0)
+            logs::error("`--stats-interval` 至少为 1");
+    }
+    else if (key == "log-file")
+    {
+        if (value.empty())
+            logs::error("`--log-file` 需要文件路径");
+        options.log_file = value;
+    }
+    else if (key == "mtu")
+    {
+        options.mtu_auto = value == "auto";
+        options.mtu = options.mtu_auto ? 65535 : parse_size(key, value);
+        if (options.mtu < 576 || options.mtu > 65535)
+            logs::error("`--mtu` 只能是 `auto` 或 576 到 65535 之间的整数");
+    }
+    else if (key == "hugepages")
+        options.hugepages = parse_bool(key, value);
+    else if (key == "compress")
+        options.compress = parse_bool(key, value);
+    else if (key == "fec")
+    {
+        std::size_t comma{value.find(',')};
+        options.fec_group = parse_size(key, value.substr(0, comma));
+        options.fec_parity =
+            comma == std::string_view::npos ? 1 : parse_size(key, value.substr(comma + 1));
+        if (options.fec_group > fec::GROUP_MAX || options.fec_parity > fec::PARITY_MAX ||
+            !fec::is_valid({static_cast<std::uint8_t>(options.fec_group),
+                            static_cast<std::uint8_t>(options.fec_parity)}))
+            logs::error("`--fec` 形如 `组长,校验包数`, 组长 1 到 ", fec::GROUP_MAX,
+                        ", 校验包数 1 到 ", fec::PARITY_MAX, " 且不超过组长");
+    }
+    else if (key == "resume")
+        options.resume = parse_bool(key, value);
+    else if (key == "cc")
+    {
+        if (value == "fixed")
+            options.congestion = congestion_algorithm::fixed;
+        else if (value == "reno")
+            options.congestion = congestion_algorithm::reno;
+        else if (value == "cubic")
+            options.congestion = congestion_algorithm::cubic;
+        else if (value == "bbr")
+            options.congestion = congestion_algorithm::bbr;
+        else
+            logs::error("`--cc` 只能是 `fixed`, `reno`, `cubic` 或 `bbr`");
+    }
+    else
+        logs::error("未知的选项 `--", key, '`');
+}
+
+// 把每个 `--key=value` 拆开交给 `parse`
+template <typename T, typename F>
+static T parse_all(int argc, char **argv, int first, F parse)
+{
+    T options;
+    for (int i{first}; i < argc; i++)
+    {
+        std::string_view arg{argv[i]};
+        if (!arg.starts_with("--"))
+            logs::error("选项 `", arg, "` 不合法, 应形如 `--key=value`");
+        arg.remove_prefix(2);
+
+        std::size_t pos{arg.find('=')};
+        if (pos == std::string_view::npos)
+            parse(options, arg, {});
+        else
+            parse(options, arg.substr(0, pos), arg.substr(pos + 1));
+    }
+    return options;
+}
+
+transfer_options parse_options(int argc, char **argv, int first)
+{
+    auto options{parse_all<transfer_options>(argc, argv, first, parse_option)};
+    if (options.rto_min_ms == 0 || options.rto_min_ms > options.rto_max_ms)
+        logs::error("`--rto-min` 必须大于 0 且不超过 `--rto-max`");
+    return options;
+}
+
+std::ostream &operator<<(std::ostream &os, const transfer_options &options)
+{
+    os << "batch=" << options.batch_size << " gso=" << options.gso
+       << " gro=" << options.gro << " mmap=" << options.mmap
+       << " send-size=" << options.send_size << " sack=" << options.sack
+       << " pwrite=" << options.pwrite
+       << " io=" << options.backend << " rto-min=" << options.rto_min_ms
+       << " rto-max=" << options.rto_max_ms << " cc=" << options.congestion
+       << " pacing=" << options.pacing << " max-rate=" << options.max_rate
+       << " ack-every=" << options.ack_every << " ack-delay=" << options.ack_delay_us
+       << " dupack=" << options.dupack_threshold << " server=" << options.server
+       << " max-sessions=" << options.max_sessions << " stripes=" << options.stripes
+       << " cpus=";
+    for (std::size_t i{0}; i < options.cpus.size(); i++)
+        os << (i > 0 ? "," : "") << options.cpus[i];
+    os << " log-file=" << (options.log_file.empty() ? "-" : options.log_file)
+       << " stats=" << (options.stats.empty() ? "-" : options.stats)
+       << " stats-snapshot=" << (options.stats_snapshot.empty() ? "-" : options.stats_snapshot)
+       << " stats-interval=" << options.stats_interval_ms << " mtu=";
+    if (options.mtu_auto)
+        os << "auto";
+    else
+        os << options.mtu;
+    os << " hugepages=" << options.hugepages << " compress=" << options.compress << " fec=";
+    if (options.fec_group > 0)
+        os << options.fec_group << ',' << options.fec_parity;
+    else
+        os << '-';
+    os << " resume=" << options.resume;
+    return os;
+}
+
+static void parse_impairment_option(impairment_options &options, std::string_view key,
+                                    std::string_view value)
+{
+    if (key == "seed")
+        options.seed = parse_size(key, value);
+    else if (key == "loss")
+        options.loss = parse_probability(key, value);
+    else if (key == "ge-p")
+        options.ge_p = parse_probability(key, value);
+    else if (key == "ge-r")
+        options.ge_r = parse_probability(key, value);
+    else if (key == "ge-bad-loss")
+        options.ge_bad_loss = parse_probability(key, value);
+    else if (key == "ge-good-loss")
+        options.ge_good_loss = parse_probability(key, value);
+    else if (key == "delay")
+        options.delay_ms = parse_double(key, value);
+    else if (key == "jitter")
+        options.jitter_ms = parse_double(key, value);
+    else if (key == "reorder")
+        options.reorder = parse_probability(key, value);
+    else if (key == "reorder-delay")
+        options.reorder_delay_ms = parse_double(key, value);
+    else if (key == "rate")
+        options.rate = parse_size(key, value);
+    else if (key == "queue")
+    {
+        options.queue_bytes = parse_size(key, value);
+        if (options.queue_bytes == 0)
+            logs::error("`--queue` 至少为 1");
+    }
+    else if (key == "duplicate")
+        options.duplicate = parse_probability(key, value);
+    else if (key == "corrupt")
+        options.corrupt = parse_probability(key, value);
+    else if (key == "direction")
+    {
+        if (value == "both")
+            options.direction = impaired_direction::both;
+        else if (value == "forward")
+            options.direction = impaired_direction::forward;
+        else if (value == "reverse")
+            options.direction = impaired_direction::reverse;
+        else
+            logs::error("`--direction` 只能是 `both`, `forward` 或 `reverse`");
+    }
+    else if (key == "trace")
+    {
+        if (value.empty())
+            logs::error("`--trace` 需要文件路径");
+        options.trace = value;
+    }
+    else if (key == "stats")
+    {
+        if (value.empty())
+            logs::error("`--stats` 需要文件路径或 `-`");
+        options.stats = value;
+    }
+    else if (key == "log-file")
+    {
+        if (value.empty())
+            logs::error("`--log-file` 需要文件路径");
+        options.log_file = value;
+    }
+    else if (key == "idle-exit")
+        options.idle_exit_ms = parse_size(key, value);
+    else
+        logs::error("未知的选项 `--", key, '`');
+}
+
+impairment_options parse_impairment_options(int argc, char **argv, int first)
+{
+    auto options{
+        parse_all<impairment_options>(argc, argv, first, parse_impairment_option)};
+    if (options.loss > 0 && options.ge_p > 0)
+        logs::error("`--loss` 与 `--ge-p` 只能选一个");
+    if (options.jitter_ms > options.delay_ms)
+        logs::error("`--jitter` 不能大于 `--delay`");
+    return options;
+}
+
+std::ostream &operator<<(std::ostream &os, const impairment_options &options)
+{
+    os << "seed=" << options.seed << " loss=" << options.loss << " ge-p=" << options.ge_p
+       << " ge-r=" << options.ge_r << " ge-bad-loss=" << options.ge_bad_loss
+       << " ge-good-loss=" << options.ge_good_loss << " delay=" << options.delay_ms
+       << " jitter=" << options.jitter_ms << " reorder=" << options.reorder
+       << " reorder-delay=" << options.reorder_delay_ms << " rate=" << options.rate
+       << " queue=" << options.queue_bytes << " duplicate=" << options.duplicate
+       << " corrupt=" << options.corrupt << " direction=" << options.direction
+       << " trace=" << (options.trace.empty() ? "-" : options.trace)
+       << " stats=" << (options.stats.empty() ? "-" : options.stats)
+       << " log-file=" << (options.log_file.empty() ? "-" : options.log_file)
+       << " idle-exit=" << options.idle_exit_ms;
+    return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const impaired_direction &direction)
+{
+    switch (direction)
+    {
+    case impaired_direction::both:
+        os << "both";
+        break;
+    case impaired_direction::forward:
+        os << "forward";
+        break;
+    case impaired_direction::reverse:
+        os << "reverse";
+        break;
+    }
+    return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const io_backend &backend)
+{
+    switch (backend)
+    {
+    case io_backend::epoll:
+        os << "epoll";
+        break;
+    case io_backend::io_uring:
+        os << "uring";
+        break;
+    }
+    return os;
+}
+
+std::ostream &operator<<(std::ostream &os, const congestion_algorithm &algorithm)
+{
+    switch (algorithm)
+    {
+    case congestion_algorithm::fixed:
+        os << "fixed";
+        break;
+    case congestion_algorithm::reno:
+        os << "reno";
+        break;
+    case congestion_algorithm::cubic:
+        os << "cubic";
+        break;
+    case congestion_algorithm::bbr:
+        os << "bbr";
+        break;
+    }
+    return os;
+}
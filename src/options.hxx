@@ -0,0 +1,156 @@
+#ifndef OPTIONS_HXX
+#define OPTIONS_HXX
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum class io_backend
+{
+    epoll,
+    io_uring
+};
+
+std::ostream &operator<<(std::ostream &os, const io_backend &backend);
+
+enum class congestion_algorithm
+{
+    fixed,
+    reno,
+    cubic,
+    bbr
+};
+
+std::ostream &operator<<(std::ostream &os, const congestion_algorithm &algorithm);
+
+// 位置参数之后的可选参数, 形如 `--batch=64`.
+// 所有选项的默认值都保持与原协议、原行为兼容.
+struct transfer_options
+{
+    // 一次 `sendmmsg()` / `recvmmsg()` 最多处理的报文数
+    std::size_t batch_size{32};
+    // 发送端用 `UDP_SEGMENT` 合并连续的满长包
+    bool gso{false};
+    // 接收端打开 `UDP_GRO` 并拆分合并后的报文. 选择重传模式下忽略.
+    bool gro{false};
+    // 发送端映射输入文件, 直接从映射中发送负载
+    bool mmap{false};
+    // 发送端在 SYN 中携带文件大小 (需要对端支持握手扩展)
+    bool send_size{false};
+    // 发送端在握手时请求选择确认 (需要对端支持)
+    bool sack{false};
+    // 接收端把每个包直接写到文件中的最终位置, 不再缓存乱序的包
+    bool pwrite{false};
+    // 主循环使用的事件机制
+    io_backend backend{io_backend::epoll};
+    // 自适应重传超时的上下限 (毫秒)
+    std::size_t rto_min_ms{10};
+    std::size_t rto_max_ms{5000};
+    // 发送端的拥塞控制算法. `fixed` 即不做拥塞控制, 总是用满窗口
+    congestion_algorithm congestion{congestion_algorithm::fixed};
+    // 发送端按拥塞控制给出的速率均匀发送, 而不是一次发出整个窗口
+    bool pacing{false};
+    // 发送速率上限 (字节每秒), 0 表示不限. 设置后总是按不超过它的速率发送.
+    std::size_t max_rate{0};
+    // 接收端每收到 `ack_every` 个包才确认一次, 最多推迟 `ack_delay_us` 微秒.
+    // 乱序、重复的包总是立即确认.
+    std::size_t ack_every{1};
+    std::size_t ack_delay_us{1000};
+    // 回退 N 模式下发送端收到这么多个重复 ACK 时立即重传窗口左端的包, 0 表示关闭.
+    // 启用前向纠错时至少取一组数据包与校验包的总数, 先让校验包恢复.
+    std::size_t dupack_threshold{3};
+    // 接收端以服务器模式运行, 同时接收多个发送端的文件 (见 `receive_server.hxx`).
+    // 此时文件路径是输出目录.
+    bool server{false};
+    std::size_t max_sessions{1024};
+    // 分条传输: 文件分成这么多段, 发送端每段一个进程, 接收端用 `SO_REUSEPORT`
+    // 开同样多个套接字与线程. 两端必须一致. 1 表示不分条.
+    std::size_t stripes{1};
+    // 分条传输时第 i 个进程或线程绑定到 `cpus[i % cpus.size()]`, 为空则不绑定.
+    // 形如 `--cpus=0,2-5`.
+    std::vector<int> cpus;
+    // 日志写到这个文件而不是 stderr
+    std::string log_file;
+    // 结束时把统计 (JSON, 见 `metrics.hxx`) 写到这里, `-` 为标准输出.
+    // 分条发送时第 i 个进程写到 `<stats>.<i>`.
+    std::string stats;
+    // 传输过程中每 `stats_interval_ms` 毫秒写一次统计快照, 可以是文件或 `unix:<path>`
+    std::string stats_snapshot;
+    std::size_t stats_interval_ms{1000};
+    // 路径 MTU (IP 报文的最大字节数), 决定握手时协商的数据包负载长度. 0 表示不协商,
+    // 按 1500 字节的 MTU. `auto` 时发送端取内核记录的路径 MTU, 并用不分片的 SYN 探测;
+    // 接收端接受发送端探测到的任何长度.
+    std::size_t mtu{0};
+    bool mtu_auto{false};
+    // 数据包缓冲区 (见 `packet_pool.hxx`) 尝试使用大页
+    bool hugepages{false};
+    // 发送端在握手时请求压缩数据包的负载 (需要对端支持), 压缩后不更短的包照原样发送
+    bool compress{false};
+    // 发送端在握手时请求前向纠错 (需要对端支持, 见 `fec.hxx`): 每 `fec_group` 个数据包
+    // 之后发出 `fec_parity` 个校验包. `fec_group` 为 0 表示不使用. 形如 `--fec=16,2`,
+    // 省略校验包数时为 1 (异或).
+    std::size_t fec_group{0};
+    std::size_t fec_parity{0};
+    // 发送端在握手时请求续传 (需要对端支持, 见 `journal.hxx`): 接收端已持久写入的部分
+    // 不再发送, 结束时接收端核对整个文件. 流式发送与分条发送时忽略.
+    bool resume{false};
+};
+
+std::ostream &operator<<(std::ostream &os, const transfer_options &options);
+
+// 解析 `argv[first]` 到 `argv[argc - 1]` 中的可选参数
+transfer_options parse_options(int argc, char **argv, int first);
+
+// 损伤代理 (`rtp_proxy`) 对哪个方向的包施加损伤. 正向为发送端到接收端.
+enum class impaired_direction
+{
+    both,
+    forward,
+    reverse
+};
+
+std::ostream &operator<<(std::ostream &os, const impaired_direction &direction);
+
+// 损伤代理的选项, 模型见 `impairment.hxx`. 概率都在 0 到 1 之间, 时间单位为毫秒.
+// 默认什么也不做, 只转发.
+struct impairment_options
+{
+    // 同样的种子与同样的包序列得到同样的损伤
+    std::uint64_t seed{1};
+    // 伯努利丢包
+    double loss{0};
+    // Gilbert-Elliott 丢包: 每个包先以 `ge_p` 从好状态转入坏状态 (或以 `ge_r` 从坏
+    // 状态转回), 再按所在状态的丢包率丢弃. `ge_p` 为 0 时不使用.
+    double ge_p{0};
+    double ge_r{1};
+    double ge_bad_loss{1};
+    double ge_good_loss{0};
+    // 固定时延与均匀抖动 (`delay` 上下 `jitter`). 抖动本身不会让包乱序.
+    double delay_ms{0};
+    double jitter_ms{0};
+    // 以这个概率让包多等 `reorder_delay_ms`, 后面的包因而先到
+    double reorder{0};
+    double reorder_delay_ms{10};
+    // 瓶颈带宽 (字节每秒), 0 表示不限; 排队超过 `queue_bytes` 时丢弃新到的包
+    std::size_t rate{0};
+    std::size_t queue_bytes{1500'000};
+    double duplicate{0};
+    // 以这个概率翻转包中随机的一位
+    double corrupt{0};
+    impaired_direction direction{impaired_direction::both};
+    // 每个包的去向逐行写到这个文件
+    std::string trace;
+    // 退出时把各方向的计数 (JSON) 写到这里, `-` 为标准输出
+    std::string stats;
+    std::string log_file;
+    // 这么久没有收到包且没有待发的包时退出, 0 表示一直运行到收到信号
+    std::size_t idle_exit_ms{0};
+};
+
+std::ostream &operator<<(std::ostream &os, const impairment_options &options);
+
+impairment_options parse_impairment_options(int argc, char **argv, int first);
+
+#endif
@@ -0,0 +1,56 @@
+#include "pacer.hxx"
+#include <algorithm>
+
+// 事件循环的定时器以毫秒计, 桶里至少要能放下两个定时周期的令牌
+constexpr double BURST_SECONDS{0.002};
+
+pacer::pacer() : m_last{clock::now()} {}
+
+void pacer::refill(clock::time_point now)
+{
+    if (m_rate == 0)
+        m_tokens = m_burst;
+    else if (now > m_last)
+        m_tokens = std::min(m_burst, m_tokens +
+                                         m_rate * std::chrono::duration<double>(now - m_last)
+                                                      .count());
+    m_last = std::max(m_last, now);
+}
+
+void pacer::set_rate(double rate)
+{
+    refill(clock::now());
+    m_rate = rate;
+    m_burst = std::max(MIN_BURST, rate * BURST_SECONDS);
+}
+
+double pacer::rate() const { return m_rate; }
+
+bool pacer::try_consume(clock::time_point now)
+{
+    refill(now);
+    if (m_tokens < 1)
+        return false;
+    m_tokens -= 1;
+    return true;
+}
+
+void pacer::consume(clock::time_point now)
+{
+    refill(now);
+    if (m_rate != 0)
+        m_tokens -= 1;
+}
+
+pacer::clock::duration pacer::delay(clock::time_point now) const
+{
+    if (m_rate == 0 || m_tokens >= 1)
+        return clock::duration::zero();
+    double tokens{m_tokens};
+    if (now > m_last)
+        tokens += m_rate * std::chrono::duration<double>(now - m_last).count();
+    if (tokens >= 1)
+        return clock::duration::zero();
+    return std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>((1 - tokens) / m_rate));
+}
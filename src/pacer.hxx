@@ -0,0 +1,38 @@
+#ifndef PACER_HXX
+#define PACER_HXX
+
+#include <chrono>
+
+// 以包为单位的令牌桶. 令牌按 `rate` 包每秒积累, 最多攒够约 2 ms 的量,
+// 使发送端把窗口中的包均匀地发出, 而不是一次全部发出.
+class pacer
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+    static constexpr double MIN_BURST{2};
+
+private:
+    // 0 表示不限速
+    double m_rate{0};
+    double m_burst{MIN_BURST};
+    double m_tokens{MIN_BURST};
+    clock::time_point m_last;
+
+    void refill(clock::time_point now);
+
+public:
+    pacer();
+
+    void set_rate(double rate);
+    double rate() const;
+
+    // 有令牌时取走一个并返回 true
+    bool try_consume(clock::time_point now);
+    // 不管有没有令牌都取走一个 (重传不等待), 欠下的令牌会推迟之后的发送
+    void consume(clock::time_point now);
+    // 距离下一个令牌的时间
+    clock::duration delay(clock::time_point now) const;
+};
+
+#endif
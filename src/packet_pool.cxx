@@ -0,0 +1,107 @@
+#include "packet_pool.hxx"
+#include "error_process.hxx"
+#include "tools.hxx"
+#include <algorithm>
+#include <bit>
+#include <sys/mman.h>
+
+namespace
+{
+    constexpr std::size_t HUGE_PAGE_SIZE{2 << 20};
+}
+
+packet_pool::packet_pool(std::size_t payload_size, std::size_t n_buffers, bool hugepages)
+    : m_buffer_size{(sizeof(rtp_header) + payload_size + CACHE_LINE_SIZE - 1) /
+                    CACHE_LINE_SIZE * CACHE_LINE_SIZE},
+      m_chunk_shift{
+          static_cast<unsigned>(std::bit_width(std::max<std::size_t>(n_buffers, 1) - 1))},
+      m_hugepages{hugepages}
+{
+    grow();
+}
+
+packet_pool::~packet_pool()
+{
+    for (const chunk &c : m_chunks)
+        munmap(c.data, c.n_bytes);
+}
+
+void packet_pool::grow()
+{
+    std::size_t n_buffers{std::size_t{1} << m_chunk_shift};
+    std::size_t n_bytes{n_buffers * m_buffer_size};
+    void *addr{MAP_FAILED};
+    if (m_hugepages)
+    {
+        n_bytes = (n_bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        addr = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (addr == MAP_FAILED)
+            log_debug("没有可用的大页, 改用透明大页");
+    }
+    if (addr == MAP_FAILED)
+    {
+        addr = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (addr == MAP_FAILED)
+            error_process::unix_error("`mmap()` 错误: ");
+        if (m_hugepages && madvise(addr, n_bytes, MADV_HUGEPAGE) == -1)
+            log_debug("`madvise(MADV_HUGEPAGE)` 失败");
+    }
+
+    auto first{static_cast<handle>(m_chunks.size() << m_chunk_shift)};
+    m_chunks.push_back({static_cast<char *>(addr), n_bytes});
+    // 一次预留足够的空间, 之后归还缓冲区时不会再分配
+    m_free.reserve(capacity());
+    // 倒序放入, 先取出的句柄较小, 地址相邻
+    for (std::size_t i{n_buffers}; i-- > 0;)
+        m_free.push_back(first + static_cast<handle>(i));
+}
+
+packet_pool::handle packet_pool::acquire()
+{
+    if (m_free.empty())
+        grow();
+    handle h{m_free.back()};
+    m_free.pop_back();
+    return h;
+}
+
+void packet_pool::release(handle h) { m_free.push_back(h); }
+
+void packet_pool::reserve(std::size_t n_free)
+{
+    while (m_free.size() < n_free)
+        grow();
+}
+
+char *packet_pool::data(handle h)
+{
+    return m_chunks[h >> m_chunk_shift].data +
+           (h & ((handle{1} << m_chunk_shift) - 1)) * m_buffer_size;
+}
+
+const char *packet_pool::data(handle h) const
+{
+    return m_chunks[h >> m_chunk_shift].data +
+           (h & ((handle{1} << m_chunk_shift) - 1)) * m_buffer_size;
+}
+
+packet_view packet_pool::operator[](handle h) { return packet_view{data(h)}; }
+
+packet_pool::handle packet_pool::find(const void *ptr) const
+{
+    const char *p{static_cast<const char *>(ptr)};
+    std::size_t chunk_bytes{(std::size_t{1} << m_chunk_shift) * m_buffer_size};
+    for (std::size_t i{0}; i < m_chunks.size(); i++)
+    {
+        const char *begin{m_chunks[i].data};
+        if (p >= begin && p < begin + chunk_bytes)
+            return static_cast<handle>(i << m_chunk_shift |
+                                       static_cast<std::size_t>(p - begin) / m_buffer_size);
+    }
+    return NO_HANDLE;
+}
+
+std::size_t packet_pool::buffer_size() const { return m_buffer_size; }
+std::size_t packet_pool::capacity() const { return m_chunks.size() << m_chunk_shift; }
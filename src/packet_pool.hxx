@@ -0,0 +1,65 @@
+#ifndef PACKET_POOL_HXX
+#define PACKET_POOL_HXX
+
+#include "rtp_header.hxx"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 定长数据包缓冲区的池, 通过句柄访问. 每个缓冲区放得下负载为 `payload_size` 的包,
+// 起点按缓存行对齐. 池按块用 `mmap()` 分配, 用完时再加一块, 已有缓冲区的地址不变;
+// `reserve()` 之后 `acquire()` / `release()` 都不再分配内存.
+//
+// 事件循环从池中取缓冲区接收包, 接收窗口通过 `event_loop::take()` 直接接管收到包的
+// 缓冲区, 省去复制. 发送窗口这样固定数量的缓冲区也可以不经 `acquire()`,
+// 直接以 0 到 `n_buffers - 1` 为句柄使用构造时的缓冲区.
+class packet_pool
+{
+public:
+    using handle = std::uint32_t;
+    static constexpr handle NO_HANDLE{~handle{0}};
+    static constexpr std::size_t CACHE_LINE_SIZE{64};
+
+private:
+    struct chunk
+    {
+        char *data;
+        std::size_t n_bytes;
+    };
+
+    std::size_t m_buffer_size;
+    // 每块的缓冲区个数是 2 的幂, 句柄的低 `m_chunk_shift` 位是块内的下标
+    unsigned m_chunk_shift;
+    bool m_hugepages;
+    std::vector<chunk> m_chunks;
+    std::vector<handle> m_free;
+
+    void grow();
+
+public:
+    packet_pool &operator=(const packet_pool &) = delete;
+    packet_pool(const packet_pool &) = delete;
+
+    // 初始有 `n_buffers` 个空闲缓冲区. `hugepages` 为 true 时尝试用大页,
+    // 系统没有预留大页时退回普通页并建议内核使用透明大页.
+    packet_pool(std::size_t payload_size, std::size_t n_buffers, bool hugepages = false);
+    ~packet_pool();
+
+    // 取一个空闲缓冲区, 没有时先加一块
+    handle acquire();
+    void release(handle h);
+    // 保证至少有 `n_free` 个空闲缓冲区
+    void reserve(std::size_t n_free);
+
+    char *data(handle h);
+    const char *data(handle h) const;
+    packet_view operator[](handle h);
+    // `ptr` 所在的缓冲区, 不在池中时返回 `NO_HANDLE`
+    handle find(const void *ptr) const;
+
+    // 相邻缓冲区的间距 (包长按缓存行向上取整), 同一块中句柄相邻的缓冲区地址也相邻
+    std::size_t buffer_size() const;
+    std::size_t capacity() const;
+};
+
+#endif
@@ -0,0 +1,415 @@
+#include "error_process.hxx"
+#include "file_process.hxx"
+#include "impairment.hxx"
+#include "metrics.hxx"
+#include "options.hxx"
+#include "rtp_header.hxx"
+#include "socket_process.hxx"
+#include "tools.hxx"
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <sstream>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <tuple>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+// 损伤代理: 夹在 sender 与 receiver 之间的 UDP 中继, 按选项对两个方向的包施加
+// 丢包、乱序、时延、限速、重复与比特翻转 (见 `impairment.hxx`), 用来在本机复现
+// 有损网络而不需要 root 或 `tc netem`.
+//
+// sender 发往代理的监听端口; 代理为每个发送端开一个连接到 receiver 的套接字,
+// 因此服务器模式与分条传输的 receiver 仍能区分各个发送端.
+
+using clock_type = impairment::clock;
+
+volatile std::sig_atomic_t stop_requested{0};
+void request_stop(int) { stop_requested = 1; }
+
+void run_proxy(const char *listen_port, const char *host, const char *port,
+               const impairment_options &options);
+void write_summary(const impairment_options &options);
+
+int main(int argc, char **argv)
+{
+    impairment_options options;
+    try
+    {
+        if (argc < 4)
+        {
+            logs::error("参数错误. 你可以这样使用: ", argv[0],
+                        " [listen port] [receiver host] [receiver port] "
+                        "[--option=value ...]");
+            return EXIT_FAILURE;
+        }
+
+        options = parse_impairment_options(argc, argv, 4);
+        if (!options.log_file.empty())
+            logs::set_output_file(options.log_file.c_str());
+        log_debug("选项: ", options);
+
+        std::signal(SIGINT, request_stop);
+        std::signal(SIGTERM, request_stop);
+        run_proxy(argv[1], argv[2], argv[3], options);
+
+        write_summary(options);
+        log_debug("Proxy: 正在退出");
+        return 0;
+    }
+    catch (exceptions)
+    {
+        write_summary(options);
+        return EXIT_FAILURE;
+    }
+}
+
+// epoll 事件的 `data.u64`: 监听套接字、定时器, 之后是第 i 条流 (`i + FLOW_EVENT`)
+constexpr std::uint64_t LISTEN_EVENT{0};
+constexpr std::uint64_t TIMER_EVENT{1};
+constexpr std::uint64_t FLOW_EVENT{2};
+
+// 代理的收发缓冲区. 默认的大小在突发时会让代理自己丢包.
+constexpr int SOCKET_BUFFER_SIZE{4 << 20};
+
+file_process::fd_wrapper listen_wrapper{-1};
+file_process::fd_wrapper epoll_wrapper{-1};
+file_process::fd_wrapper timer_wrapper{-1};
+
+struct flow
+{
+    socket_address client;
+    file_process::fd_wrapper upstream{-1};
+};
+std::vector<std::unique_ptr<flow>> flows;
+std::unordered_map<socket_address, flow *, socket_address_hash> flow_of;
+
+// 等待发出的包, 按发出时间排序; 时间相同时先到的先发
+struct pending_packet
+{
+    clock_type::time_point release;
+    std::uint64_t order;
+    flow *target;
+    bool forward;
+    std::vector<char> data;
+};
+
+struct later
+{
+    bool operator()(const pending_packet &lhs, const pending_packet &rhs) const
+    {
+        return std::tie(lhs.release, lhs.order) > std::tie(rhs.release, rhs.order);
+    }
+};
+
+std::priority_queue<pending_packet, std::vector<pending_packet>, later> pending;
+std::uint64_t next_order{0};
+
+// 正向 (发往 receiver) 与反向各一个
+std::unique_ptr<impairment> forward_link;
+std::unique_ptr<impairment> reverse_link;
+
+std::ofstream trace_stream;
+clock_type::time_point start_time;
+
+static void add_to_epoll(int fd, std::uint64_t data)
+{
+    epoll_event ep_event{};
+    ep_event.events = EPOLLIN;
+    ep_event.data.u64 = data;
+    if (epoll_ctl(epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD, fd, &ep_event) == -1)
+        error_process::unix_error("`epoll_ctl()` 错误: ");
+}
+
+static void enlarge_buffers(int fd)
+{
+    // 失败时保持默认大小
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &SOCKET_BUFFER_SIZE, sizeof(SOCKET_BUFFER_SIZE));
+}
+
+static flow &flow_for(const socket_address &client, const char *host, const char *port)
+{
+    if (auto it{flow_of.find(client)}; it != flow_of.end())
+        return *it->second;
+
+    auto new_flow{std::make_unique<flow>()};
+    new_flow->client = client;
+    new_flow->upstream.open(socket_process::open_sender_socket(host, port));
+    enlarge_buffers(new_flow->upstream.get_file_descriptor());
+    add_to_epoll(new_flow->upstream.get_file_descriptor(), FLOW_EVENT + flows.size());
+    logs::info("新的发送端 ", client);
+
+    flow &result{*new_flow};
+    flows.push_back(std::move(new_flow));
+    flow_of.emplace(client, &result);
+    return result;
+}
+
+// 一行: 时间 (微秒) 方向 seq_num flag 长度 去向 推迟 (微秒) 其它
+static void write_trace(clock_type::time_point now, bool forward, const char *data,
+                        std::size_t length, const impairment::verdict &verdict)
+{
+    auto us{[](clock_type::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    }};
+    trace_stream << us(now - start_time) << (forward ? " f " : " r ");
+    if (length >= sizeof(rtp_header))
+    {
+        rtp_header header;
+        std::memcpy(&header, data, sizeof(header));
+        trace_stream << header.get_seq_num() << ' ' << static_cast<int>(header.get_flag());
+    }
+    else
+        trace_stream << "- -";
+    trace_stream << ' ' << length << ' ';
+
+    switch (verdict.result)
+    {
+    case impairment::fate::lost:
+        trace_stream << "lost - -\n";
+        return;
+    case impairment::fate::queue_dropped:
+        trace_stream << "queue-drop - -\n";
+        return;
+    case impairment::fate::forwarded:
+        break;
+    }
+    trace_stream << "forward " << us(verdict.release - now) << ' ';
+    if (!verdict.reordered && !verdict.duplicated && !verdict.corrupt_bit)
+        trace_stream << '-';
+    const char *separator{""};
+    if (verdict.reordered)
+    {
+        trace_stream << "reorder";
+        separator = ",";
+    }
+    if (verdict.duplicated)
+    {
+        trace_stream << separator << "duplicate";
+        separator = ",";
+    }
+    if (verdict.corrupt_bit)
+        trace_stream << separator << "corrupt:" << *verdict.corrupt_bit;
+    trace_stream << '\n';
+}
+
+static void impair(flow &target, bool forward, const char *data, std::size_t length,
+                   clock_type::time_point now)
+{
+    auto verdict{(forward ? forward_link : reverse_link)->decide(now, length)};
+    if (trace_stream.is_open())
+        write_trace(now, forward, data, length, verdict);
+    if (verdict.result != impairment::fate::forwarded)
+        return;
+
+    std::vector<char> copy(data, data + length);
+    if (verdict.duplicated)
+        pending.push({verdict.release, next_order++, &target, forward, copy});
+    if (verdict.corrupt_bit)
+        copy[*verdict.corrupt_bit / 8] ^= static_cast<char>(1 << *verdict.corrupt_bit % 8);
+    pending.push({verdict.release, next_order++, &target, forward, std::move(copy)});
+}
+
+// 读空套接字. 返回是否读到了包.
+static bool receive_from_senders(const char *host, const char *port)
+{
+    static char buffer[65536];
+    bool received{false};
+    while (true)
+    {
+        socket_address source;
+        source.length = sizeof(source.storage);
+        ssize_t n{recvfrom(listen_wrapper.get_file_descriptor(), buffer, sizeof(buffer),
+                           MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&source.storage),
+                           &source.length)};
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return received;
+            error_process::unix_error("`recvfrom()` 错误: ");
+        }
+        received = true;
+        impair(flow_for(source, host, port), true, buffer, static_cast<std::size_t>(n),
+               clock_type::now());
+    }
+}
+
+static bool receive_from_receiver(flow &source)
+{
+    static char buffer[65536];
+    bool received{false};
+    while (true)
+    {
+        ssize_t n{recv(source.upstream.get_file_descriptor(), buffer, sizeof(buffer),
+                       MSG_DONTWAIT)};
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return received;
+            // receiver 还没有启动或已经退出时, 之前发出的包会带回 `ECONNREFUSED`
+            if (errno == EINTR || errno == ECONNREFUSED)
+                continue;
+            error_process::unix_error("`recv()` 错误: ");
+        }
+        received = true;
+        impair(source, false, buffer, static_cast<std::size_t>(n), clock_type::now());
+    }
+}
+
+static void release_due(clock_type::time_point now)
+{
+    while (!pending.empty() && pending.top().release <= now)
+    {
+        const pending_packet &packet{pending.top()};
+        ssize_t n;
+        if (packet.forward)
+            n = send(packet.target->upstream.get_file_descriptor(), packet.data.data(),
+                     packet.data.size(), MSG_DONTWAIT);
+        else
+            n = sendto(listen_wrapper.get_file_descriptor(), packet.data.data(),
+                       packet.data.size(), MSG_DONTWAIT, packet.target->client.get(),
+                       packet.target->client.length);
+        if (n < 0)
+            log_debug("转发失败: ", std::strerror(errno));
+        pending.pop();
+    }
+}
+
+// 定时器在最早的待发包该发出时到期
+static void arm_timer()
+{
+    itimerspec spec{};
+    if (!pending.empty())
+    {
+        auto since_epoch{pending.top().release.time_since_epoch()};
+        auto seconds{std::chrono::duration_cast<std::chrono::seconds>(since_epoch)};
+        spec.it_value.tv_sec = static_cast<time_t>(seconds.count());
+        spec.it_value.tv_nsec = static_cast<long>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count());
+        // 全为 0 会关闭定时器
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+    }
+    if (timerfd_settime(timer_wrapper.get_file_descriptor(), TFD_TIMER_ABSTIME, &spec,
+                        nullptr) == -1)
+        error_process::unix_error("`timerfd_settime()` 错误: ");
+}
+
+void run_proxy(const char *listen_port, const char *host, const char *port,
+               const impairment_options &options)
+{
+    bool forward_enabled{options.direction != impaired_direction::reverse};
+    bool reverse_enabled{options.direction != impaired_direction::forward};
+    forward_link = std::make_unique<impairment>(options, forward_enabled, 0);
+    reverse_link = std::make_unique<impairment>(options, reverse_enabled, 1);
+    if (!options.trace.empty())
+    {
+        trace_stream.open(options.trace, std::ios::trunc);
+        if (trace_stream.fail())
+            logs::error("打开文件 `", options.trace, "` 时出现了问题");
+        trace_stream << "# time_us direction seq_num flag length fate delay_us extra\n";
+    }
+
+    listen_wrapper.open(socket_process::open_receiver_socket(listen_port));
+    enlarge_buffers(listen_wrapper.get_file_descriptor());
+    epoll_wrapper.open(epoll_create1(0));
+    if (!epoll_wrapper.is_valid())
+        error_process::unix_error("`epoll_create1()` 错误: ");
+    timer_wrapper.open(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK));
+    if (!timer_wrapper.is_valid())
+        error_process::unix_error("`timerfd_create()` 错误: ");
+    add_to_epoll(listen_wrapper.get_file_descriptor(), LISTEN_EVENT);
+    add_to_epoll(timer_wrapper.get_file_descriptor(), TIMER_EVENT);
+
+    start_time = clock_type::now();
+    auto last_activity{start_time};
+    constexpr int EVENTS_MAX{64};
+    epoll_event ep_events[EVENTS_MAX];
+    while (!stop_requested)
+    {
+        arm_timer();
+        int timeout{-1};
+        if (options.idle_exit_ms > 0 && pending.empty())
+        {
+            auto idle{std::chrono::duration_cast<std::chrono::milliseconds>(
+                clock_type::now() - last_activity)};
+            auto remaining{static_cast<std::int64_t>(options.idle_exit_ms) - idle.count()};
+            if (remaining <= 0)
+            {
+                log_debug("空闲超过 ", options.idle_exit_ms, " ms, 退出");
+                break;
+            }
+            timeout = static_cast<int>(remaining);
+        }
+
+        int n_events{
+            epoll_wait(epoll_wrapper.get_file_descriptor(), ep_events, EVENTS_MAX, timeout)};
+        if (n_events == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            error_process::unix_error("`epoll_wait()` 错误: ");
+        }
+
+        bool received{false};
+        for (int i{0}; i < n_events; i++)
+        {
+            std::uint64_t event{ep_events[i].data.u64};
+            if (event == LISTEN_EVENT)
+                received |= receive_from_senders(host, port);
+            else if (event == TIMER_EVENT)
+            {
+                std::uint64_t n_expirations;
+                (void)read(timer_wrapper.get_file_descriptor(), &n_expirations,
+                           sizeof(n_expirations));
+            }
+            else
+                received |= receive_from_receiver(*flows[event - FLOW_EVENT]);
+        }
+        if (received)
+            last_activity = clock_type::now();
+        release_due(clock_type::now());
+    }
+    trace_stream.flush();
+}
+
+static void log_counters(const char *name, const impairment::counters &counters)
+{
+    logs::info(name, ": 收到 ", counters.packets, " 个包 (", counters.bytes, " 字节), 转发 ",
+               counters.forwarded, ", 丢弃 ", counters.lost, ", 队列溢出 ",
+               counters.queue_dropped, ", 乱序 ", counters.reordered, ", 重复 ",
+               counters.duplicated, ", 翻转 ", counters.corrupted);
+}
+
+void write_summary(const impairment_options &options)
+{
+    if (!forward_link || !reverse_link)
+        return;
+    log_counters("正向", forward_link->get_counters());
+    log_counters("反向", reverse_link->get_counters());
+    if (options.stats.empty())
+        return;
+    try
+    {
+        stats_sink sink{options.stats};
+        std::ostringstream line;
+        line << "{\"role\":\"proxy\",\"forward\":" << forward_link->get_counters()
+             << ",\"reverse\":" << reverse_link->get_counters() << "}\n";
+        sink.write(line.view());
+    }
+    catch (exceptions)
+    {
+    }
+}
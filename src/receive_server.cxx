@@ -0,0 +1,571 @@
+#include "receive_server.hxx"
+#include "event_loop.hxx"
+#include "extension.hxx"
+#include "file_process.hxx"
+#include "metrics.hxx"
+#include "receive_session.hxx"
+#include "rtp_header.hxx"
+#include "socket_process.hxx"
+#include "timing_wheel.hxx"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fcntl.h>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    using clock = std::chrono::steady_clock;
+
+    constexpr int SERVER_TIMER{0};
+    constexpr int STATS_TIMER{1};
+    // 与单个接收端相同: 5 s 没有收到包则放弃, 发出 FIN ACK 后 2 s 内没有新的包即结束
+    constexpr std::chrono::seconds IDLE_TIMEOUT{5};
+    constexpr std::chrono::seconds LINGER_TIME{2};
+    // 分条接收时, 没有会话的线程隔多久检查一次其它条是否都已结束
+    constexpr std::chrono::milliseconds STRIPE_POLL_INTERVAL{100};
+
+    enum class session_state
+    {
+        // 已回应 SYN ACK, 等待 ACK 或第一个数据包
+        syn_received,
+        established,
+        // 已回应 FIN ACK, 对端的 FIN 重传时再次回应
+        closing
+    };
+
+    template <mode_type mode> struct session_entry
+    {
+        socket_address peer;
+        std::uint32_t connection_id;
+        session_state state{session_state::syn_received};
+        std::unique_ptr<receive_session<mode>> session;
+        // SYN ACK, 收到重复的 SYN 时重发
+        rtp_packet syn_ack;
+        std::uint32_t fin_seq_num{0};
+        clock::time_point last_active;
+        // 已放入时间轮的确认时间
+        std::optional<clock::time_point> ack_timer_deadline;
+        bool touched{false};
+    };
+
+    // 分条接收时各线程共享的输出文件. 每个发送端进程负责一条, 握手时给出它在文件中的
+    // 偏移; 所有条都收完 (或超时放弃) 后各线程退出.
+    struct striped_output
+    {
+        int fd;
+        std::size_t n_stripes;
+        std::atomic<std::size_t> n_completed{0};
+        std::atomic<std::size_t> n_failed{0};
+    };
+
+    template <mode_type mode> class receive_server
+    {
+    private:
+        const char *m_directory;
+        striped_output *m_striped;
+        std::size_t m_window_size;
+        const transfer_options &m_options;
+        // 各会话协商的负载长度不超过它
+        std::size_t m_payload_limit;
+        std::unique_ptr<event_loop> m_loop;
+
+        // 本线程所有会话的统计; 设定了 `--stats-snapshot` 时定期写出
+        transfer_metrics m_metrics;
+        stats_sink *m_snapshot_sink;
+        int m_worker;
+
+        std::vector<std::unique_ptr<session_entry<mode>>> m_slots;
+        std::vector<std::size_t> m_free_slots;
+        std::unordered_map<socket_address, std::size_t, socket_address_hash> m_sessions;
+
+        // 每个槽位两个定时器: `2 * slot` 是推迟的确认, `2 * slot + 1` 是空闲与挥手.
+        // 事件循环的 `SERVER_TIMER` 只按其中最早的到期时间设定.
+        timing_wheel m_timers;
+        std::vector<std::size_t> m_expired;
+        bool m_timers_changed{false};
+        bool m_timer_armed{false};
+        clock::time_point m_timer_deadline;
+
+        // 本批收到过数据包的会话, 处理完整批后再决定是否发出确认
+        std::vector<std::size_t> m_touched;
+
+        // 处理本轮收到的第 `i` 个包
+        void dispatch(std::size_t i, const socket_address &source, clock::time_point now);
+        void accept(packet_view syn, const socket_address &source, clock::time_point now);
+        void close(std::size_t slot);
+        void remove(std::size_t slot);
+
+        void push_pending_ack(std::size_t slot, clock::time_point now);
+        void schedule_idle(std::size_t slot);
+        void expire_timers(clock::time_point now);
+        void arm_timer();
+        bool finished() const;
+
+    public:
+        // `striped` 为空时是服务器模式, 每个会话写入 `directory` 下自己的文件.
+        // `snapshot_sink` 可以为空; `worker` 是写入统计的线程编号, 负数表示不写.
+        receive_server(int fd, const char *directory, std::size_t window_size,
+                       const transfer_options &options, stats_sink *snapshot_sink,
+                       int worker = -1, striped_output *striped = nullptr);
+
+        void run();
+        const transfer_metrics &metrics() const;
+    };
+
+    template <mode_type mode>
+    receive_server<mode>::receive_server(int fd, const char *directory, std::size_t window_size,
+                                         const transfer_options &options,
+                                         stats_sink *snapshot_sink, int worker,
+                                         striped_output *striped)
+        : m_directory{directory}, m_striped{striped}, m_window_size{window_size},
+          m_options{options}, m_payload_limit{receiver_payload_limit(fd, options)},
+          m_snapshot_sink{snapshot_sink}, m_worker{worker},
+          m_slots(options.max_sessions), m_timers{2 * options.max_sessions}
+    {
+        // 区分会话要用到每个包的来源地址, io_uring 的多发接收拿不到
+        transfer_options loop_options{options};
+        if (loop_options.backend == io_backend::io_uring)
+        {
+            log_debug("服务器模式需要来源地址, 改用 epoll");
+            loop_options.backend = io_backend::epoll;
+        }
+        // 设定了 `--mtu` 时, 探测路径 MTU 的 SYN 可能比本端的上限还长, 也要能完整收下
+        m_loop = make_event_loop(fd, loop_options, options.mtu != 0 ? PAYLOAD_LIMIT : PAYLOAD_MAX);
+        if (m_payload_limit > PAYLOAD_MAX)
+            socket_process::enlarge_buffers(fd, window_size *
+                                                    (sizeof(rtp_header) + m_payload_limit));
+        for (std::size_t slot{options.max_sessions}; slot > 0; slot--)
+            m_free_slots.push_back(slot - 1);
+    }
+
+    template <mode_type mode> void receive_server<mode>::run()
+    {
+        log_debug("开始接受连接");
+        // 分条接收时可能一直没有流分到本线程, 也要定时检查是否该退出
+        arm_timer();
+        auto stats_interval{std::chrono::milliseconds{m_options.stats_interval_ms}};
+        if (m_snapshot_sink)
+            m_loop->start_timer(STATS_TIMER, stats_interval);
+        while (!finished())
+        {
+            m_loop->wait();
+            if (m_loop->is_expired(SERVER_TIMER))
+                m_timer_armed = false;
+
+            auto now{clock::now()};
+            m_metrics.sample(now);
+            if (m_snapshot_sink && m_loop->is_expired(STATS_TIMER))
+            {
+                write_stats(*m_snapshot_sink, m_metrics, "receiver", m_worker);
+                m_loop->start_timer(STATS_TIMER, stats_interval);
+            }
+            for (std::size_t i{0}; i < m_loop->size(); i++)
+            {
+                packet_view packet{(*m_loop)[i]};
+                if (m_loop->length(i) >= sizeof(rtp_header) + packet.get_length() &&
+                    packet.is_valid())
+                    dispatch(i, *m_loop->source(i), now);
+                else
+                    m_metrics.add(counter::checksum_failures);
+            }
+            for (std::size_t slot : m_touched)
+            {
+                if (!m_slots[slot])
+                    continue;
+                m_slots[slot]->touched = false;
+                push_pending_ack(slot, now);
+            }
+            m_touched.clear();
+
+            expire_timers(clock::now());
+            arm_timer();
+        }
+    }
+
+    template <mode_type mode>
+    void receive_server<mode>::dispatch(std::size_t i, const socket_address &source,
+                                        clock::time_point now)
+    {
+        packet_view packet{(*m_loop)[i]};
+        if (packet.get_flag() == SYN)
+        {
+            accept(packet, source, now);
+            return;
+        }
+        auto it{m_sessions.find(source)};
+        if (it == m_sessions.end())
+        {
+            log_debug("丢弃来自未知对端 ", source, " 的包");
+            return;
+        }
+
+        std::size_t slot{it->second};
+        session_entry<mode> &entry{*m_slots[slot]};
+        entry.last_active = now;
+        m_loop->set_destination(entry.peer);
+        switch (entry.state)
+        {
+        case session_state::closing:
+            m_loop->push_copy({entry.fin_seq_num, 0, FIN | ACK});
+            return;
+        case session_state::syn_received:
+            entry.state = session_state::established;
+            log_debug("会话 ", entry.peer, " 建立连接");
+            if (packet.get_flag() == ACK)
+                return;
+            break;
+        case session_state::established:
+            break;
+        }
+
+        if (entry.session->process(i))
+        {
+            close(slot);
+            return;
+        }
+        if (!entry.touched)
+        {
+            entry.touched = true;
+            m_touched.push_back(slot);
+        }
+    }
+
+    // 收到 SYN: 重复的 SYN 重发 SYN ACK, 新的连接编号则建立新会话
+    template <mode_type mode>
+    void receive_server<mode>::accept(packet_view syn, const socket_address &source,
+                                      clock::time_point now)
+    {
+        std::uint32_t connection_id{syn.get_seq_num()};
+        auto it{m_sessions.find(source)};
+        if (it != m_sessions.end())
+        {
+            session_entry<mode> &entry{*m_slots[it->second]};
+            if (entry.connection_id == connection_id)
+            {
+                if (entry.state == session_state::syn_received)
+                {
+                    entry.last_active = now;
+                    m_loop->set_destination(entry.peer);
+                    m_loop->push(entry.syn_ack);
+                }
+                return;
+            }
+            log_debug("对端 ", source, " 重新连接, 放弃旧的会话");
+            remove(it->second);
+        }
+        if (m_free_slots.empty())
+        {
+            log_debug("会话数已达上限 ", m_options.max_sessions, ", 忽略来自 ", source,
+                      " 的 SYN");
+            return;
+        }
+
+        handshake_extensions extensions{decode_extensions(syn.get_buf(), syn.get_length())};
+        handshake_extensions accepted{accept_extensions(extensions, m_payload_limit)};
+        extensions.payload_size = accepted.payload_size;
+        extensions.fec = accepted.fec;
+        auto entry{std::make_unique<session_entry<mode>>()};
+        if (m_striped)
+        {
+            if (!extensions.stripe_offset)
+            {
+                log_debug("分条接收时忽略没有偏移的 SYN, 来自 ", source);
+                return;
+            }
+            accepted.stripe_offset = extensions.stripe_offset;
+            entry->session = std::make_unique<receive_session<mode>>(
+                *m_loop, m_metrics, m_striped->fd, *extensions.stripe_offset, m_window_size,
+                connection_id + 1, m_options, extensions);
+            log_debug("来自 ", source, " 的连接, 连接编号 ", connection_id, ", 握手扩展: ",
+                      extensions);
+        }
+        else
+        {
+            std::filesystem::path file_path{m_directory};
+            file_path /= socket_process::host_of(source) + '_' +
+                         std::to_string(socket_process::port_of(source)) + '_' +
+                         std::to_string(connection_id);
+            try
+            {
+                entry->session = std::make_unique<receive_session<mode>>(
+                    *m_loop, m_metrics, file_path.c_str(), m_window_size, connection_id + 1,
+                    m_options, extensions);
+            }
+            catch (exceptions)
+            {
+                return;
+            }
+            log_debug("来自 ", source, " 的连接, 连接编号 ", connection_id, ", 握手扩展: ",
+                      extensions, ", 写入 ", file_path);
+        }
+        entry->peer = source;
+        entry->connection_id = connection_id;
+        entry->last_active = now;
+        entry->syn_ack.make_packet(connection_id + 1,
+                                   encode_extensions(accepted, entry->syn_ack.get_buf()),
+                                   SYN | ACK);
+
+        std::size_t slot{m_free_slots.back()};
+        m_free_slots.pop_back();
+        m_slots[slot] = std::move(entry);
+        m_sessions.emplace(source, slot);
+        m_loop->set_destination(source);
+        m_loop->push(m_slots[slot]->syn_ack);
+        schedule_idle(slot);
+    }
+
+    // 收到 FIN: 确认所有包并写完文件, 然后回应 FIN ACK
+    template <mode_type mode> void receive_server<mode>::close(std::size_t slot)
+    {
+        session_entry<mode> &entry{*m_slots[slot]};
+        entry.session->finish();
+        m_loop->drain();
+        entry.fin_seq_num = entry.session->fin_seq_num();
+        entry.session.reset();
+        entry.state = session_state::closing;
+        m_loop->push_copy({entry.fin_seq_num, 0, FIN | ACK});
+        entry.ack_timer_deadline.reset();
+        m_timers.cancel(2 * slot);
+        schedule_idle(slot);
+        log_debug("会话 ", entry.peer, " 接收完成");
+        m_metrics.stop();
+        if (m_striped)
+            m_striped->n_completed++;
+    }
+
+    template <mode_type mode> void receive_server<mode>::remove(std::size_t slot)
+    {
+        // 已加入发送队列的包可能引用会话中的内存
+        m_loop->flush();
+        m_sessions.erase(m_slots[slot]->peer);
+        m_timers.cancel(2 * slot);
+        m_timers.cancel(2 * slot + 1);
+        m_timers_changed = true;
+        m_slots[slot].reset();
+        m_free_slots.push_back(slot);
+    }
+
+    template <mode_type mode>
+    void receive_server<mode>::push_pending_ack(std::size_t slot, clock::time_point now)
+    {
+        session_entry<mode> &entry{*m_slots[slot]};
+        if (!entry.session)
+            return;
+        m_loop->set_destination(entry.peer);
+        entry.session->push_pending_ack(now);
+
+        const auto &deadline{entry.session->ack_deadline()};
+        if (deadline == entry.ack_timer_deadline)
+            return;
+        if (deadline)
+            m_timers.schedule(2 * slot, *deadline);
+        else
+            m_timers.cancel(2 * slot);
+        entry.ack_timer_deadline = deadline;
+        m_timers_changed = true;
+    }
+
+    // 空闲定时器按最后一次收到包的时间检查, 收到包时不必重设
+    template <mode_type mode> void receive_server<mode>::schedule_idle(std::size_t slot)
+    {
+        session_entry<mode> &entry{*m_slots[slot]};
+        auto timeout{entry.state == session_state::closing ? LINGER_TIME : IDLE_TIMEOUT};
+        m_timers.schedule(2 * slot + 1, entry.last_active + timeout);
+        m_timers_changed = true;
+    }
+
+    template <mode_type mode> void receive_server<mode>::expire_timers(clock::time_point now)
+    {
+        m_expired.clear();
+        m_timers.expire(now, m_expired);
+        for (std::size_t id : m_expired)
+        {
+            std::size_t slot{id / 2};
+            m_timers_changed = true;
+            if (!m_slots[slot])
+                continue;
+            session_entry<mode> &entry{*m_slots[slot]};
+            if (id % 2 == 0)
+            {
+                entry.ack_timer_deadline.reset();
+                push_pending_ack(slot, now);
+                continue;
+            }
+
+            auto timeout{entry.state == session_state::closing ? LINGER_TIME : IDLE_TIMEOUT};
+            if (now - entry.last_active < timeout)
+            {
+                schedule_idle(slot);
+                continue;
+            }
+            if (entry.state == session_state::closing)
+                log_debug("会话 ", entry.peer, " 结束");
+            else
+            {
+                log_debug("会话 ", entry.peer, " 接收数据超时, 放弃");
+                if (m_striped)
+                    m_striped->n_failed++;
+            }
+            remove(slot);
+        }
+    }
+
+    template <mode_type mode> void receive_server<mode>::arm_timer()
+    {
+        if (!m_timers_changed && m_timer_armed)
+            return;
+        m_timers_changed = false;
+        auto deadline{m_timers.next_deadline()};
+        if (m_striped && m_sessions.empty())
+        {
+            auto poll{clock::now() + STRIPE_POLL_INTERVAL};
+            if (!deadline || *deadline > poll)
+                deadline = poll;
+        }
+        if (!deadline)
+        {
+            if (m_timer_armed)
+                m_loop->stop_timer(SERVER_TIMER);
+            m_timer_armed = false;
+            return;
+        }
+        if (m_timer_armed && m_timer_deadline == *deadline)
+            return;
+        auto now{clock::now()};
+        auto delay{*deadline > now ? std::chrono::ceil<std::chrono::microseconds>(*deadline - now)
+                                   : std::chrono::microseconds{1}};
+        m_loop->start_timer(SERVER_TIMER, delay);
+        m_timer_armed = true;
+        m_timer_deadline = *deadline;
+    }
+
+    template <mode_type mode> const transfer_metrics &receive_server<mode>::metrics() const
+    {
+        return m_metrics;
+    }
+
+    // 服务器模式一直运行; 分条接收在所有条都已结束、本线程的会话都已挥手完成后退出
+    template <mode_type mode> bool receive_server<mode>::finished() const
+    {
+        return m_striped && m_sessions.empty() &&
+               m_striped->n_completed + m_striped->n_failed >= m_striped->n_stripes;
+    }
+
+    template <mode_type mode>
+    void run_server(int fd, const char *directory, std::size_t window_size,
+                    const transfer_options &options)
+    {
+        std::unique_ptr<stats_sink> snapshot_sink;
+        if (!options.stats_snapshot.empty())
+            snapshot_sink = std::make_unique<stats_sink>(options.stats_snapshot);
+        receive_server<mode> server{fd, directory, window_size, options, snapshot_sink.get()};
+        server.run();
+    }
+
+    template <mode_type mode>
+    void run_striped(std::vector<std::unique_ptr<file_process::fd_wrapper>> &sockets, striped_output &output,
+                     std::size_t window_size, const transfer_options &options)
+    {
+        std::unique_ptr<stats_sink> snapshot_sink;
+        if (!options.stats_snapshot.empty())
+            snapshot_sink = std::make_unique<stats_sink>(options.stats_snapshot);
+        std::atomic<bool> failed{false};
+        std::vector<transfer_metrics> metrics(sockets.size());
+        std::vector<std::thread> threads;
+        for (std::size_t i{0}; i < sockets.size(); i++)
+            threads.emplace_back([&, i] {
+                try
+                {
+                    set_cpu_affinity(options.cpus, i);
+                    receive_server<mode> server{sockets[i]->get_file_descriptor(),
+                                                nullptr,
+                                                window_size,
+                                                options,
+                                                snapshot_sink.get(),
+                                                static_cast<int>(i),
+                                                &output};
+                    server.run();
+                    metrics[i] = server.metrics();
+                }
+                catch (exceptions)
+                {
+                    failed = true;
+                }
+            });
+        for (auto &thread : threads)
+            thread.join();
+        if (!options.stats.empty())
+        {
+            for (std::size_t i{1}; i < metrics.size(); i++)
+                metrics[0].merge(metrics[i]);
+            stats_sink sink{options.stats};
+            write_stats(sink, metrics[0], "receiver");
+        }
+        if (failed || output.n_failed > 0)
+            logs::error("分条接收失败");
+    }
+}
+
+void serve(const char *port, const char *directory, std::size_t window_size, mode_type mode,
+           const transfer_options &options)
+{
+    if (!std::filesystem::is_directory(directory))
+        logs::error("服务器模式下 `", directory, "` 必须是已存在的目录");
+    file_process::fd_wrapper socket_wrapper{socket_process::open_receiver_socket(port)};
+    socket_process::set_no_recv_timeout(socket_wrapper.get_file_descriptor());
+
+    switch (mode)
+    {
+    case mode_type::go_back_n:
+        run_server<mode_type::go_back_n>(socket_wrapper.get_file_descriptor(), directory,
+                                         window_size, options);
+        break;
+    case mode_type::selective_repeat:
+        run_server<mode_type::selective_repeat>(socket_wrapper.get_file_descriptor(), directory,
+                                                window_size, options);
+        break;
+    case mode_type::unknown:
+        logs::error("未知的模式");
+        break;
+    }
+}
+
+void receive_striped(const char *port, const char *file_path, std::size_t window_size,
+                     mode_type mode, const transfer_options &options)
+{
+    file_process::fd_wrapper output_wrapper{
+        ::open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+    if (!output_wrapper.is_valid())
+        logs::error("打开文件 `", file_path, "` 时出现了问题");
+    striped_output output{output_wrapper.get_file_descriptor(), options.stripes};
+
+    // 先绑定所有套接字, 内核才会把各发送端的流分散到它们上面
+    std::vector<std::unique_ptr<file_process::fd_wrapper>> sockets;
+    for (std::size_t i{0}; i < options.stripes; i++)
+    {
+        sockets.push_back(std::make_unique<file_process::fd_wrapper>(
+            socket_process::open_receiver_socket(port, true)));
+        socket_process::set_no_recv_timeout(sockets.back()->get_file_descriptor());
+    }
+
+    switch (mode)
+    {
+    case mode_type::go_back_n:
+        run_striped<mode_type::go_back_n>(sockets, output, window_size, options);
+        break;
+    case mode_type::selective_repeat:
+        run_striped<mode_type::selective_repeat>(sockets, output, window_size, options);
+        break;
+    case mode_type::unknown:
+        logs::error("未知的模式");
+        break;
+    }
+    log_debug("分条接收完成, 共 ", output.n_stripes, " 条");
+}
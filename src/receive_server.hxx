@@ -0,0 +1,21 @@
+#ifndef RECEIVE_SERVER_HXX
+#define RECEIVE_SERVER_HXX
+
+#include "options.hxx"
+#include "tools.hxx"
+#include <cstddef>
+
+// 服务器模式: 一个没有 `connect()` 的套接字同时接收多个发送端的文件.
+// 会话按对端地址区分, 以 SYN 的序号作为连接编号; 每个会话有自己的窗口与输出文件
+// `<directory>/<对端地址>_<端口>_<连接编号>`, 全部由同一个事件循环驱动.
+// 一直运行到被信号终止.
+void serve(const char *port, const char *directory, std::size_t window_size, mode_type mode,
+           const transfer_options &options);
+
+// 分条接收 (`--stripes=N`): 在同一端口上打开 N 个 `SO_REUSEPORT` 套接字, 每个由一个
+// 线程 (按 `--cpus` 绑核) 驱动. 发送端的每个进程负责文件的一段, 握手时以扩展给出偏移;
+// 各线程把收到的包直接写到 `file_path` 中对应的位置. N 条都结束后返回.
+void receive_striped(const char *port, const char *file_path, std::size_t window_size,
+                     mode_type mode, const transfer_options &options);
+
+#endif
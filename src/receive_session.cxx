@@ -0,0 +1,508 @@
+#include "receive_session.hxx"
+#include "compression.hxx"
+#include "error_process.hxx"
+#include "sack.hxx"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::size_t receiver_payload_limit(int socket_fd, const transfer_options &options)
+{
+    if (options.mtu_auto)
+        return PAYLOAD_LIMIT;
+    if (options.mtu == 0)
+        return PAYLOAD_MAX;
+    return socket_process::payload_size_for_mtu(socket_fd, options.mtu);
+}
+
+template <mode_type mode>
+receive_session<mode>::receive_session(event_loop &loop, transfer_metrics &metrics,
+                                       std::size_t window_size, std::uint32_t start_seq_num,
+                                       const transfer_options &options,
+                                       const handshake_extensions &extensions)
+    : m_loop{loop}, m_metrics{metrics}, m_file_start_seq_num{start_seq_num},
+      m_payload_size{extensions.payload_size.value_or(PAYLOAD_MAX) -
+                     (extensions.fec ? fec::OVERHEAD : 0)},
+      m_data_flags{extensions.compression ? COMPRESSED : std::uint8_t{0}},
+      m_ack_flags_vec(window_size, false), m_window_size{window_size},
+      m_window_left_seq_num{start_seq_num}, m_window_right_seq_num{start_seq_num + window_size},
+      // 空文件 (或空的分条) 的 FIN 紧跟在握手之后
+      m_fin_seq_num{start_seq_num - 1u},
+      m_sack_enabled{extensions.sack}, m_ack_every{options.ack_every},
+      m_ack_delay{options.ack_delay_us}
+{
+    m_ack_coalescing =
+        m_sack_enabled || (mode == mode_type::go_back_n && options.ack_every > 1);
+    if (!m_ack_coalescing && m_ack_every > 1)
+        log_debug("选择重传没有协商选择确认, 无法合并 ACK");
+    if (m_data_flags & COMPRESSED)
+        m_decompressed.resize(m_payload_size);
+    if (extensions.fec)
+        m_fec = std::make_unique<fec::decoder>(*extensions.fec, m_payload_size, window_size,
+                                               start_seq_num);
+}
+
+template <mode_type mode>
+receive_session<mode>::receive_session(event_loop &loop, transfer_metrics &metrics,
+                                       const char *file_path, std::size_t window_size,
+                                       std::uint32_t start_seq_num,
+                                       const transfer_options &options,
+                                       const handshake_extensions &extensions)
+    : receive_session{loop, metrics, window_size, start_seq_num, options, extensions}
+{
+    // 标准输出 (`-`)、管道等不能定位, 只能按顺序写
+    bool to_stdout{std::string_view{file_path} == "-"};
+    struct stat status;
+    bool seekable{!to_stdout && (stat(file_path, &status) == -1 || S_ISREG(status.st_mode))};
+    if (options.pwrite && !seekable)
+        log_debug("输出不是普通文件, 不使用 `--pwrite`");
+    if (extensions.resume && extensions.resume_offset)
+    {
+        // 续传时直接写到文件中的位置, 窗口左端之前的部分总是已经写出
+        std::uint64_t offset{*extensions.resume_offset};
+        m_output_wrapper.open(
+            ::open(file_path, O_RDWR | O_CREAT | (offset == 0 ? O_TRUNC : 0), 0644));
+        if (!m_output_wrapper.is_valid())
+            logs::error("打开文件 `", file_path, "` 时出现了问题");
+        m_output_fd = m_output_wrapper.get_file_descriptor();
+        m_output_offset = offset;
+        if (ftruncate(m_output_fd, static_cast<off_t>(extensions.resume->size)) == -1)
+            error_process::unix_error("`ftruncate()` 错误: ");
+        m_journal = std::make_unique<journal::writer>(file_path, *extensions.resume, offset);
+        m_journaled = offset;
+        log_debug("从第 ", offset, " 字节续传");
+    }
+    else if (options.pwrite && seekable)
+    {
+        m_output_wrapper.open(::open(file_path, O_WRONLY | O_CREAT | O_TRUNC, 0644));
+        if (!m_output_wrapper.is_valid())
+            logs::error("打开文件 `", file_path, "` 时出现了问题");
+        m_output_fd = m_output_wrapper.get_file_descriptor();
+        if (extensions.file_size && *extensions.file_size > 0)
+        {
+            int err{posix_fallocate(m_output_fd, 0, *extensions.file_size)};
+            if (err != 0)
+                log_debug("`posix_fallocate()` 失败, 继续接收: ", err);
+        }
+    }
+    else
+    {
+        if (to_stdout)
+            m_out = &std::cout;
+        else
+        {
+            m_ofs.open(file_path, std::ios::binary | std::ios::trunc);
+            if (m_ofs.fail())
+                logs::error("打开文件 `", file_path, "` 时出现了问题");
+        }
+        m_packet_handles.assign(window_size, packet_pool::NO_HANDLE);
+        m_loop.pool().reserve(window_size);
+    }
+}
+
+template <mode_type mode>
+receive_session<mode>::receive_session(event_loop &loop, transfer_metrics &metrics,
+                                       int output_fd, std::uint64_t output_offset,
+                                       std::size_t window_size, std::uint32_t start_seq_num,
+                                       const transfer_options &options,
+                                       const handshake_extensions &extensions)
+    : receive_session{loop, metrics, window_size, start_seq_num, options, extensions}
+{
+    m_output_fd = output_fd;
+    m_output_offset = output_offset;
+}
+
+template <mode_type mode> receive_session<mode>::~receive_session()
+{
+    // 出错或被信号中断而退出时也记下已写入的部分
+    if (m_journal)
+    {
+        try
+        {
+            checkpoint(true);
+        }
+        catch (exceptions)
+        {
+        }
+    }
+    for (packet_pool::handle h : m_packet_handles)
+        if (h != packet_pool::NO_HANDLE)
+            m_loop.pool().release(h);
+}
+
+template <mode_type mode> bool receive_session<mode>::process(std::size_t i)
+{
+    packet_view packet{m_loop[i]};
+    // 续传时 FIN 带整个文件的校验和
+    if (packet.get_flag() == FIN &&
+        packet.get_seq_num() == static_cast<std::uint32_t>(m_fin_seq_num + 1) &&
+        (packet.get_length() == 0 ||
+         (m_journal && packet.get_length() == sizeof(std::uint32_t))))
+    {
+        log_debug("收到 FIN");
+        if (packet.get_length() > 0)
+        {
+            std::uint32_t checksum;
+            std::memcpy(&checksum, packet.get_buf(), sizeof(checksum));
+            m_file_checksum = checksum;
+        }
+        m_fin_seq_num++;
+        return true;
+    }
+    if (m_fec && packet.get_flag() == PARITY)
+    {
+        receive_parity(packet);
+        return false;
+    }
+
+    // 比协商的更长的包会覆盖下一个包在文件中的位置
+    if ((packet.get_flag() & ~m_data_flags) != 0 || packet.get_length() > m_payload_size)
+        return false;
+
+    std::size_t seq_num{unwrap_seq_num(packet.get_seq_num(), m_window_left_seq_num)};
+    accept(packet, i);
+    if (m_fec)
+        recover(seq_num);
+    if (m_journal)
+        checkpoint(false);
+    return false;
+}
+
+template <>
+void receive_session<mode_type::selective_repeat>::accept(packet_view packet, std::size_t i)
+{
+    if (i != RECOVERED)
+        m_metrics.add(counter::packets_received);
+    std::size_t seq_num{unwrap_seq_num(packet.get_seq_num(), m_window_left_seq_num)};
+    std::size_t index{seq_num % m_window_size};
+    if (seq_num >= m_window_right_seq_num)
+    {
+        log_debug("收到的 `seq_num` ", seq_num, " 大于窗口右边界 ", m_window_right_seq_num);
+        m_metrics.add(counter::out_of_window_packets);
+        return;
+    }
+    if (seq_num < m_window_left_seq_num || m_ack_flags_vec[index])
+    {
+        m_metrics.add(counter::duplicate_packets);
+        send_ack(seq_num, true);
+        return;
+    }
+
+    if (!store_packet(packet, i, seq_num, index))
+        return;
+    m_ack_flags_vec[index] = true;
+    if (m_fec && i != RECOVERED)
+        m_fec->add_data(seq_num, packet, packet.get_buf());
+    if (m_fin_seq_num < seq_num)
+        m_fin_seq_num = seq_num;
+    log_debug("ACK ", seq_num);
+
+    if (seq_num != m_window_left_seq_num)
+    {
+        send_ack(seq_num, true);
+        return;
+    }
+
+    std::size_t _1st_nack_pkt;
+    for (_1st_nack_pkt = m_window_left_seq_num; _1st_nack_pkt < m_window_right_seq_num;
+         _1st_nack_pkt++)
+    {
+        std::size_t index{_1st_nack_pkt % m_window_size};
+
+        if (!m_ack_flags_vec[index])
+            break;
+
+        m_ack_flags_vec[index] = false;
+        deliver_packet(index);
+    }
+
+    std::size_t difference{_1st_nack_pkt - m_window_left_seq_num};
+    m_window_left_seq_num += difference;
+    m_window_right_seq_num += difference;
+
+    log_debug("窗口变为 ", m_window_left_seq_num, ' ', m_window_right_seq_num);
+    // 填上了空洞时立即确认
+    send_ack(seq_num, difference > 1);
+}
+
+template <>
+void receive_session<mode_type::go_back_n>::accept(packet_view packet, std::size_t i)
+{
+    if (i != RECOVERED)
+        m_metrics.add(counter::packets_received);
+    std::size_t seq_num{unwrap_seq_num(packet.get_seq_num(), m_window_left_seq_num)};
+    std::size_t index{seq_num % m_window_size};
+    if (seq_num >= m_window_right_seq_num)
+    {
+        log_debug("收到的 `seq_num` ", seq_num, " 大于窗口右边界 ", m_window_right_seq_num);
+        m_metrics.add(counter::out_of_window_packets);
+        return;
+    }
+    if (seq_num < m_window_left_seq_num || m_ack_flags_vec[index])
+    {
+        m_metrics.add(counter::duplicate_packets);
+        send_ack(m_window_left_seq_num, true);
+        return;
+    }
+
+    if (!store_packet(packet, i, seq_num, index))
+        return;
+    m_ack_flags_vec[index] = true;
+    if (m_fec && i != RECOVERED)
+        m_fec->add_data(seq_num, packet, packet.get_buf());
+    if (m_fin_seq_num < seq_num)
+        m_fin_seq_num = seq_num;
+
+    log_debug("ACK ", seq_num);
+
+    if (seq_num != m_window_left_seq_num)
+    {
+        // 乱序到达: 立即重复确认窗口左端, 发送端据此快速重传
+        send_ack(m_window_left_seq_num, true);
+        return;
+    }
+
+    std::size_t _1st_nack_pkt;
+    for (_1st_nack_pkt = m_window_left_seq_num; _1st_nack_pkt < m_window_right_seq_num;
+         _1st_nack_pkt++)
+    {
+        std::size_t index{_1st_nack_pkt % m_window_size};
+
+        if (!m_ack_flags_vec[index])
+            break;
+
+        m_ack_flags_vec[index] = false;
+        deliver_packet(index);
+    }
+
+    std::size_t difference{_1st_nack_pkt - m_window_left_seq_num};
+    m_window_left_seq_num += difference;
+    m_window_right_seq_num += difference;
+
+    log_debug("窗口变为 ", m_window_left_seq_num, ' ', m_window_right_seq_num);
+
+    send_ack(m_window_left_seq_num, difference > 1);
+}
+
+// 不合并时立即发出 ACK; 否则只记下需要确认, 由 `push_pending_ack()` 发出
+template <mode_type mode>
+void receive_session<mode>::send_ack(std::size_t seq_num, bool immediate)
+{
+    if (!m_ack_coalescing)
+    {
+        m_metrics.add(counter::acks_sent);
+        m_loop.push_copy({static_cast<std::uint32_t>(seq_num), 0, ACK});
+        return;
+    }
+    m_n_unacked++;
+    if (immediate)
+        m_ack_now = true;
+}
+
+// `ack_delay` 为 0 时每批都确认
+template <mode_type mode> void receive_session<mode>::push_pending_ack(clock::time_point now)
+{
+    if (m_n_unacked == 0)
+        return;
+    if (!m_ack_now && m_n_unacked < m_ack_every && m_ack_delay.count() > 0)
+    {
+        if (!m_ack_deadline)
+            m_ack_deadline = now + m_ack_delay;
+        if (now < *m_ack_deadline)
+            return;
+    }
+
+    if (m_sack_enabled)
+    {
+        std::uint16_t length{sack::encode(m_ack_flags_vec, m_window_left_seq_num,
+                                          m_window_right_seq_num, m_sack_packet.get_buf())};
+        m_sack_packet.make_packet(static_cast<std::uint32_t>(m_window_left_seq_num), length,
+                                  ACK);
+        m_loop.push(m_sack_packet);
+    }
+    else
+        m_loop.push_copy({static_cast<std::uint32_t>(m_window_left_seq_num), 0, ACK});
+    m_metrics.add(counter::acks_sent);
+    m_n_unacked = 0;
+    m_ack_now = false;
+    m_ack_deadline.reset();
+}
+
+template <mode_type mode> void receive_session<mode>::finish()
+{
+    m_ack_now = true;
+    push_pending_ack(clock::now());
+    if (m_output_fd < 0 && !m_out->flush())
+        logs::error("写输出时出现了问题");
+}
+
+// 收到校验包的组缺的数据包可能已经可以恢复. 整组都在窗口左端之前时早已收齐;
+// 发送端不会在窗口右端之后发包, 也就不会有那里的校验包.
+template <mode_type mode> void receive_session<mode>::receive_parity(packet_view parity)
+{
+    std::size_t first_seq_num{unwrap_seq_num(parity.get_seq_num(), m_window_left_seq_num)};
+    if (first_seq_num + m_fec->group_size() <= m_window_left_seq_num ||
+        first_seq_num >= m_window_right_seq_num)
+        return;
+    if (!m_fec->add_parity(first_seq_num, parity))
+    {
+        log_debug("校验包 ", first_seq_num, " 不合法");
+        return;
+    }
+    recover(first_seq_num);
+}
+
+template <mode_type mode> void receive_session<mode>::recover(std::size_t seq_num)
+{
+    packet_pool &pool{m_loop.pool()};
+    for (const fec::recovered_packet &recovered : m_fec->recover(seq_num))
+    {
+        log_debug("由校验包恢复出 ", recovered.seq_num);
+        m_metrics.add(counter::packets_recovered);
+        if ((recovered.flag & ~m_data_flags) != 0 || recovered.length > m_payload_size)
+            continue;
+        m_recovered = pool.acquire();
+        packet_view packet{pool[m_recovered]};
+        std::memcpy(packet.get_buf(), recovered.payload, recovered.length);
+        packet.make_packet(static_cast<std::uint32_t>(recovered.seq_num), recovered.length,
+                           recovered.flag);
+        accept(packet, RECOVERED);
+        // 没有被窗口接管 (重复、解压后另放或直接写到了文件) 时归还
+        if (m_recovered != packet_pool::NO_HANDLE)
+        {
+            pool.release(m_recovered);
+            m_recovered = packet_pool::NO_HANDLE;
+        }
+    }
+}
+
+// 按顺序写出时接管包所在的缓冲区, 只有与别的包共用缓冲区时才复制.
+// 压缩的包解压到新的缓冲区 (直接写到文件时解压到 `m_decompressed`).
+template <mode_type mode>
+bool receive_session<mode>::store_packet(packet_view packet, std::size_t i,
+                                         std::size_t seq_num, std::size_t index)
+{
+    packet_pool &pool{m_loop.pool()};
+    const char *payload{packet.get_buf()};
+    std::size_t length{packet.get_length()};
+    packet_pool::handle h{packet_pool::NO_HANDLE};
+    if (packet.get_flag() & COMPRESSED)
+    {
+        char *buf{m_decompressed.data()};
+        if (m_output_fd < 0)
+        {
+            h = pool.acquire();
+            buf = pool[h].get_buf();
+        }
+        auto n{compression::decompress(payload, length, buf, m_payload_size)};
+        if (!n)
+        {
+            log_debug("包 ", seq_num, " 解压失败");
+            if (h != packet_pool::NO_HANDLE)
+                pool.release(h);
+            m_metrics.add(counter::checksum_failures);
+            return false;
+        }
+        payload = buf;
+        length = *n;
+        // 窗口中的包只用到负载长度
+        if (h != packet_pool::NO_HANDLE)
+            *reinterpret_cast<rtp_header *>(pool.data(h)) =
+                rtp_header{packet.get_seq_num(), static_cast<std::uint16_t>(length), 0};
+    }
+    m_metrics.add_goodput(length);
+
+    if (m_output_fd < 0)
+    {
+        if (h == packet_pool::NO_HANDLE && i == RECOVERED)
+            std::swap(h, m_recovered);
+        else if (h == packet_pool::NO_HANDLE)
+            h = m_loop.take(i);
+        if (h == packet_pool::NO_HANDLE)
+        {
+            h = pool.acquire();
+            std::memcpy(pool.data(h), packet.data(), sizeof(rtp_header) + length);
+        }
+        m_packet_handles[index] = h;
+        return true;
+    }
+
+    off_t offset{static_cast<off_t>(m_output_offset +
+                                    (seq_num - m_file_start_seq_num) * m_payload_size)};
+    m_loop.write_file(m_output_fd, payload, length, offset);
+    return true;
+}
+
+template <mode_type mode> void receive_session<mode>::deliver_packet(std::size_t index)
+{
+    if (m_output_fd >= 0)
+        return;
+    packet_pool &pool{m_loop.pool()};
+    packet_view packet{pool[m_packet_handles[index]]};
+    m_out->write(packet.get_buf(), packet.get_length());
+    pool.release(m_packet_handles[index]);
+    m_packet_handles[index] = packet_pool::NO_HANDLE;
+}
+
+// 日志只在输出同步之后前进. 最后一个包可能不满, 前缀不超过文件大小.
+template <mode_type mode> void receive_session<mode>::checkpoint(bool force)
+{
+    std::uint64_t committed{std::min<std::uint64_t>(
+        m_output_offset + (m_window_left_seq_num - m_file_start_seq_num) * m_payload_size,
+        m_journal->identity().size)};
+    if (committed == m_journaled || (!force && committed - m_journaled < CHECKPOINT_BYTES))
+        return;
+    m_loop.drain();
+    if (fdatasync(m_output_fd) == -1)
+        error_process::unix_error("`fdatasync()` 错误: ");
+    m_journal->store(committed);
+    m_journaled = committed;
+}
+
+// 核对不一致时输出中已记入日志的部分也不可信, 同样删除日志, 下次从头接收
+template <mode_type mode> std::optional<bool> receive_session<mode>::verify_file()
+{
+    if (!m_journal)
+        return std::nullopt;
+    m_loop.drain();
+    std::uint64_t size{m_journal->identity().size};
+    std::vector<char> buf(1 << 20);
+    std::uint32_t checksum{0};
+    std::uint64_t offset{0};
+    while (offset < size)
+    {
+        ssize_t n_bytes{pread(m_output_fd, buf.data(),
+                              std::min<std::uint64_t>(buf.size(), size - offset),
+                              static_cast<off_t>(offset))};
+        if (n_bytes == -1)
+            error_process::unix_error("`pread()` 错误: ");
+        if (n_bytes == 0)
+            break;
+        checksum = checksum::extend(checksum, buf.data(), static_cast<std::size_t>(n_bytes));
+        offset += static_cast<std::uint64_t>(n_bytes);
+    }
+    bool verified{offset == size && m_file_checksum == checksum};
+    log_debug("整个文件的校验和 ", checksum, verified ? ", 核对一致" : ", 与发送端的不符");
+    m_journal->remove();
+    m_journal.reset();
+    return verified;
+}
+
+template <mode_type mode>
+const std::optional<typename receive_session<mode>::clock::time_point> &
+receive_session<mode>::ack_deadline() const
+{
+    return m_ack_deadline;
+}
+
+template <mode_type mode> std::uint32_t receive_session<mode>::fin_seq_num() const
+{
+    return static_cast<std::uint32_t>(m_fin_seq_num);
+}
+
+template class receive_session<mode_type::go_back_n>;
+template class receive_session<mode_type::selective_repeat>;
@@ -0,0 +1,141 @@
+#ifndef RECEIVE_SESSION_HXX
+#define RECEIVE_SESSION_HXX
+
+#include "event_loop.hxx"
+#include "extension.hxx"
+#include "fec.hxx"
+#include "file_process.hxx"
+#include "journal.hxx"
+#include "metrics.hxx"
+#include "options.hxx"
+#include "rtp_header.hxx"
+#include "tools.hxx"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <vector>
+
+// 接收端按 `--mtu` 能接受的最大负载: 没有设定时为 `PAYLOAD_MAX`, `auto` 时不限
+std::size_t receiver_payload_limit(int socket_fd, const transfer_options &options);
+
+// 一次文件接收的全部状态: 接收窗口、输出文件与 ACK 合并.
+// 握手与挥手由调用者完成; 会话只处理握手之后的数据包与 FIN,
+// ACK 经 `loop` 发出, 调用者负责在此之前设定好目的地址.
+template <mode_type mode> class receive_session
+{
+public:
+    using clock = std::chrono::steady_clock;
+
+private:
+    event_loop &m_loop;
+    transfer_metrics &m_metrics;
+
+    std::ofstream m_ofs;
+    // 按顺序写出的输出: `m_ofs` 或标准输出
+    std::ostream *m_out{&m_ofs};
+    // `--pwrite` 模式、续传或分条传输时的输出文件. 包按
+    // `m_output_offset + (seq_num - m_file_start_seq_num) * m_payload_size`
+    // 直接写到最终位置, 窗口中只剩下 `m_ack_flags_vec`. 分条传输时文件由调用者持有.
+    file_process::fd_wrapper m_output_wrapper{-1};
+    int m_output_fd{-1};
+    std::uint64_t m_output_offset{0};
+    std::size_t m_file_start_seq_num;
+    // 数据包的负载长度, 除最后一个包外每个包都是满的. 即握手时协商的负载长度,
+    // 协商了 FEC 时再减去 `fec::OVERHEAD`.
+    std::size_t m_payload_size;
+    // 数据包可以带的标志: 协商了压缩时为 `COMPRESSED`, 否则为 0.
+    // 直接写到文件时压缩的包先解压到 `m_decompressed`.
+    std::uint8_t m_data_flags;
+    std::vector<char> m_decompressed;
+
+    // 按顺序写出时, 窗口中每个已收到的包所在的缓冲区. 缓冲区从事件循环的池中
+    // 直接接管 (见 `event_loop::take()`), 写出后归还.
+    std::vector<packet_pool::handle> m_packet_handles;
+    std::vector<std::uint8_t> m_ack_flags_vec;
+
+    // 协商了前向纠错时, 由校验包恢复出缺的数据包. 恢复出的包放在 `m_recovered` 中,
+    // 按收到的包同样处理.
+    std::unique_ptr<fec::decoder> m_fec;
+    packet_pool::handle m_recovered{packet_pool::NO_HANDLE};
+    static constexpr std::size_t RECOVERED{~std::size_t{0}};
+
+    // 协商了续传时的日志 (见 `journal.hxx`) 与已记入日志的前缀. 前缀每增长
+    // `CHECKPOINT_BYTES` 同步一次输出并记入日志.
+    std::unique_ptr<journal::writer> m_journal;
+    std::uint64_t m_journaled{0};
+    static constexpr std::uint64_t CHECKPOINT_BYTES{64 << 20};
+    // FIN 带来的整个文件的校验和
+    std::optional<std::uint32_t> m_file_checksum;
+
+    std::size_t m_window_size;
+    std::size_t m_window_left_seq_num;
+    std::size_t m_window_right_seq_num;
+    std::size_t m_fin_seq_num;
+
+    // 合并 ACK: 每收完一批包, 按 `--ack-every` / `--ack-delay` 决定是否发出一个累计确认
+    // (协商了选择确认时带位图). 选择重传不带位图的 ACK 只确认单个包, 无法合并.
+    bool m_ack_coalescing;
+    bool m_sack_enabled;
+    std::size_t m_ack_every;
+    std::chrono::microseconds m_ack_delay;
+    // 还没有确认的包数, 以及是否有乱序、重复等需要立即确认的情况
+    std::size_t m_n_unacked{0};
+    bool m_ack_now{false};
+    std::optional<clock::time_point> m_ack_deadline;
+    rtp_packet m_sack_packet;
+
+    // 处理一个数据包: 本轮收到的第 `i` 个包, 或 `i` 为 `RECOVERED` 时恢复出的包
+    void accept(packet_view packet, std::size_t i);
+    void receive_parity(packet_view parity);
+    void recover(std::size_t seq_num);
+    void send_ack(std::size_t seq_num, bool immediate);
+    // 解压失败时返回 false
+    [[nodiscard]] bool store_packet(packet_view packet, std::size_t i, std::size_t seq_num,
+                                    std::size_t index);
+    void deliver_packet(std::size_t index);
+    // 同步输出中窗口左端之前的部分并记入日志. `force` 为 false 时攒够
+    // `CHECKPOINT_BYTES` 才做.
+    void checkpoint(bool force);
+
+    receive_session(event_loop &loop, transfer_metrics &metrics, std::size_t window_size,
+                    std::uint32_t start_seq_num, const transfer_options &options,
+                    const handshake_extensions &extensions);
+
+public:
+    receive_session &operator=(const receive_session &) = delete;
+    receive_session(const receive_session &) = delete;
+    ~receive_session();
+
+    // 打开输出文件, `-` 为标准输出. 协商了续传时保留文件中 `resume_offset` 之前的部分,
+    // 第一个数据包写在那里. `start_seq_num` 是第一个数据包的序号 (包头中的
+    // 低 32 位, 之后的序号按 64 位计). 统计计入 `metrics`.
+    receive_session(event_loop &loop, transfer_metrics &metrics, const char *file_path,
+                    std::size_t window_size, std::uint32_t start_seq_num,
+                    const transfer_options &options, const handshake_extensions &extensions);
+    // 分条传输: 写入调用者打开的 `output_fd`, 第一个数据包位于 `output_offset`
+    receive_session(event_loop &loop, transfer_metrics &metrics, int output_fd,
+                    std::uint64_t output_offset, std::size_t window_size,
+                    std::uint32_t start_seq_num, const transfer_options &options,
+                    const handshake_extensions &extensions);
+
+    // 处理 `loop` 本轮收到的第 `i` 个包, 调用者已校验过. 收到 FIN 时返回 true.
+    bool process(std::size_t i);
+
+    // 一批包处理完后调用: 攒够 `ack_every` 个包、需要立即确认或已到 `ack_deadline()`
+    // 时发出累计确认, 否则记下最晚的确认时间
+    void push_pending_ack(clock::time_point now);
+    // 收到 FIN 后调用: 立即发出所有未发的确认
+    void finish();
+    // 协商了续传时, 在 `finish()` 之后读回整个输出, 与 FIN 带来的校验和核对, 然后删除
+    // 日志. 返回是否一致; 没有协商续传时为空.
+    std::optional<bool> verify_file();
+
+    // 有推迟的确认时, 调用者应在这个时间之后再调用 `push_pending_ack()`
+    const std::optional<clock::time_point> &ack_deadline() const;
+    std::uint32_t fin_seq_num() const;
+};
+
+#endif
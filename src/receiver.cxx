@@ -1,152 +1,217 @@
 #include "error_process.hxx"
+#include "event_loop.hxx"
+#include "extension.hxx"
+#include "fec.hxx"
 #include "file_process.hxx"
+#include "journal.hxx"
+#include "metrics.hxx"
+#include "options.hxx"
+#include "packet_pool.hxx"
+#include "receive_server.hxx"
+#include "receive_session.hxx"
 #include "rtp_header.hxx"
 #include "socket_process.hxx"
 #include "tools.hxx"
 #include <cerrno>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
-#include <fstream>
-#include <sys/epoll.h>
+#include <fcntl.h>
+#include <memory>
+#include <optional>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
-#include <vector>
+#include <unistd.h>
 
-[[noreturn]] void terminal(int err_num) { std::exit(EXIT_FAILURE); }
+// 接收文件的主循环运行时, SIGINT/SIGTERM 只置位 `interrupted` 并写管道唤醒主循环,
+// 由主循环抛出异常退出, 会话的析构函数因此能记下续传位置. 其他时候直接退出.
+volatile std::sig_atomic_t receiving{0};
+volatile std::sig_atomic_t interrupted{0};
+int interrupt_pipe[2]{-1, -1};
 
-void receiver_core_function(const char *port, const char *file_path,
-                            std::size_t window_size, mode_type mode);
+void terminal(int err_num)
+{
+    if (!receiving)
+        std::exit(EXIT_FAILURE);
+    interrupted = 1;
+    [[maybe_unused]] ssize_t n{write(interrupt_pipe[1], "", 1)};
+}
 
-std::size_t handshake(int fd);
+void receiver_core_function(const char *port, const char *file_path,
+                            std::size_t window_size, mode_type mode,
+                            const transfer_options &options);
 
-template <mode_type mode> bool process_new_packet(const rtp_packet &packet, int fd);
+std::size_t handshake(int fd, handshake_extensions &extensions,
+                      const transfer_options &options, const char *file_path);
 
 template <mode_type mode>
-void receive_file(int fd, const char *file_path, std::size_t window_size,
-                  std::uint32_t start_seq_num);
+std::uint32_t receive_file(const char *file_path, std::size_t window_size,
+                           std::uint32_t start_seq_num, const transfer_options &options,
+                           const handshake_extensions &extensions);
+template <mode_type mode> void update_ack_timer(const receive_session<mode> &session);
 
 void terminate_connection(int fd, std::uint32_t fin_seq_num);
+void write_summary(const transfer_options &options);
 
 int main(int argc, char **argv)
 {
+    transfer_options options;
     try
     {
-        if (argc != 5)
+        if (argc < 5)
         {
             logs::error("参数错误. 你可以这样使用: ", argv[0],
-                        " [listen port] [file path] [window size] [mode]");
+                        " [listen port] [file path] [window size] [mode] "
+                        "[--option=value ...]\n"
+                        "[file path] 为 `-` 时写到标准输出; "
+                        "服务器模式 (`--server`) 下 [file path] 是输出目录");
             return EXIT_FAILURE;
         }
 
         const char *port{argv[1]}, *file_path{argv[2]};
 
         auto [window_size, mode]{parse_window_size_and_mode(argv[3], argv[4])};
+        options = parse_options(argc, argv, 5);
+        if (!options.log_file.empty())
+            logs::set_output_file(options.log_file.c_str());
 
         log_debug("端口: ", port);
         log_debug("文件路径: ", file_path);
         log_debug("窗口大小: ", window_size);
         log_debug("模式: ", mode);
+        log_debug("选项: ", options);
 
+        if (std::string_view{file_path} == "-")
+        {
+            if (options.server || options.stripes > 1)
+                logs::error("服务器模式与分条传输不能输出到标准输出");
+            if (options.stats == "-" || options.stats_snapshot == "-")
+                logs::error("输出到标准输出时统计不能也写到标准输出");
+        }
+        // GRO 把若干个包合并后一起交付, 先到的包因此确认得晚. 选择重传的逐包定时器
+        // 按单个包的往返时间设定, 会把这段等待误判为超时而重传.
+        if (options.gro && mode == mode_type::selective_repeat)
+        {
+            log_debug("选择重传模式下不使用 GRO");
+            options.gro = false;
+        }
+
+        if (pipe2(interrupt_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+            error_process::unix_error("`pipe2()` 错误: ");
         std::signal(SIGINT, terminal);
         std::signal(SIGTERM, terminal);
-        receiver_core_function(port, file_path, window_size, mode);
+        if (options.server)
+            serve(port, file_path, window_size, mode, options);
+        else if (options.stripes > 1)
+            receive_striped(port, file_path, window_size, mode, options);
+        else
+            receiver_core_function(port, file_path, window_size, mode, options);
 
+        write_summary(options);
         log_debug("Receiver: 正在退出");
         return 0;
     }
     catch (exceptions)
     {
+        write_summary(options);
         return EXIT_FAILURE;
     }
 }
 
-std::ofstream ofs;
-
-std::vector<rtp_packet> packets_vec;
-std::vector<std::uint8_t> ack_flags_vec;
+file_process::fd_wrapper socket_wrapper{-1};
 
-std::size_t remain_file_size;
+constexpr int RECEIVE_TIMER{0};
+std::unique_ptr<event_loop> loop;
 
-std::size_t window_size;
-std::size_t file_window;
+// 推迟发出的确认由 `ACK_TIMER` 到时发出
+constexpr int ACK_TIMER{1};
+bool ack_timer_armed{false};
 
-std::size_t window_left_seq_num;
-std::size_t window_right_seq_num;
-std::size_t fin_seq_num;
+// 握手完成后开始统计. 服务器模式与分条接收由各自的线程统计.
+std::unique_ptr<transfer_metrics> metrics;
+constexpr int STATS_TIMER{2};
+std::unique_ptr<stats_sink> snapshot_sink;
 
-file_process::fd_wrapper socket_wrapper{-1};
-file_process::fd_wrapper timer_wrapper{-1};
-file_process::fd_wrapper epoll_wrapper{-1};
+// 协商了续传时整个文件的核对结果, 在 FIN ACK 中告知发送端
+std::optional<bool> file_verified;
 
 void receiver_core_function(const char *port, const char *file_path,
-                            std::size_t window_size, mode_type mode)
+                            std::size_t window_size, mode_type mode,
+                            const transfer_options &options)
 {
     socket_wrapper.open(socket_process::open_receiver_socket(port));
 
-    timer_wrapper.open(timerfd_create(0, 0));
-
-    if (!timer_wrapper.is_valid())
-        error_process::unix_error("`timerfd_create()` 错误: ");
-    epoll_wrapper.open(epoll_create1(0));
-    if (!epoll_wrapper.is_valid())
-        error_process::unix_error("`epoll_create1()` 错误: ");
-
-    epoll_event ep_event_sock, ep_event_timer;
-    ep_event_sock.events = EPOLLIN;
-    ep_event_sock.data.fd = socket_wrapper.get_file_descriptor();
-    if (epoll_ctl(epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD,
-                  socket_wrapper.get_file_descriptor(), &ep_event_sock) == -1)
-        error_process::unix_error("`epoll_ctl()` 错误: ");
-
-    ep_event_timer.events = EPOLLIN;
-    ep_event_timer.data.fd = timer_wrapper.get_file_descriptor();
-    if (epoll_ctl(epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD,
-                  timer_wrapper.get_file_descriptor(), &ep_event_timer) == -1)
-        error_process::unix_error("`epoll_ctl()` 错误: ");
-
-    std::size_t start_seq_num{handshake(socket_wrapper.get_file_descriptor())};
+    handshake_extensions extensions;
+    std::uint32_t fin_seq_num{0};
+    std::size_t start_seq_num{
+        handshake(socket_wrapper.get_file_descriptor(), extensions, options, file_path)};
+    socket_process::set_no_recv_timeout(socket_wrapper.get_file_descriptor());
+    std::size_t payload_size{extensions.payload_size.value_or(PAYLOAD_MAX)};
+    if (payload_size > PAYLOAD_MAX)
+        socket_process::enlarge_buffers(socket_wrapper.get_file_descriptor(),
+                                        window_size * (sizeof(rtp_header) + payload_size));
+    loop = make_event_loop(socket_wrapper.get_file_descriptor(), options, payload_size);
+    metrics = std::make_unique<transfer_metrics>();
+    if (!options.stats_snapshot.empty())
+    {
+        snapshot_sink = std::make_unique<stats_sink>(options.stats_snapshot);
+        loop->start_timer(STATS_TIMER, static_cast<std::int64_t>(options.stats_interval_ms));
+    }
 
     switch (mode)
     {
     case mode_type::go_back_n:
-        receive_file<mode_type::go_back_n>(socket_wrapper.get_file_descriptor(),
-                                           file_path, window_size, start_seq_num);
+        fin_seq_num = receive_file<mode_type::go_back_n>(file_path, window_size, start_seq_num,
+                                                         options, extensions);
         break;
     case mode_type::selective_repeat:
-        receive_file<mode_type::selective_repeat>(socket_wrapper.get_file_descriptor(),
-                                                  file_path, window_size, start_seq_num);
+        fin_seq_num = receive_file<mode_type::selective_repeat>(
+            file_path, window_size, start_seq_num, options, extensions);
         break;
     case mode_type::unknown:
         logs::error("未知的模式");
         break;
     }
+    metrics->stop();
+    loop.reset();
     terminate_connection(socket_wrapper.get_file_descriptor(), fin_seq_num);
+    if (file_verified && !*file_verified)
+        logs::error("整个文件的校验和与发送端的不符, 已删除续传日志, 请重新传输");
 }
 
-std::size_t handshake(int fd)
+std::size_t handshake(int fd, handshake_extensions &extensions,
+                      const transfer_options &options, const char *file_path)
 {
     std::uint32_t seq_num{0};
-    rtp_header header_buffer;
+    // 探测路径 MTU 的 SYN 填充到了数据包的长度
+    packet_pool syn_buffer{PAYLOAD_LIMIT, 1};
+    packet_view header_buffer{syn_buffer[0]};
     {
         int times{0};
         sockaddr src_addr;
         socklen_t addrlen{16};
         for (times = 1; times <= 50; times++)
         {
-            if (recvfrom(fd, &header_buffer, sizeof(rtp_header), 0, &src_addr,
-                         &addrlen) == -1 &&
-                (errno == EAGAIN || errno == EWOULDBLOCK))
+            ssize_t n_bytes{recvfrom(fd, header_buffer.data(), sizeof(rtp_header) + PAYLOAD_LIMIT, 0,
+                                     &src_addr, &addrlen)};
+            if (n_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
             {
                 log_debug("接收失败. 当前尝试次数: ", times);
                 continue;
             }
 
-            log_debug(RECV_HEADER_LOG, header_buffer);
+            log_debug(RECV_HEADER_LOG, header_buffer.header());
 
-            if (header_buffer.is_valid() && header_buffer.get_flag() == SYN)
+            // SYN 的负载是握手扩展
+            if (n_bytes >= static_cast<ssize_t>(sizeof(rtp_header)) &&
+                static_cast<std::size_t>(n_bytes) >=
+                    sizeof(rtp_header) + header_buffer.get_length() &&
+                header_buffer.is_valid() && header_buffer.get_flag() == SYN)
             {
                 seq_num = header_buffer.get_seq_num();
+                extensions =
+                    decode_extensions(header_buffer.get_buf(), header_buffer.get_length());
+                log_debug("握手扩展: ", extensions);
                 if (connect(fd, &src_addr, addrlen) == -1)
                     error_process::unix_error("`connect()` 错误: ");
                 log_debug("包合法. 成功建立连接. 发送 SYN ACK");
@@ -156,174 +221,137 @@ std::size_t handshake(int fd)
         if (times > 50)
             logs::error("握手达到最大尝试次数");
     }
-    send_and_wait_header(50, fd, {seq_num + 1, 0, SYN | ACK}, {seq_num + 1, 0, ACK});
-    return seq_num + 1;
-}
-
-template <>
-bool process_new_packet<mode_type::selective_repeat>(const rtp_packet &packet, int fd)
-{
-    if (packet.get_length() == 0 && packet.get_flag() == FIN &&
-        packet.get_seq_num() == fin_seq_num + 1)
-    {
-        log_debug("收到 FIN");
-        fin_seq_num = packet.get_seq_num();
-        return true;
-    }
-
-    if (packet.get_flag() != 0)
-        return false;
-
-    std::uint32_t seq_num{packet.get_seq_num()};
-    std::size_t index{seq_num % window_size};
-    if (seq_num >= window_right_seq_num)
-    {
-        log_debug("收到的 `seq_num` ", seq_num, " 大于窗口右边界 ", window_right_seq_num);
-        return false;
-    }
-    if (seq_num < window_left_seq_num || ack_flags_vec[index])
-    {
-        if (rtp_header(seq_num, 0, ACK).send(fd) == -1)
-            error_process::unix_error("发送包时出现了问题");
-        return false;
-    }
-
-    ack_flags_vec[index] = true;
-    packets_vec[index] = packet;
-    if (fin_seq_num < packet.get_seq_num())
-        fin_seq_num = packet.get_seq_num();
-    if (rtp_header(seq_num, 0, ACK).send(fd) == -1)
-        error_process::unix_error("发送包时出现了问题");
-    log_debug("ACK ", seq_num);
-
-    if (seq_num != window_left_seq_num)
-        return false;
-
-    std::size_t _1st_nack_pkt;
-    for (_1st_nack_pkt = window_left_seq_num; _1st_nack_pkt < window_right_seq_num;
-         _1st_nack_pkt++)
+    rto_estimator rto{std::chrono::milliseconds{options.rto_min_ms},
+                      std::chrono::milliseconds{options.rto_max_ms}};
+    // 回应同意的扩展. 没有时负载为空, 与原协议的 SYN ACK 完全相同
+    handshake_extensions accepted{
+        accept_extensions(extensions, receiver_payload_limit(fd, options))};
+    // 之后按协商的负载长度与分组接收
+    extensions.payload_size = accepted.payload_size;
+    extensions.fec = accepted.fec;
+    // 续传时从日志记录的已写入部分之后开始, 按数据包的负载长度向下取整
+    if (extensions.resume && !file_process::is_stream(file_path))
     {
-        std::size_t index{_1st_nack_pkt % window_size};
-
-        if (!ack_flags_vec[index])
-            break;
-
-        ack_flags_vec[index] = false;
-        ofs.write(packets_vec[index].get_buf(), packets_vec[index].get_length());
+        std::size_t payload_size{accepted.payload_size.value_or(PAYLOAD_MAX) -
+                                 (accepted.fec ? fec::OVERHEAD : 0)};
+        std::uint64_t committed{journal::committed_bytes(file_path, *extensions.resume)};
+        accepted.resume_offset = committed / payload_size * payload_size;
     }
-
-    std::size_t difference{_1st_nack_pkt - window_left_seq_num};
-    window_left_seq_num += difference;
-    window_right_seq_num += difference;
-
-    log_debug("窗口变为 ", window_left_seq_num, ' ', window_right_seq_num);
-    return false;
+    else if (extensions.resume)
+        log_debug("输出不是普通文件, 不能续传");
+    extensions.resume_offset = accepted.resume_offset;
+    rtp_packet syn_ack;
+    syn_ack.make_packet(seq_num + 1, encode_extensions(accepted, syn_ack.get_buf()), SYN | ACK);
+    send_and_wait_header(50, fd, syn_ack, {seq_num + 1, 0, ACK}, rto);
+    return seq_num + 1;
 }
 
-template <>
-bool process_new_packet<mode_type::go_back_n>(const rtp_packet &packet, int fd)
+// 按会话给出的最晚确认时间设定 `ACK_TIMER`. 确认已经发出时停止它.
+template <mode_type mode> void update_ack_timer(const receive_session<mode> &session)
 {
-    if (packet.get_length() == 0 && packet.get_flag() == FIN &&
-        packet.get_seq_num() == fin_seq_num + 1)
-    {
-        log_debug("收到 FIN");
-        fin_seq_num = packet.get_seq_num();
-        return true;
-    }
-
-    if (packet.get_flag() != 0)
-        return false;
-
-    std::uint32_t seq_num{packet.get_seq_num()};
-    std::size_t index{seq_num % window_size};
-    if (seq_num >= window_right_seq_num)
-    {
-        log_debug("收到的 `seq_num` ", seq_num, " 大于窗口右边界 ", window_right_seq_num);
-        return false;
-    }
-    if (seq_num < window_left_seq_num || ack_flags_vec[index])
+    const auto &deadline{session.ack_deadline()};
+    if (!deadline)
     {
-        if (rtp_header(window_left_seq_num, 0, ACK).send(fd) == -1)
-            error_process::unix_error("发送包时出现了问题");
-        return false;
-    }
-
-    ack_flags_vec[index] = true;
-    packets_vec[index] = packet;
-    if (fin_seq_num < packet.get_seq_num())
-        fin_seq_num = packet.get_seq_num();
-
-    log_debug("ACK ", seq_num);
-
-    if (seq_num != window_left_seq_num)
-        return false;
-
-    std::size_t _1st_nack_pkt;
-    for (_1st_nack_pkt = window_left_seq_num; _1st_nack_pkt < window_right_seq_num;
-         _1st_nack_pkt++)
-    {
-        std::size_t index{_1st_nack_pkt % window_size};
-
-        if (!ack_flags_vec[index])
-            break;
-
-        ack_flags_vec[index] = false;
-        ofs.write(packets_vec[index].get_buf(), packets_vec[index].get_length());
+        if (ack_timer_armed)
+        {
+            loop->stop_timer(ACK_TIMER);
+            ack_timer_armed = false;
+        }
+        return;
     }
-
-    std::size_t difference{_1st_nack_pkt - window_left_seq_num};
-    window_left_seq_num += difference;
-    window_right_seq_num += difference;
-
-    log_debug("窗口变为 ", window_left_seq_num, ' ', window_right_seq_num);
-
-    if (rtp_header(window_left_seq_num, 0, ACK).send(fd) == -1)
-        error_process::unix_error("发送包时出现了问题");
-    return false;
+    if (ack_timer_armed)
+        return;
+    auto now{receive_session<mode>::clock::now()};
+    auto delay{*deadline > now ? std::chrono::ceil<std::chrono::microseconds>(*deadline - now)
+                               : std::chrono::microseconds{1}};
+    loop->start_timer(ACK_TIMER, delay);
+    ack_timer_armed = true;
 }
 
 template <mode_type mode>
-void receive_file(int fd, const char *file_path, std::size_t window_size,
-                  std::uint32_t start_seq_num)
+std::uint32_t receive_file(const char *file_path, std::size_t window_size,
+                           std::uint32_t start_seq_num, const transfer_options &options,
+                           const handshake_extensions &extensions)
 {
-    ofs.open(file_path, std::ios::binary | std::ios::trunc);
-    if (ofs.fail())
-        logs::error("打开文件 `", file_path, "` 时出现了问题");
-
-    ::window_size = window_size;
-    packets_vec.resize(window_size);
-    ack_flags_vec.resize(window_size, false);
-    window_left_seq_num = start_seq_num;
-    window_right_seq_num = window_left_seq_num + window_size;
-
-    epoll_event ep_event{EPOLLIN};
-
-    rtp_packet packet_buf;
+    receive_session<mode> session{*loop,       *metrics,      file_path, window_size,
+                                  start_seq_num, options, extensions};
 
     log_debug("开始接收文件");
-    start_timer(timer_wrapper.get_file_descriptor(), 5000);
-    socket_process::set_no_recv_timeout(fd);
+    loop->start_timer(RECEIVE_TIMER, 5000);
+    loop->watch_readable(interrupt_pipe[0]);
+    receiving = 1;
     while (true)
     {
-        if (epoll_wait(epoll_wrapper.get_file_descriptor(), &ep_event, 1, -1) == -1)
-            error_process::unix_error("`epoll_wait()` 错误: ");
-        if (ep_event.data.fd != fd)
-            logs::error("接收数据超时");
-        else
+        loop->wait();
+        if (interrupted)
+            logs::error("收到信号, 停止接收");
+        metrics->sample(transfer_metrics::clock::now());
+        if (snapshot_sink && loop->is_expired(STATS_TIMER))
         {
-            if (recv(fd, &packet_buf, sizeof(rtp_packet), 0) == -1)
-                error_process::unix_error("接收包时发生了问题: ");
-            if (packet_buf.is_valid())
+            write_stats(*snapshot_sink, *metrics, "receiver");
+            loop->start_timer(STATS_TIMER, static_cast<std::int64_t>(options.stats_interval_ms));
+        }
+        if (loop->is_expired(ACK_TIMER))
+        {
+            ack_timer_armed = false;
+            session.push_pending_ack(receive_session<mode>::clock::now());
+            update_ack_timer(session);
+        }
+        if (loop->size() == 0)
+        {
+            if (loop->is_expired(RECEIVE_TIMER))
+                logs::error("接收数据超时");
+            continue;
+        }
+        for (std::size_t i{0}; i < loop->size(); i++)
+        {
+            packet_view packet_buf{(*loop)[i]};
+            if (loop->length(i) < sizeof(rtp_header) + packet_buf.get_length() ||
+                !packet_buf.is_valid())
             {
-                if (process_new_packet<mode>(packet_buf, fd))
-                    break;
+                metrics->add(counter::checksum_failures);
+                continue;
+            }
+            if (session.process(i))
+            {
+                // 发出已加入的 ACK, 并确保所有包都已写入文件
+                session.finish();
+                loop->drain();
+                file_verified = session.verify_file();
+                receiving = 0;
+                return session.fin_seq_num();
             }
-            start_timer(timer_wrapper.get_file_descriptor(), 5000);
         }
+        session.push_pending_ack(receive_session<mode>::clock::now());
+        update_ack_timer(session);
+        loop->start_timer(RECEIVE_TIMER, 5000);
+    }
+}
+
+// 单个接收端的统计; 握手之前就失败时没有统计
+void write_summary(const transfer_options &options)
+{
+    if (options.stats.empty() || !metrics)
+        return;
+    try
+    {
+        stats_sink sink{options.stats};
+        write_stats(sink, *metrics, "receiver");
+    }
+    catch (exceptions)
+    {
     }
 }
 
 void terminate_connection(int fd, std::uint32_t fin_seq_num)
 {
-    send_and_wait<2>(50, fd, {fin_seq_num, 0, FIN | ACK});
+    rtp_packet fin_ack;
+    std::uint16_t length{0};
+    if (file_verified)
+    {
+        fin_ack.get_buf()[0] = *file_verified ? 1 : 0;
+        length = 1;
+    }
+    fin_ack.make_packet(fin_seq_num, length, FIN | ACK);
+    send_and_wait<2>(50, fd, fin_ack);
 }
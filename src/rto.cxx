@@ -0,0 +1,50 @@
+#include "rto.hxx"
+#include <algorithm>
+
+// 定时器的精度
+constexpr rto_estimator::duration CLOCK_GRANULARITY{1000};
+
+rto_estimator::rto_estimator(duration min, duration max)
+    : m_min{min}, m_max{max}, m_rto{std::clamp(INITIAL_RTO, min, max)}
+{
+}
+
+static rto_estimator::duration compute_rto(rto_estimator::duration srtt,
+                                           rto_estimator::duration rttvar,
+                                           rto_estimator::duration min,
+                                           rto_estimator::duration max)
+{
+    return std::clamp(srtt + std::max(CLOCK_GRANULARITY, 4 * rttvar), min, max);
+}
+
+void rto_estimator::sample(clock::duration rtt)
+{
+    auto r{std::chrono::duration_cast<duration>(rtt)};
+    if (!m_has_sample)
+    {
+        m_srtt = r;
+        m_rttvar = r / 2;
+        m_has_sample = true;
+    }
+    else
+    {
+        duration delta{m_srtt > r ? m_srtt - r : r - m_srtt};
+        m_rttvar = (3 * m_rttvar + delta) / 4;
+        m_srtt = (7 * m_srtt + r) / 8;
+    }
+    m_rto = compute_rto(m_srtt, m_rttvar, m_min, m_max);
+}
+
+void rto_estimator::backoff() { m_rto = std::min(2 * m_rto, m_max); }
+
+void rto_estimator::reset_backoff()
+{
+    m_rto = m_has_sample ? compute_rto(m_srtt, m_rttvar, m_min, m_max)
+                         : std::clamp(INITIAL_RTO, m_min, m_max);
+}
+
+rto_estimator::duration rto_estimator::timeout() const { return m_rto; }
+
+std::int64_t rto_estimator::timeout_ms() const { return (m_rto.count() + 999) / 1000; }
+
+rto_estimator::duration rto_estimator::srtt() const { return m_srtt; }
@@ -0,0 +1,42 @@
+#ifndef RTO_HXX
+#define RTO_HXX
+
+#include <chrono>
+#include <cstdint>
+
+// 按 RFC 6298 由往返时间样本估计重传超时 (RTO).
+// 调用者按 Karn 算法只用没有重传过的包采样.
+class rto_estimator
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using duration = std::chrono::microseconds;
+
+    // 还没有样本时使用的超时, 与原先写死的 100 ms 相同
+    static constexpr duration INITIAL_RTO{100'000};
+
+private:
+    duration m_min;
+    duration m_max;
+    duration m_srtt{0};
+    duration m_rttvar{0};
+    duration m_rto{INITIAL_RTO};
+    bool m_has_sample{false};
+
+public:
+    rto_estimator(duration min, duration max);
+
+    void sample(clock::duration rtt);
+    // 超时后退避: RTO 加倍, 直到收到新的样本或新的数据被确认
+    void backoff();
+    // 新的数据被确认, 说明路径恢复: 撤销退避. 回退 N 重传后很久取不到样本,
+    // 不这样做 RTO 会一路加倍到上限.
+    void reset_backoff();
+
+    duration timeout() const;
+    // 向上取整到毫秒, 供定时器使用
+    std::int64_t timeout_ms() const;
+    duration srtt() const;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #include "tools.hxx"
 #include <bit>
 #include <cassert>
+#include <cerrno>
 #include <cstdint>
 #include <cstring>
 #include <ios>
@@ -16,10 +17,18 @@ static_assert(sizeof(rtp_packet) == 1472);
 rtp_header::rtp_header(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag)
     : m_seq_num{seq_num}, m_length{length}, m_checksum{0}, m_flag{flag}
 {
-    assert(length <= PAYLOAD_MAX);
+    assert(length <= PAYLOAD_LIMIT);
     m_checksum = compute_checksum(this, sizeof(rtp_header));
 }
 
+rtp_header::rtp_header(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag,
+                       const void *payload)
+    : m_seq_num{seq_num}, m_length{length}, m_checksum{0}, m_flag{flag}
+{
+    assert(length <= PAYLOAD_LIMIT);
+    m_checksum = compute_checksum(this, sizeof(rtp_header), payload, length);
+}
+
 [[nodiscard]] ssize_t rtp_header::send(int fd) const
 {
     return ::send(fd, this, sizeof(rtp_header) + m_length, 0);
@@ -28,24 +37,29 @@ rtp_header::rtp_header(std::uint32_t seq_num, std::uint16_t length, std::uint8_t
 [[nodiscard]] ssize_t rtp_header::recv(int fd)
 {
     std::memset(this, 0, sizeof(rtp_header));
-    return ::recv(fd, this, sizeof(rtp_header), 0);
+    // 关闭 io_uring 后内核可能以任务工作打断下一次阻塞调用, 此时重新接收即可
+    ssize_t n_bytes;
+    do
+        n_bytes = ::recv(fd, this, sizeof(rtp_header), 0);
+    while (n_bytes == -1 && errno == EINTR);
+    return n_bytes;
 }
 
-bool rtp_header::is_valid() const
+// 校验和按清零了校验和字段的包头计算, 所以在副本上清零, 不改动缓冲区
+bool rtp_header::is_valid(const void *payload) const
 {
-    if (m_length > PAYLOAD_MAX)
+    if (m_length > PAYLOAD_LIMIT)
         return false;
 
-    if (m_flag & ~(SYN | ACK | FIN))
+    if (m_flag & ~(SYN | ACK | FIN | COMPRESSED | PARITY))
         return false;
 
-    std::uint32_t original_checksum{m_checksum};
-    m_checksum = 0;
-    std::uint32_t new_checksum{compute_checksum(this, sizeof(rtp_header) + m_length)};
-    m_checksum = original_checksum;
-    if (new_checksum != original_checksum)
+    rtp_header zeroed{*this};
+    zeroed.m_checksum = 0;
+    std::uint32_t new_checksum{compute_checksum(&zeroed, sizeof(rtp_header), payload, m_length)};
+    if (new_checksum != m_checksum)
     {
-        log_debug("错误的校验和", original_checksum, ' ', new_checksum);
+        log_debug("错误的校验和", m_checksum, ' ', new_checksum);
         return false;
     }
 
@@ -61,11 +75,25 @@ rtp_packet::rtp_packet(std::uint32_t seq_num, std::uint16_t length, std::uint8_t
 {
 }
 
+[[nodiscard]] ssize_t rtp_packet::recv(int fd)
+{
+    std::memset(this, 0, sizeof(rtp_header));
+    ssize_t n_bytes;
+    do
+        n_bytes = ::recv(fd, this, sizeof(rtp_packet), 0);
+    while (n_bytes == -1 && errno == EINTR);
+    return n_bytes;
+}
+
+bool rtp_packet::is_valid() const { return rtp_header::is_valid(m_payload); }
+
 char *rtp_packet::get_buf() { return m_payload; }
+const char *rtp_packet::get_buf() const { return m_payload; }
 
 void rtp_packet::make_packet(std::uint32_t seq_num, std::uint16_t length,
                              std::uint8_t flag)
 {
+    assert(length <= PAYLOAD_MAX);
     m_seq_num = seq_num;
     m_length = length;
     m_flag = flag;
@@ -73,6 +101,14 @@ void rtp_packet::make_packet(std::uint32_t seq_num, std::uint16_t length,
     m_checksum = compute_checksum(this, sizeof(rtp_header) + m_length);
 }
 
+bool packet_view::is_valid() const { return header().is_valid(get_buf()); }
+
+void packet_view::make_packet(std::uint32_t seq_num, std::uint16_t length,
+                              std::uint8_t flag) const
+{
+    header() = rtp_header{seq_num, length, flag, get_buf()};
+}
+
 std::ostream &operator<<(std::ostream &os, const rtp_header &rh)
 {
     std::ios_base::fmtflags f{os.flags()};
@@ -87,5 +123,9 @@ std::ostream &operator<<(std::ostream &os, const rtp_header &rh)
         os << " ACK";
     if (rh.m_flag & FIN)
         os << " FIN";
+    if (rh.m_flag & COMPRESSED)
+        os << " COMPRESSED";
+    if (rh.m_flag & PARITY)
+        os << " PARITY";
     return os;
 }
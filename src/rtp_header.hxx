@@ -7,12 +7,26 @@
 #include <ostream>
 #include <sys/types.h>
 
+// 1500 字节的 MTU 下的最大负载, 也是没有协商负载长度时的负载长度
 constexpr std::size_t PAYLOAD_MAX{1461};
 
+// 两端都用 64 位的序号计数, 包头中只有低 32 位. 由包头中的 `seq_num` 还原离
+// `reference` (例如窗口左端) 最近的 64 位序号; 窗口远小于 2^31, 所以还原是唯一的,
+// 超过 2^32 个包的传输也不会因回绕出错.
+inline std::size_t unwrap_seq_num(std::uint32_t seq_num, std::size_t reference)
+{
+    auto distance{static_cast<std::int32_t>(seq_num - static_cast<std::uint32_t>(reference))};
+    return reference + static_cast<std::size_t>(static_cast<std::int64_t>(distance));
+}
+
 // flags in the rtp header
 constexpr std::uint8_t SYN{0b0001};
 constexpr std::uint8_t ACK{0b0010};
 constexpr std::uint8_t FIN{0b0100};
+// 数据包的负载经过压缩 (见 `compression.hxx`), 只在握手时协商了压缩后使用
+constexpr std::uint8_t COMPRESSED{0b1000};
+// 前向纠错的校验包 (见 `fec.hxx`), 只在握手时协商了 FEC 后使用
+constexpr std::uint8_t PARITY{0b10000};
 
 class [[gnu::packed]] rtp_header
 {
@@ -24,11 +38,15 @@ protected:
 
 public:
     rtp_header(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag);
+    // 负载不紧跟在包头之后时使用, 校验和覆盖包头与 `payload` 的前 `length` 字节
+    rtp_header(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag,
+               const void *payload);
     rtp_header() = default;
     friend std::ostream &operator<<(std::ostream &, const rtp_header &);
     [[nodiscard]] ssize_t send(int fd) const;
     [[nodiscard]] ssize_t recv(int fd);
-    bool is_valid() const;
+    // 长度、标志与校验和都正确. 负载位于 `payload`.
+    bool is_valid(const void *payload) const;
 
     std::uint32_t get_seq_num() const;
     std::uint16_t get_length() const;
@@ -37,6 +55,8 @@ public:
     friend auto operator<=>(const rtp_header &lhs, const rtp_header &rhs) = default;
 };
 
+// 负载最多 `PAYLOAD_MAX` 字节的包, 用于握手、ACK 等长度固定的包. 按协商的负载长度
+// 分配的缓冲区 (`packet_pool`、接收缓冲区) 中的包可能更长, 通过 `packet_view` 访问.
 class [[gnu::packed]] rtp_packet : public rtp_header
 {
 private:
@@ -44,11 +64,46 @@ private:
 public:
     rtp_packet(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag);
 
+    bool is_valid() const;
     char *get_buf();
+    const char *get_buf() const;
 
     void make_packet(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag);
+    // 接收整个报文, 包括负载
+    [[nodiscard]] ssize_t recv(int fd);
 
     rtp_packet() = default;
 };
 
+// 缓冲区中的一个包: 包头之后紧跟负载, 负载的长度只受缓冲区限制. 负载经由缓冲区本身的
+// `char *` 访问, 不越过 `rtp_packet` 的定长数组. 视图不持有缓冲区, 复制视图不复制包.
+// 逐包的处理 (校验和、FEC、复制) 都按运行期的实际长度进行, 不为常见的负载长度做
+// 编译期特化: 以常量长度实现的 FEC 编码循环实测与现在的版本没有差别.
+class packet_view
+{
+private:
+    char *m_data;
+
+public:
+    explicit packet_view(char *data) : m_data{data} {}
+    packet_view(rtp_packet &packet) : m_data{reinterpret_cast<char *>(&packet)} {}
+
+    rtp_header &header() const { return *reinterpret_cast<rtp_header *>(m_data); }
+    operator rtp_header &() const { return header(); }
+    // 包的起点, 即包头所在的位置
+    char *data() const { return m_data; }
+    char *get_buf() const { return m_data + sizeof(rtp_header); }
+
+    std::uint32_t get_seq_num() const { return header().get_seq_num(); }
+    std::uint16_t get_length() const { return header().get_length(); }
+    std::uint8_t get_flag() const { return header().get_flag(); }
+    bool is_valid() const;
+
+    // 负载已在 `get_buf()` 处, 写入包头并计算校验和
+    void make_packet(std::uint32_t seq_num, std::uint16_t length, std::uint8_t flag) const;
+};
+
+// 一个 UDP 报文 (IPv4) 能容纳的最大负载
+constexpr std::size_t PAYLOAD_LIMIT{65507 - sizeof(rtp_header)};
+
 #endif // RTP_HEAD_HXX
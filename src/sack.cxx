@@ -0,0 +1,25 @@
+#include "sack.hxx"
+#include <cstring>
+
+namespace sack
+{
+    std::uint16_t encode(const std::vector<std::uint8_t> &ack_flags_vec, std::size_t left,
+                         std::size_t right, char *buf)
+    {
+        std::size_t window_size{ack_flags_vec.size()};
+        std::size_t n_bits{right - left - 1};
+        if (n_bits > PAYLOAD_MAX * 8)
+            n_bits = PAYLOAD_MAX * 8;
+
+        std::memset(buf, 0, (n_bits + 7) / 8);
+        std::uint16_t length{0};
+        for (std::size_t i{0}; i < n_bits; i++)
+        {
+            if (!ack_flags_vec[(left + 1 + i) % window_size])
+                continue;
+            buf[i / 8] = static_cast<char>(buf[i / 8] | 1 << (i % 8));
+            length = static_cast<std::uint16_t>(i / 8 + 1);
+        }
+        return length;
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef SACK_HXX
+#define SACK_HXX
+
+#include "rtp_header.hxx"
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// 选择确认 (SACK), 需要在握手时协商. 协商后 ACK 的 `seq_num` 总是累计确认点,
+// 即接收端下一个期望的包, 在它之前的包都已收到. 负载是位图: 第 i 位 (第 i / 8 字节的
+// 第 i % 8 位) 表示 `seq_num + 1 + i` 已收到. 末尾全为 0 的字节不发送, 因此按序到达时
+// ACK 仍然只有包头.
+namespace sack
+{
+    // 由接收窗口 [left, right) 的确认标志编码位图, 返回字节数. 只编码窗口中
+    // 前 `PAYLOAD_MAX * 8` 个包.
+    std::uint16_t encode(const std::vector<std::uint8_t> &ack_flags_vec, std::size_t left,
+                         std::size_t right, char *buf);
+
+    // 对位图中每个已收到的包调用 `f(seq_num)`. `ack_seq_num` 是还原成 64 位的累计确认点.
+    template <typename F> void for_each(packet_view ack, std::size_t ack_seq_num, F f)
+    {
+        const char *buf{ack.get_buf()};
+        std::size_t base{ack_seq_num + 1};
+        for (std::size_t byte{0}; byte < ack.get_length(); byte++)
+        {
+            auto bits{static_cast<std::uint8_t>(buf[byte])};
+            while (bits != 0)
+            {
+                f(base + byte * 8 + std::countr_zero(bits));
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+#endif
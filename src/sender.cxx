@@ -1,8 +1,22 @@
+#include "compression.hxx"
+#include "congestion.hxx"
 #include "error_process.hxx"
+#include "event_loop.hxx"
+#include "extension.hxx"
+#include "fec.hxx"
 #include "file_process.hxx"
+#include "journal.hxx"
+#include "metrics.hxx"
+#include "options.hxx"
+#include "pacer.hxx"
+#include "packet_pool.hxx"
 #include "rtp_header.hxx"
+#include "sack.hxx"
 #include "socket_process.hxx"
+#include "timing_wheel.hxx"
 #include "tools.hxx"
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <cstddef>
 #include <cstdint>
@@ -12,207 +26,623 @@
 #include <filesystem>
 #include <fstream>
 #include <limits>
+#include <memory>
+#include <optional>
 #include <random>
-#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <vector>
 
 [[noreturn]] void terminal(int err_num) { std::exit(EXIT_FAILURE); }
 
 void sender_core_function(const char *hose_name, const char *port, const char *file_path,
-                          std::size_t window_size, mode_type mode);
-void handshake(int fd, std::uint32_t seq_num);
+                          std::size_t window_size, mode_type mode,
+                          const transfer_options &options);
+void send_striped(const char *host_name, const char *port, const char *file_path,
+                  std::size_t window_size, mode_type mode, const transfer_options &options);
+std::size_t requested_payload_size(int fd, const transfer_options &options);
+handshake_extensions handshake(int fd, std::uint32_t seq_num,
+                               const handshake_extensions &extensions, bool probe);
 void terminate_connection(int fd, std::uint32_t fin_seq_num);
 
 template <mode_type mode>
-void send_file(int fd, const char *file_path, std::size_t window_size,
-               std::uint32_t start_seq_num);
+void send_file(const char *file_path, std::size_t window_size, std::uint32_t start_seq_num,
+               const transfer_options &options);
 
-template <mode_type mode> void resend(int fd);
+void resend();
+void fast_retransmit();
+void resend_expired(int &attempt_times, bool window_moved);
+void arm_retransmit_timer(timing_wheel::clock::time_point deadline);
 
-template <mode_type mode> [[nodiscard]] bool process_ack(std::uint32_t seq_num);
+template <mode_type mode> [[nodiscard]] bool process_ack(std::size_t seq_num);
+template <mode_type mode> [[nodiscard]] bool process_sack(packet_view ack);
 
-void send_window(int fd);
+void send_window();
+bool fill_from_stream(std::size_t seq_num);
+void keep_alive();
+void update_pacing_rate();
+void wait_for_tokens(pacer::clock::time_point now);
+
+void make_data_packet(std::size_t seq_num, std::size_t payload_size);
+void push_packet(std::size_t seq_num);
+void push_parity(std::size_t seq_num, pacer::clock::time_point now);
+void flush_parity(std::size_t end_seq_num, pacer::clock::time_point now);
+std::optional<rto_estimator::clock::duration> sample_rtt(std::size_t seq_num);
+
+void write_summary(const transfer_options &options);
 
 int main(int argc, char **argv)
 {
+    transfer_options options;
     try
     {
         std::ios::sync_with_stdio(false);
-        if (argc != 6)
-            logs::error(
-                "参数错误. 你可以这样使用: ", argv[0],
-                " [receiver ip] [receiver port] [file path] [window size] [mode]");
+        if (argc < 6)
+            logs::error("参数错误. 你可以这样使用: ", argv[0],
+                        " [receiver ip] [receiver port] [file path] [window size] [mode] "
+                        "[--option=value ...]\n"
+                        "[file path] 为 `-` 或管道时从中读到结尾, 大小不必事先知道");
 
         const char *host_name{argv[1]}, *port{argv[2]}, *file_path{argv[3]};
 
         auto [window_size, mode]{parse_window_size_and_mode(argv[4], argv[5])};
+        options = parse_options(argc, argv, 6);
+        if (!options.log_file.empty())
+            logs::set_output_file(options.log_file.c_str());
 
         log_debug("接收端地址: ", host_name);
         log_debug("接收端端口: ", port);
         log_debug("文件路径: ", file_path);
         log_debug("窗口大小: ", window_size);
         log_debug("模式: ", mode);
+        log_debug("选项: ", options);
+
+        if (file_process::is_stream(file_path) && (options.mmap || options.stripes > 1))
+            logs::error("流式发送 (标准输入、管道等) 不能使用 `--mmap` 与 `--stripes`");
 
         std::signal(SIGINT, terminal);
         std::signal(SIGTERM, terminal);
-        sender_core_function(host_name, port, file_path, window_size, mode);
+        if (options.stripes > 1)
+            send_striped(host_name, port, file_path, window_size, mode, options);
+        else
+            sender_core_function(host_name, port, file_path, window_size, mode, options);
 
+        write_summary(options);
         log_debug("Sender: 退出");
         return 0;
     }
     catch (exceptions)
     {
+        write_summary(options);
         return EXIT_FAILURE;
     }
 }
 
 std::ifstream ifs;
+std::unique_ptr<file_process::mapped_file> mapped_file;
 
-std::vector<rtp_packet> packets_vec;
+// 流式发送: 输入是标准输入 (`-`) 或管道等, 大小事先未知. 除最后一个包外每个包都是满的,
+// 接收端因此仍可按序号计算偏移. 读完之前 `n_need_ack_window` 与 `transfer_bytes` 都只是上限.
+bool streaming{false};
+std::unique_ptr<file_process::stream_input> stream;
+bool stream_finished;
+// 正在读入的包已读到的字节数, 以及已读入的总字节数
+std::size_t stream_filled;
+std::size_t stream_bytes;
+// 没有在途的包时, 定期发一个旧序号的空包, 接收端回应重复 ACK, 以免等输入时接收端超时
+constexpr int KEEPALIVE_TIMER{3};
+constexpr std::int64_t KEEPALIVE_INTERVAL_MS{1000};
+
+// 读文件时每个窗口槽位保存整个包, 以窗口下标为句柄; 映射文件时只保存包头, 负载留在映射中
+std::unique_ptr<packet_pool> packets_vec;
+std::vector<rtp_header> headers_vec;
 std::vector<std::uint8_t> ack_flags_vec;
+// 每个窗口槽位最近一次发送的时间, 以及是否重传过 (重传过的包不用于采样)
+std::vector<rto_estimator::clock::time_point> send_times_vec;
+std::vector<std::uint8_t> retransmitted_flags_vec;
 
 std::size_t remain_file_size;
+// 分条发送时本进程负责的一段: 从 `stripe_offset` 开始的 `stripe_length` 字节.
+// 续传时是接收端还没有的部分; 不分条也不续传时是整个文件.
+std::size_t stripe_offset{0};
+std::optional<std::size_t> stripe_length;
+// 协商了续传时整个文件的校验和: 接收端已有的部分在开始时算出, 其余的包第一次发送时
+// 依次加入. 随 FIN 发出, 由接收端核对.
+std::optional<std::uint32_t> file_checksum;
 std::size_t n_need_ack_window;
+// 握手时协商的负载长度, 除最后一个包外每个包都是满的
+std::size_t full_payload_size{PAYLOAD_MAX};
 
 std::size_t window_size;
 std::size_t file_window;
 
 std::size_t window_left_seq_num;
 std::size_t window_right_seq_num;
+// 下一个要发送的包. 回退 N 超时后退回窗口左端, 已读入的包按拥塞窗口依次重发.
 std::size_t window_left_unsent_seq_num;
+// 已从文件读入窗口的包的右边界
+std::size_t window_filled_seq_num;
+std::size_t file_start_seq_num;
+
+// 映射中已预读到的位置与已释放到的位置
+std::size_t prefetched_offset;
+std::size_t released_offset;
 
 file_process::fd_wrapper socket_wrapper{-1};
-file_process::fd_wrapper timer_wrapper{-1};
-file_process::fd_wrapper epoll_wrapper{-1};
+
+constexpr int RETRANSMIT_TIMER{0};
+std::unique_ptr<event_loop> loop;
+std::unique_ptr<rto_estimator> rto;
+std::unique_ptr<congestion_control> congestion;
+// 握手时协商了选择确认, 之后的 ACK 都按 `sack.hxx` 中的格式解释
+bool sack_enabled{false};
+// 握手时协商了压缩, 每个包的负载压缩后更短时发送压缩后的负载.
+// 读文件时先读入窗口槽位再压缩到 `compress_buffer`; 映射文件时直接从映射压缩到窗口槽位.
+bool compression_enabled{false};
+std::unique_ptr<compression::compressor> compressor;
+std::vector<char> compress_buffer;
+// 握手时协商了前向纠错 (见 `fec.hxx`) 时, 每组数据包第一次发完后紧接着发出校验包.
+// 校验包不重传; 它们的缓冲区在下一次 `wait()` 返回后归还.
+std::optional<fec::parameters> fec_parameters;
+std::unique_ptr<fec::encoder> fec_encoder;
+std::unique_ptr<packet_pool> parity_packets;
+std::vector<packet_pool::handle> parity_handles;
+
+// 回退 N 的快速重传: 连续的重复 ACK 数, 以及本次丢包恢复结束的位置.
+// 窗口左端越过 `recovery_seq_num` 之前不再因重复 ACK 触发新的快速重传.
+// `fast_recovery` 表示这次恢复由重复 ACK 而不是超时引起, 只有这时部分确认才重传新的左端.
+std::size_t dupack_threshold;
+std::size_t n_duplicate_acks{0};
+std::size_t recovery_seq_num{0};
+bool fast_recovery{false};
+bool fast_retransmit_pending{false};
+
+// 没有 `--pacing` 也没有 `--max-rate` 时为空
+constexpr int PACING_TIMER{1};
+std::unique_ptr<pacer> pacing;
+bool pacing_by_congestion;
+// `--max-rate` 换算成包每秒, 0 表示不限
+double max_rate_packets;
+bool pacing_timer_armed{false};
+
+// 选择重传模式下每个窗口槽位各有一个重传定时器, 存放在时间轮中;
+// `RETRANSMIT_TIMER` 只按其中最早的到期时间设定.
+std::unique_ptr<timing_wheel> retransmit_timers;
+std::vector<std::size_t> expired_indexes_vec;
+bool retransmit_timer_armed{false};
+timing_wheel::clock::time_point retransmit_timer_deadline;
+
+// 握手完成后开始统计. 有效吞吐量按已确认的字节计.
+std::unique_ptr<transfer_metrics> metrics;
+constexpr int STATS_TIMER{2};
+std::unique_ptr<stats_sink> snapshot_sink;
+std::size_t transfer_bytes;
+std::size_t acked_bytes;
+
+// 按 `--mtu` 向接收端请求的负载长度. `auto` 时还给套接字设置 DF, 握手后由调用者清除.
+std::size_t requested_payload_size(int fd, const transfer_options &options)
+{
+    std::size_t mtu{options.mtu};
+    if (options.mtu_auto)
+    {
+        // 超过内核已知的路径 MTU 的报文会直接发送失败, 先按它请求
+        socket_process::set_dont_fragment(fd, true);
+        if (std::size_t path_mtu{socket_process::path_mtu(fd)}; path_mtu > 0)
+            mtu = path_mtu;
+        log_debug("路径 MTU: ", mtu);
+    }
+    return socket_process::payload_size_for_mtu(fd, mtu);
+}
 
 void sender_core_function(const char *hose_name, const char *port, const char *file_path,
-                          std::size_t window_size, mode_type mode)
+                          std::size_t window_size, mode_type mode,
+                          const transfer_options &options)
 {
     socket_wrapper.open(socket_process::open_sender_socket(hose_name, port));
-    timer_wrapper.open(timerfd_create(0, 0));
-    epoll_wrapper.open(epoll_create1(0));
-    if (!timer_wrapper.is_valid())
-        error_process::unix_error("`timerfd_create()` 错误: ");
-    if (!epoll_wrapper.is_valid())
-        error_process::unix_error("`epoll_create1()` 错误: ");
-
-    epoll_event ep_event_sock, ep_event_timer;
-    ep_event_sock.events = EPOLLIN;
-    ep_event_sock.data.fd = socket_wrapper.get_file_descriptor();
-    if (epoll_ctl(epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD,
-                  socket_wrapper.get_file_descriptor(), &ep_event_sock) == -1)
-        error_process::unix_error("`epoll_ctl()` 错误: ");
-
-    ep_event_timer.events = EPOLLIN;
-    ep_event_timer.data.fd = timer_wrapper.get_file_descriptor();
-    if (epoll_ctl(epoll_wrapper.get_file_descriptor(), EPOLL_CTL_ADD,
-                  timer_wrapper.get_file_descriptor(), &ep_event_timer) == -1)
-        error_process::unix_error("`epoll_ctl()` 错误: ");
+    if (options.max_rate > 0)
+        socket_process::set_max_pacing_rate(socket_wrapper.get_file_descriptor(),
+                                            options.max_rate);
+    rto = std::make_unique<rto_estimator>(std::chrono::milliseconds{options.rto_min_ms},
+                                          std::chrono::milliseconds{options.rto_max_ms});
+    streaming = file_process::is_stream(file_path);
 
     std::uint32_t seq_num{std::random_device{}()};
     if (seq_num > std::numeric_limits<std::uint16_t>::max())
         seq_num /= (std::numeric_limits<std::uint8_t>::max() + 1);
-    handshake(socket_wrapper.get_file_descriptor(), seq_num);
-    log_debug("握手完成");
+    handshake_extensions extensions;
+    if (options.send_size && !streaming)
+        extensions.file_size = std::filesystem::file_size(file_path);
+    else if (options.send_size)
+        log_debug("流式发送时大小未知, 忽略 `--send-size`");
+    extensions.sack = options.sack;
+    extensions.compression = options.compress;
+    if (options.fec_group > 0)
+        extensions.fec = fec::parameters{static_cast<std::uint8_t>(options.fec_group),
+                                         static_cast<std::uint8_t>(options.fec_parity)};
+    if (stripe_length)
+        extensions.stripe_offset = stripe_offset;
+    if (options.resume && !streaming && !stripe_length)
+        extensions.resume = journal::identify(file_path);
+    else if (options.resume)
+        log_debug("流式发送与分条发送不能续传, 忽略 `--resume`");
+    if (options.mtu != 0)
+        extensions.payload_size = static_cast<std::uint16_t>(
+            requested_payload_size(socket_wrapper.get_file_descriptor(), options));
+    handshake_extensions accepted{handshake(socket_wrapper.get_file_descriptor(), seq_num,
+                                            extensions, options.mtu_auto)};
+    if (options.mtu_auto)
+        socket_process::set_dont_fragment(socket_wrapper.get_file_descriptor(), false);
+    // 不认识偏移的接收端会把这一段写到文件开头
+    if (stripe_length && accepted.stripe_offset != extensions.stripe_offset)
+        logs::error("接收端不支持分条接收, 请以同样的 `--stripes` 启动接收端");
+    sack_enabled = accepted.sack;
+    compression_enabled = accepted.compression;
+    if (options.compress && !compression_enabled)
+        log_debug("接收端不支持压缩, 照原样发送");
+    // 对端回应的长度不会超过请求的长度, 不认识这个扩展的对端不回应
+    full_payload_size = PAYLOAD_MAX;
+    if (extensions.payload_size && accepted.payload_size && *accepted.payload_size > 0)
+        full_payload_size = std::min(*accepted.payload_size, *extensions.payload_size);
+    // 校验包比数据包多 FEC 头, 数据包让出这部分, 校验包就不超过协商的长度
+    fec_parameters.reset();
+    if (extensions.fec && accepted.fec == extensions.fec)
+    {
+        fec_parameters = accepted.fec;
+        full_payload_size -= fec::OVERHEAD;
+    }
+    else if (extensions.fec)
+        log_debug("接收端不支持前向纠错, 只靠重传");
+    // 接收端已持久写入了文件的前 `resume_offset` 字节, 只发送其余部分
+    file_checksum.reset();
+    if (extensions.resume && accepted.resume_offset)
+    {
+        std::uint64_t offset{*accepted.resume_offset};
+        if (offset > extensions.resume->size || offset % full_payload_size != 0)
+            logs::error("接收端给出的续传位置 ", offset, " 不合法");
+        stripe_offset = offset;
+        stripe_length = extensions.resume->size - offset;
+        file_checksum = 0;
+        log_debug("接收端已有前 ", offset, " 字节, 从这里续传");
+    }
+    else if (extensions.resume)
+        log_debug("接收端不支持续传, 从头发送");
+    if (full_payload_size > PAYLOAD_MAX)
+        socket_process::enlarge_buffers(socket_wrapper.get_file_descriptor(),
+                                        window_size * (sizeof(rtp_header) + full_payload_size));
+    log_debug("握手完成. 对端同意的扩展: ", accepted);
+    // 发送端只接收 ACK, 用不上 GRO
+    transfer_options loop_options{options};
+    loop_options.gro = false;
+    loop = make_event_loop(socket_wrapper.get_file_descriptor(), loop_options,
+                           full_payload_size);
+    metrics = std::make_unique<transfer_metrics>();
+    if (!options.stats_snapshot.empty())
+    {
+        snapshot_sink = std::make_unique<stats_sink>(options.stats_snapshot);
+        loop->start_timer(STATS_TIMER, static_cast<std::int64_t>(options.stats_interval_ms));
+    }
     switch (mode)
     {
     case mode_type::go_back_n:
-        send_file<mode_type::go_back_n>(socket_wrapper.get_file_descriptor(), file_path,
-                                        window_size, seq_num + 1);
+        send_file<mode_type::go_back_n>(file_path, window_size, seq_num + 1, options);
         break;
     case mode_type::selective_repeat:
-        send_file<mode_type::selective_repeat>(socket_wrapper.get_file_descriptor(),
-                                               file_path, window_size, seq_num + 1);
+        send_file<mode_type::selective_repeat>(file_path, window_size, seq_num + 1, options);
         break;
     case mode_type::unknown:
         logs::error("未知的模式");
         break;
     }
     log_debug("文件发送完成");
+    metrics->stop();
+    loop.reset();
     terminate_connection(socket_wrapper.get_file_descriptor(), seq_num + 1 + file_window);
 }
 
+// 按包把文件均分成 `--stripes` 段, 每段由一个子进程 (按 `--cpus` 绑核) 经自己的套接字
+// 发送. 发送端的状态都是全局的, 所以用进程而不是线程.
+void send_striped(const char *host_name, const char *port, const char *file_path,
+                  std::size_t window_size, mode_type mode, const transfer_options &options)
+{
+    std::size_t file_size{std::filesystem::file_size(file_path)};
+    // 按各条将要请求的负载长度分段, 每段都由整包组成. 协商的结果更短时分段仍然正确,
+    // 只是各段末尾多一个不满的包.
+    std::size_t payload_size{PAYLOAD_MAX};
+    if (options.mtu != 0)
+    {
+        file_process::fd_wrapper probe{socket_process::open_sender_socket(host_name, port)};
+        payload_size = requested_payload_size(probe.get_file_descriptor(), options);
+    }
+    if (options.fec_group > 0)
+        payload_size -= fec::OVERHEAD;
+    std::size_t n_packets{(file_size + payload_size - 1) / payload_size};
+    std::size_t packets_per_stripe{(n_packets + options.stripes - 1) / options.stripes};
+    auto start{std::chrono::steady_clock::now()};
+
+    std::vector<pid_t> children;
+    for (std::size_t i{0}; i < options.stripes; i++)
+    {
+        std::size_t offset{std::min(i * packets_per_stripe, n_packets) * payload_size};
+        std::size_t length{std::min(packets_per_stripe * payload_size,
+                                    file_size - std::min(offset, file_size))};
+        logs::flush();
+        pid_t pid{fork()};
+        if (pid == -1)
+            error_process::unix_error("`fork()` 错误: ");
+        if (pid == 0)
+        {
+            // 各条的统计写到各自的文件
+            transfer_options stripe_options{options};
+            for (std::string *path : {&stripe_options.stats, &stripe_options.stats_snapshot})
+                if (!path->empty() && *path != "-" && !path->starts_with("unix:"))
+                    *path += '.' + std::to_string(i);
+            try
+            {
+                set_cpu_affinity(options.cpus, i);
+                stripe_offset = offset;
+                stripe_length = length;
+                log_debug("第 ", i, " 条: 偏移 ", offset, ", 长度 ", length);
+                sender_core_function(host_name, port, file_path, window_size, mode,
+                                     stripe_options);
+            }
+            catch (exceptions)
+            {
+                write_summary(stripe_options);
+                std::exit(EXIT_FAILURE);
+            }
+            write_summary(stripe_options);
+            std::exit(EXIT_SUCCESS);
+        }
+        children.push_back(pid);
+    }
+
+    bool failed{false};
+    for (pid_t pid : children)
+    {
+        int status;
+        if (waitpid(pid, &status, 0) == -1)
+            error_process::unix_error("`waitpid()` 错误: ");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS)
+            failed = true;
+    }
+    if (failed)
+        logs::error("有分条发送失败");
+
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+    logs::info(options.stripes, " 条共发送 ", file_size, " 字节, 用时 ", elapsed.count(),
+               " s, ", file_size / elapsed.count() / 1e6, " MB/s");
+}
+
 template <mode_type mode>
-void send_file(int fd, const char *file_path, std::size_t window_size,
-               std::uint32_t start_seq_num)
+void send_file(const char *file_path, std::size_t window_size, std::uint32_t start_seq_num,
+               const transfer_options &options)
 {
-    ifs.open(file_path, std::ios::binary);
-    if (ifs.fail())
-        logs::error("打开文件 `", file_path, "` 时出现了问题");
+    if (options.mmap)
+    {
+        mapped_file = std::make_unique<file_process::mapped_file>(file_path);
+        remain_file_size = mapped_file->size();
+    }
+    else if (streaming)
+    {
+        stream = std::make_unique<file_process::stream_input>(file_path);
+        stream_finished = false;
+        stream_filled = 0;
+        stream_bytes = 0;
+        remain_file_size = std::numeric_limits<std::size_t>::max() / 2;
+        loop->start_timer(KEEPALIVE_TIMER, KEEPALIVE_INTERVAL_MS);
+    }
+    else
+    {
+        ifs.open(file_path, std::ios::binary);
+        if (ifs.fail())
+            logs::error("打开文件 `", file_path, "` 时出现了问题");
 
-    remain_file_size = std::filesystem::file_size(file_path);
-    log_debug("文件大小: ", remain_file_size);
-    file_window = remain_file_size / PAYLOAD_MAX;
+        remain_file_size = std::filesystem::file_size(file_path);
+        ifs.seekg(static_cast<std::streamoff>(stripe_offset));
+    }
+    if (stripe_length)
+        remain_file_size = *stripe_length;
+    // 接收端已有的部分也计入整个文件的校验和
+    if (file_checksum && stripe_offset > 0)
+    {
+        if (mapped_file)
+            file_checksum = checksum::extend(0, mapped_file->data(), stripe_offset);
+        else
+        {
+            std::vector<char> buf(1 << 20);
+            ifs.seekg(0);
+            for (std::size_t offset{0}; offset < stripe_offset;)
+            {
+                std::size_t n{std::min(buf.size(), stripe_offset - offset)};
+                if (!ifs.read(buf.data(), static_cast<std::streamsize>(n)))
+                    logs::error("读文件 `", file_path, "` 时出现了问题");
+                file_checksum = checksum::extend(*file_checksum, buf.data(), n);
+                offset += n;
+            }
+        }
+    }
+    if (!stream)
+        log_debug("文件大小: ", remain_file_size);
+    transfer_bytes = remain_file_size;
+    acked_bytes = 0;
+    file_window = remain_file_size / full_payload_size;
 
-    if (remain_file_size % PAYLOAD_MAX > 0)
+    if (remain_file_size % full_payload_size > 0)
         file_window += 1;
     ::window_size = window_size;
 
-    packets_vec.resize(window_size);
+    if (mapped_file)
+        headers_vec.resize(window_size);
+    if (!mapped_file || compression_enabled)
+        packets_vec =
+            std::make_unique<packet_pool>(full_payload_size, window_size, options.hugepages);
+    if (compression_enabled)
+    {
+        compressor = std::make_unique<compression::compressor>();
+        compress_buffer.resize(full_payload_size);
+    }
+    if (fec_parameters)
+    {
+        fec_encoder = std::make_unique<fec::encoder>(*fec_parameters, full_payload_size);
+        // 两次 `wait()` 之间一般最多发出一个窗口, 即 `window_size / group_size + 1` 组
+        std::size_t n_groups{window_size / fec_parameters->group_size + 1};
+        parity_packets = std::make_unique<packet_pool>(
+            full_payload_size + fec::OVERHEAD, n_groups * fec_parameters->n_parity,
+            options.hugepages);
+    }
     ack_flags_vec.resize(window_size, false);
+    send_times_vec.resize(window_size);
+    retransmitted_flags_vec.resize(window_size, false);
+    if constexpr (mode == mode_type::selective_repeat)
+        retransmit_timers = std::make_unique<timing_wheel>(window_size);
 
+    file_start_seq_num = start_seq_num;
+    prefetched_offset = stripe_offset;
+    released_offset = stripe_offset;
     window_left_seq_num = start_seq_num;
     window_left_unsent_seq_num = window_left_seq_num;
+    window_filled_seq_num = window_left_seq_num;
+    congestion = make_congestion_control(options.congestion, window_size);
+    if (options.pacing || options.max_rate > 0)
+    {
+        pacing = std::make_unique<pacer>();
+        pacing_by_congestion = options.pacing;
+        // 握手后 `full_payload_size` 已按协商结果 (及 FEC 开销) 确定, 按实际包长换算
+        max_rate_packets = static_cast<double>(options.max_rate) /
+                           (sizeof(rtp_header) + full_payload_size);
+    }
     window_right_seq_num =
         window_left_seq_num + (file_window > window_size ? window_size : file_window);
+    dupack_threshold = options.dupack_threshold;
+    // 接收端对每个乱序的包都立即重复确认. 组内丢了包时, 在校验包恢复出它之前, 组内其余
+    // 的包就可能带来 `group_size - 1` 个重复 ACK. 门限至少取一组数据包与校验包的总数,
+    // 否则总是抢在校验包之前快速重传.
+    if (fec_parameters && dupack_threshold > 0)
+    {
+        dupack_threshold =
+            std::max<std::size_t>(dupack_threshold, fec_parameters->group_size +
+                                                        fec_parameters->n_parity);
+        log_debug("重复 ACK 门限: ", dupack_threshold);
+    }
 
     n_need_ack_window = file_window;
 
-    epoll_event ep_event{EPOLLIN};
     int attempt_times{0};
-    rtp_header header_buf;
 
     log_debug("开始发送文件");
     while (true)
     {
+        // 流式发送在 `send_window()` 中读到结尾时才确定还剩多少包
+        send_window();
         if (n_need_ack_window == 0)
             return;
-        send_window(fd);
-        if (epoll_wait(epoll_wrapper.get_file_descriptor(), &ep_event, 1, -1) == -1)
-            error_process::unix_error("`epoll_wait()` 错误: ");
+        loop->wait();
+        // 之前加入的校验包都已发出
+        for (packet_pool::handle h : parity_handles)
+            parity_packets->release(h);
+        parity_handles.clear();
 
-        if (ep_event.data.fd != fd)
+        if (loop->is_expired(PACING_TIMER))
+            pacing_timer_armed = false;
+        metrics->sample(transfer_metrics::clock::now());
+        if (snapshot_sink && loop->is_expired(STATS_TIMER))
         {
-            attempt_times++;
-            if (attempt_times > 500)
-                logs::error("发送数据达到最大尝试次数");
-            resend<mode>(fd);
-            start_timer(timer_wrapper.get_file_descriptor(), 100);
+            write_stats(*snapshot_sink, *metrics, "sender");
+            loop->start_timer(STATS_TIMER, static_cast<std::int64_t>(options.stats_interval_ms));
         }
-        else
+        if (stream && loop->is_expired(KEEPALIVE_TIMER))
+            keep_alive();
+
+        bool window_moved{false};
+        for (std::size_t i{0}; i < loop->size(); i++)
         {
-            if (header_buf.recv(fd) == -1 && (errno != EAGAIN && errno != EWOULDBLOCK))
-                error_process::unix_error("接收包发生了错误: ");
-            if (header_buf.get_length() == 0 && header_buf.is_valid() &&
-                header_buf.get_flag() == ACK)
+            packet_view header_buf{(*loop)[i]};
+            if (loop->length(i) < sizeof(rtp_header) ||
+                loop->length(i) < sizeof(rtp_header) + header_buf.get_length() ||
+                !header_buf.is_valid())
             {
-                if (process_ack<mode>(header_buf.get_seq_num()))
-                {
-                    attempt_times = 0;
-                    start_timer(timer_wrapper.get_file_descriptor(), 100);
-                }
+                metrics->add(counter::checksum_failures);
+                continue;
             }
+            if (header_buf.get_flag() != ACK)
+                continue;
+            metrics->add(counter::acks_received);
+            if (sack_enabled)
+            {
+                if (process_sack<mode>(header_buf))
+                    window_moved = true;
+            }
+            else if (header_buf.get_length() == 0 &&
+                     process_ack<mode>(
+                         unwrap_seq_num(header_buf.get_seq_num(), window_left_seq_num)))
+                window_moved = true;
+        }
+        if (window_moved)
+        {
+            rto->reset_backoff();
+            std::size_t acked{std::min(
+                (window_left_seq_num - file_start_seq_num) * full_payload_size, transfer_bytes)};
+            metrics->add_goodput(acked - acked_bytes);
+            acked_bytes = acked;
+        }
+        if constexpr (mode == mode_type::selective_repeat)
+            resend_expired(attempt_times, window_moved);
+        else if (window_moved || fast_retransmit_pending)
+        {
+            if (window_moved)
+                attempt_times = 0;
+            // 快速恢复期间窗口只前进了一部分, 说明新的左端也丢了
+            if (dupack_threshold > 0 &&
+                (fast_retransmit_pending ||
+                 (fast_recovery && window_left_seq_num < recovery_seq_num)))
+                fast_retransmit();
+            loop->start_timer(RETRANSMIT_TIMER, rto->timeout_ms());
+        }
+        else if (loop->is_expired(RETRANSMIT_TIMER) &&
+                 // 流式发送等待输入时可能没有在途的包
+                 window_left_seq_num < window_filled_seq_num)
+        {
+            attempt_times++;
+            if (attempt_times > 500)
+                logs::error("发送数据达到最大尝试次数");
+            metrics->add(counter::timeouts);
+            rto->backoff();
+            congestion->on_loss(window_left_seq_num, window_filled_seq_num,
+                                congestion_control::clock::now());
+            log_debug("重传超时, RTO 退避为 ", rto->timeout_ms(), " ms, 拥塞窗口 ",
+                      congestion->window());
+            // 退回重发的包会引起大量重复 ACK, 不能再触发快速重传
+            n_duplicate_acks = 0;
+            recovery_seq_num = window_filled_seq_num;
+            fast_recovery = false;
+            resend();
+            loop->start_timer(RETRANSMIT_TIMER, rto->timeout_ms());
         }
     }
 }
 
 template <>
-[[nodiscard]] bool process_ack<mode_type::selective_repeat>(std::uint32_t seq_num)
+[[nodiscard]] bool process_ack<mode_type::selective_repeat>(std::size_t seq_num)
 {
     if (seq_num < window_left_seq_num || seq_num >= window_right_seq_num)
     {
         log_debug("`process_ack()`: 接收到的 `seq_num`: ", seq_num, " 超出当前窗口 [",
                   window_left_seq_num, ", ", window_right_seq_num - 1, ']');
+        metrics->add(counter::out_of_window_acks);
         return false;
     }
 
     if (ack_flags_vec[seq_num % window_size])
+    {
+        metrics->add(counter::duplicate_acks);
         return false;
+    }
 
     log_debug("ACK ", seq_num);
     ack_flags_vec[seq_num % window_size] = true;
+    retransmit_timers->cancel(seq_num % window_size);
+    congestion->on_ack(1, sample_rtt(seq_num), congestion_control::clock::now());
 
     if (seq_num != window_left_seq_num)
         return false;
@@ -232,7 +662,6 @@ template <>
     std::size_t difference{_1st_nack_pkt - window_left_seq_num};
     window_left_seq_num += difference;
     n_need_ack_window -= difference;
-    window_left_unsent_seq_num = window_right_seq_num;
     window_right_seq_num += difference;
     if (window_right_seq_num - window_left_seq_num > n_need_ack_window)
         window_right_seq_num = window_left_seq_num + n_need_ack_window;
@@ -242,85 +671,532 @@ template <>
     return true;
 }
 
-template <> [[nodiscard]] bool process_ack<mode_type::go_back_n>(std::uint32_t seq_num)
+template <> [[nodiscard]] bool process_ack<mode_type::go_back_n>(std::size_t seq_num)
 {
-    if (seq_num <= window_left_seq_num || seq_num > window_right_seq_num)
+    // 重复 ACK: 接收端收到了乱序或重复的包, 窗口左端的包可能已丢失
+    if (seq_num == window_left_seq_num && seq_num < window_filled_seq_num)
+    {
+        metrics->add(counter::duplicate_acks);
+        if (dupack_threshold > 0 && window_left_seq_num >= recovery_seq_num &&
+            ++n_duplicate_acks == dupack_threshold)
+            fast_retransmit_pending = true;
+        return false;
+    }
+    if (seq_num <= window_left_seq_num || seq_num > window_filled_seq_num)
     {
         log_debug("`process_ack()`: 接收到的 `seq_num`: ", seq_num, " 超出当前窗口 [",
                   window_left_seq_num, ", ", window_right_seq_num - 1, ']');
+        metrics->add(counter::out_of_window_acks);
         return false;
     }
 
+    // 选择确认早已报告过的包, 等待的是前面的空洞, 不能用来采样
+    bool sacked{ack_flags_vec[(seq_num - 1) % window_size] != 0};
     for (std::size_t i{window_left_seq_num}; i < seq_num; i++)
     {
         log_debug("ACK ", i);
         ack_flags_vec[i % window_size] = true;
     }
-
     std::size_t difference{seq_num - window_left_seq_num};
+    // 累计确认: 用被确认的最后一个包采样
+    congestion->on_ack(difference, sacked ? std::nullopt : sample_rtt(seq_num - 1),
+                       congestion_control::clock::now());
     window_left_seq_num += difference;
     n_need_ack_window -= difference;
-    window_left_unsent_seq_num = window_right_seq_num;
     window_right_seq_num += difference;
     if (window_right_seq_num - window_left_seq_num > n_need_ack_window)
         window_right_seq_num = window_left_seq_num + n_need_ack_window;
+    n_duplicate_acks = 0;
+    // 超时退回后, 之前发出的包仍可能被确认
+    if (window_left_unsent_seq_num < window_left_seq_num)
+        window_left_unsent_seq_num = window_left_seq_num;
 
     log_debug("窗口变为 ", window_left_seq_num, ' ', window_right_seq_num, ' ',
               window_left_unsent_seq_num);
     return true;
 }
 
-template <mode_type mode> void resend(int fd)
+// 选择确认: 累计确认点之前的包与位图中的包都已收到
+template <>
+[[nodiscard]] bool process_sack<mode_type::selective_repeat>(packet_view ack)
+{
+    bool window_moved{false};
+    std::size_t ack_seq_num{unwrap_seq_num(ack.get_seq_num(), window_left_seq_num)};
+    while (window_left_seq_num < ack_seq_num &&
+           process_ack<mode_type::selective_repeat>(window_left_seq_num))
+        window_moved = true;
+    // 位图会重复报告已确认的包, 跳过它们, 不计为重复 ACK
+    sack::for_each(ack, ack_seq_num,
+                   [&](std::size_t seq_num)
+                   {
+                       if (seq_num < window_left_seq_num || seq_num >= window_right_seq_num ||
+                           ack_flags_vec[seq_num % window_size])
+                           return;
+                       if (process_ack<mode_type::selective_repeat>(seq_num))
+                           window_moved = true;
+                   });
+    return window_moved;
+}
+
+// 回退 N 的 ACK 本来就是累计确认. 位图中的包只做标记, 超时重传时跳过它们.
+template <> [[nodiscard]] bool process_sack<mode_type::go_back_n>(packet_view ack)
+{
+    std::size_t ack_seq_num{unwrap_seq_num(ack.get_seq_num(), window_left_seq_num)};
+    bool window_moved{process_ack<mode_type::go_back_n>(ack_seq_num)};
+    sack::for_each(ack, ack_seq_num,
+                   [](std::size_t seq_num)
+                   {
+                       if (seq_num >= window_left_seq_num && seq_num < window_filled_seq_num)
+                           ack_flags_vec[seq_num % window_size] = true;
+                   });
+    return window_moved;
+}
+
+// 回退 N: 从窗口左端起, 在拥塞窗口内重传已发出的包
+void resend()
+{
+    window_left_unsent_seq_num = window_left_seq_num;
+    send_window();
+}
+
+// 回退 N: 不等定时器到期, 只重传窗口左端的包. 接收端缓存了乱序的包,
+// 补上空洞后累计确认会直接跳过它们.
+void fast_retransmit()
 {
-    for (std::size_t i{window_left_seq_num}; i < window_right_seq_num; i++)
+    fast_retransmit_pending = false;
+    n_duplicate_acks = 0;
+    auto now{congestion_control::clock::now()};
+    if (window_left_seq_num >= recovery_seq_num)
     {
-        std::size_t index{i % window_size};
-        if constexpr (mode == mode_type::selective_repeat)
+        congestion->on_loss(window_left_seq_num, window_filled_seq_num, now);
+        recovery_seq_num = window_filled_seq_num;
+        fast_recovery = true;
+    }
+    // 超时退回后 `send_window()` 会从左端起重发, 不必再单独发一次
+    if (window_left_unsent_seq_num <= window_left_seq_num)
+        return;
+    log_debug("快速重传 ", window_left_seq_num, ", 拥塞窗口 ", congestion->window());
+    metrics->add(counter::fast_retransmits);
+    metrics->add(counter::packets_retransmitted);
+
+    retransmitted_flags_vec[window_left_seq_num % window_size] = true;
+    if (pacing)
+        pacing->consume(now);
+    push_packet(window_left_seq_num);
+    loop->flush();
+}
+
+// 选择重传: 只重传自己的定时器已到期的包
+void resend_expired(int &attempt_times, bool window_moved)
+{
+    if (window_moved)
+        attempt_times = 0;
+    if (loop->is_expired(RETRANSMIT_TIMER))
+        retransmit_timer_armed = false;
+
+    auto now{timing_wheel::clock::now()};
+    expired_indexes_vec.clear();
+    retransmit_timers->expire(now, expired_indexes_vec);
+    if (!expired_indexes_vec.empty())
+    {
+        std::size_t left_index{window_left_seq_num % window_size};
+        // 只有窗口左端 (最早发出且未确认的包) 超时才相当于 RFC 6298 中唯一的那个
+        // 定时器到期, 此时才退避; 否则一次丢包中先后到期的各个包会让 RTO 连续加倍.
+        if (std::find(expired_indexes_vec.begin(), expired_indexes_vec.end(), left_index) !=
+            expired_indexes_vec.end())
         {
-            if (!ack_flags_vec[index])
-            {
-                if (packets_vec[index].send(fd) == -1)
-                    error_process::unix_error("发送包失败: ");
-            }
+            if (!window_moved && ++attempt_times > 500)
+                logs::error("发送数据达到最大尝试次数");
+            metrics->add(counter::timeouts);
+            rto->backoff();
         }
-        else
+        log_debug(expired_indexes_vec.size(), " 个包重传超时, RTO 为 ", rto->timeout_ms(), " ms");
+
+        timing_wheel::clock::time_point deadline;
+        for (std::size_t index : expired_indexes_vec)
         {
-            if (packets_vec[index].send(fd) == -1)
-                error_process::unix_error("发送包失败: ");
+            std::size_t seq_num{window_left_seq_num +
+                                (index + window_size - left_index) % window_size};
+            retransmitted_flags_vec[index] = true;
+            metrics->add(counter::packets_retransmitted);
+            congestion->on_loss(seq_num, window_filled_seq_num, now);
+            if (pacing)
+                pacing->consume(now);
+            push_packet(seq_num);
+            deadline = retransmit_timers->schedule(index, now + rto->timeout());
         }
+        loop->flush();
+        arm_retransmit_timer(deadline);
     }
+
+    // 定时器到期后, 按剩下的最早到期时间重新设定
+    if (!retransmit_timer_armed)
+    {
+        if (auto deadline{retransmit_timers->next_deadline()})
+            arm_retransmit_timer(*deadline);
+    }
+}
+
+// 只在新的到期时间早于已设定的时间时才重设定时器, 确认包不会引起重设.
+// 已确认的包的定时器只在时间轮中取消, 定时器因此可能提前到期一次, 到时再重设.
+void arm_retransmit_timer(timing_wheel::clock::time_point deadline)
+{
+    if (retransmit_timer_armed && retransmit_timer_deadline <= deadline)
+        return;
+    auto now{timing_wheel::clock::now()};
+    std::int64_t time_ms{
+        deadline > now ? std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count()
+                       : 1};
+    loop->start_timer(RETRANSMIT_TIMER, time_ms);
+    retransmit_timer_armed = true;
+    retransmit_timer_deadline = deadline;
+}
+
+// Karn 算法: 只用没有重传过的包采样
+std::optional<rto_estimator::clock::duration> sample_rtt(std::size_t seq_num)
+{
+    std::size_t index{seq_num % window_size};
+    if (retransmitted_flags_vec[index])
+        return std::nullopt;
+    auto rtt{rto_estimator::clock::now() - send_times_vec[index]};
+    rto->sample(rtt);
+    metrics->rtt.record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(rtt).count()));
+    return rtt;
 }
 
-void send_window(int fd)
+// 窗口槽位中已读入 `payload_size` 字节的负载, 作成数据包. 协商了压缩且压缩后更短时
+// 换成压缩后的负载.
+void make_data_packet(std::size_t seq_num, std::size_t payload_size)
 {
+    packet_view packet{(*packets_vec)[seq_num % window_size]};
+    if (compression_enabled)
+    {
+        std::size_t n{compressor->compress(packet.get_buf(), payload_size, compress_buffer.data())};
+        if (n > 0)
+        {
+            std::memcpy(packet.get_buf(), compress_buffer.data(), n);
+            packet.make_packet(seq_num, n, COMPRESSED);
+            metrics->add(counter::packets_compressed);
+            return;
+        }
+    }
+    packet.make_packet(seq_num, payload_size, 0);
+}
+
+// 窗口中的包的包头与负载. 压缩过的包在窗口槽位中, 即使映射了文件.
+static bool in_mapping(std::size_t index)
+{
+    return mapped_file && !(headers_vec[index].get_flag() & COMPRESSED);
+}
+
+static const rtp_header &window_header(std::size_t seq_num)
+{
+    std::size_t index{seq_num % window_size};
+    if (in_mapping(index))
+        return headers_vec[index];
+    return (*packets_vec)[index];
+}
+
+static const char *window_payload(std::size_t seq_num)
+{
+    std::size_t index{seq_num % window_size};
+    if (in_mapping(index))
+        return mapped_file->data() + stripe_offset +
+               (seq_num - file_start_seq_num) * full_payload_size;
+    return (*packets_vec)[index].get_buf();
+}
+
+void push_packet(std::size_t seq_num)
+{
+    const rtp_header &header{window_header(seq_num)};
+    metrics->add(counter::packets_sent);
+    metrics->add(counter::payload_bytes_sent, header.get_length());
+    if (in_mapping(seq_num % window_size))
+        loop->push(header, window_payload(seq_num));
+    else
+        loop->push(header);
+}
+
+// 把第一次发出的包加入所在的组. 组满或这是最后一个包时发出组的校验包.
+void push_parity(std::size_t seq_num, pacer::clock::time_point now)
+{
+    fec_encoder->add(window_header(seq_num), window_payload(seq_num));
+    if (!fec_encoder->is_full() && seq_num + 1 != file_start_seq_num + file_window)
+        return;
+    flush_parity(seq_num + 1, now);
+}
+
+// 发出以 `end_seq_num` 之前的包结尾的组的校验包, 并开始新的组.
+void flush_parity(std::size_t end_seq_num, pacer::clock::time_point now)
+{
+    auto first_seq_num{static_cast<std::uint32_t>(end_seq_num - fec_encoder->size())};
+    for (std::size_t j{0}; j < fec_parameters->n_parity; j++)
+    {
+        packet_pool::handle h{parity_packets->acquire()};
+        packet_view parity{(*parity_packets)[h]};
+        fec_encoder->make_parity(j, first_seq_num, parity);
+        parity_handles.push_back(h);
+        metrics->add(counter::parity_packets_sent);
+        metrics->add(counter::payload_bytes_sent, parity.get_length());
+        if (pacing)
+            pacing->consume(now);
+        loop->push(parity);
+    }
+    fec_encoder->reset();
+}
+
+// 预读窗口右侧即将发送的部分, 释放窗口左侧已确认的部分,
+// 使映射的驻留内存不随文件大小增长.
+static void advise_mapping()
+{
+    constexpr std::size_t ADVISE_CHUNK{4 << 20};
+    std::size_t left_offset{stripe_offset +
+                            (window_left_seq_num - file_start_seq_num) * full_payload_size};
+    std::size_t right_offset{stripe_offset +
+                             (window_right_seq_num - file_start_seq_num) * full_payload_size};
+    std::size_t window_bytes{window_size * full_payload_size};
+
+    if (right_offset + window_bytes > prefetched_offset)
+    {
+        std::size_t length{window_bytes > ADVISE_CHUNK ? window_bytes : ADVISE_CHUNK};
+        mapped_file->prefetch(prefetched_offset, right_offset + length - prefetched_offset);
+        prefetched_offset = right_offset + length;
+    }
+    if (left_offset - released_offset >= ADVISE_CHUNK)
+    {
+        mapped_file->release(released_offset, left_offset - released_offset);
+        released_offset = left_offset;
+    }
+}
+
+void send_window()
+{
+    if (mapped_file && window_left_unsent_seq_num < window_right_seq_num)
+        advise_mapping();
+
+    // 在途的包不超过拥塞窗口
+    std::size_t right_seq_num{
+        std::min(window_right_seq_num, window_left_seq_num + congestion->window())};
+
     bool send_{false};
-    for (std::size_t seq_num{window_left_unsent_seq_num}; seq_num < window_right_seq_num;
-         seq_num++)
+    auto now{rto_estimator::clock::now()};
+    timing_wheel::clock::time_point deadline;
+    if (pacing)
+        update_pacing_rate();
+    std::size_t seq_num;
+    for (seq_num = window_left_unsent_seq_num; seq_num < right_seq_num; seq_num++)
     {
-        send_ = true;
         std::size_t index{seq_num % window_size};
-        std::size_t payload_size{remain_file_size > PAYLOAD_MAX ? PAYLOAD_MAX
-                                                                : remain_file_size};
-        ifs.read(packets_vec[index].get_buf(), payload_size);
+        // 选择确认已报告收到的包不必重传
+        if (seq_num < window_filled_seq_num && ack_flags_vec[index])
+            continue;
+        if (seq_num >= window_filled_seq_num && stream && !fill_from_stream(seq_num))
+            break;
+        if (pacing && !pacing->try_consume(now))
+        {
+            wait_for_tokens(now);
+            break;
+        }
+        send_ = true;
+        if (seq_num < window_filled_seq_num)
+        {
+            retransmitted_flags_vec[index] = true;
+            metrics->add(counter::packets_retransmitted);
+            push_packet(seq_num);
+            continue;
+        }
+        window_filled_seq_num = seq_num + 1;
+        ack_flags_vec[index] = false;
+        send_times_vec[index] = now;
+        retransmitted_flags_vec[index] = false;
+        if (retransmit_timers)
+            deadline = retransmit_timers->schedule(index, now + rto->timeout());
+        std::size_t payload_size{std::min(remain_file_size, full_payload_size)};
+        if (mapped_file)
+        {
+            const char *payload{mapped_file->data() + stripe_offset +
+                                (seq_num - file_start_seq_num) * full_payload_size};
+            if (file_checksum)
+                file_checksum = checksum::extend(*file_checksum, payload, payload_size);
+            // 没有协商压缩时没有窗口槽位
+            std::size_t n{0};
+            if (compression_enabled)
+                n = compressor->compress(payload, payload_size, (*packets_vec)[index].get_buf());
+            if (n > 0)
+            {
+                packet_view packet{(*packets_vec)[index]};
+                packet.make_packet(seq_num, n, COMPRESSED);
+                headers_vec[index] = packet;
+                metrics->add(counter::packets_compressed);
+            }
+            else
+                headers_vec[index] = rtp_header(seq_num, payload_size, 0, payload);
+        }
+        else if (stream)
+        {
+            // 负载已由 `fill_from_stream()` 读入
+            payload_size = stream_filled;
+            stream_filled = 0;
+            make_data_packet(seq_num, payload_size);
+        }
+        else
+        {
+            ifs.read((*packets_vec)[index].get_buf(), payload_size);
+            if (file_checksum)
+                file_checksum = checksum::extend(*file_checksum,
+                                                 (*packets_vec)[index].get_buf(), payload_size);
+            make_data_packet(seq_num, payload_size);
+        }
 
         remain_file_size -= payload_size;
 
-        packets_vec[index].make_packet(seq_num, payload_size, 0);
-        if (packets_vec[index].send(fd) == -1)
-            error_process::unix_error("发送包失败: ");
+        push_packet(seq_num);
+        if (fec_encoder)
+            push_parity(seq_num, now);
     }
-    window_left_unsent_seq_num = window_right_seq_num;
+    loop->flush();
     if (send_)
-        start_timer(timer_wrapper.get_file_descriptor(), 100);
+    {
+        window_left_unsent_seq_num = seq_num;
+        metrics->window_occupancy.record(window_left_unsent_seq_num - window_left_seq_num);
+        if (retransmit_timers)
+            arm_retransmit_timer(deadline);
+        else
+            loop->start_timer(RETRANSMIT_TIMER, rto->timeout_ms());
+    }
+}
+
+// 把流中的数据读入 `seq_num` 的槽位. 包读满或读到结尾时返回 true; 暂时没有数据时
+// 等到输入可读再继续. 读到结尾时确定文件的包数, 此后与普通文件一样.
+bool fill_from_stream(std::size_t seq_num)
+{
+    // 最后一个不满的包可能因为限速还没发出
+    if (stream_finished)
+        return stream_filled > 0;
+    char *buf{(*packets_vec)[seq_num % window_size].get_buf()};
+    while (stream_filled < full_payload_size)
+    {
+        auto n{stream->read(buf + stream_filled, full_payload_size - stream_filled)};
+        if (!n)
+        {
+            loop->watch_readable(stream->get_file_descriptor());
+            return false;
+        }
+        if (*n == 0)
+            break;
+        stream_filled += *n;
+        stream_bytes += *n;
+    }
+    if (stream_filled == full_payload_size)
+        return true;
+
+    std::size_t end_seq_num{stream_filled > 0 ? seq_num + 1 : seq_num};
+    stream_finished = true;
+    transfer_bytes = stream_bytes;
+    file_window = end_seq_num - file_start_seq_num;
+    n_need_ack_window = end_seq_num - window_left_seq_num;
+    window_right_seq_num = std::min(window_right_seq_num, end_seq_num);
+    loop->stop_timer(KEEPALIVE_TIMER);
+    // 输入恰好在包边界结束时, 最后一组已在发出最后一个包时加入编码器, 在此补发校验包
+    if (stream_filled == 0 && fec_encoder && fec_encoder->size() > 0)
+        flush_parity(end_seq_num, pacer::clock::now());
+    log_debug("输入结束, 共 ", stream_bytes, " 字节, ", file_window, " 个包");
+    return stream_filled > 0;
 }
 
-void handshake(int fd, std::uint32_t seq_num)
+void keep_alive()
 {
-    send_and_wait_header(50, fd, {seq_num, 0, SYN}, {seq_num + 1, 0, SYN | ACK});
+    if (stream_finished)
+        return;
+    if (window_left_seq_num == window_filled_seq_num)
+    {
+        loop->push_copy({static_cast<std::uint32_t>(window_left_seq_num - 1), 0, 0});
+        loop->flush();
+    }
+    loop->start_timer(KEEPALIVE_TIMER, KEEPALIVE_INTERVAL_MS);
+}
+
+void update_pacing_rate()
+{
+    double rate{pacing_by_congestion ? congestion->pacing_rate(rto->srtt()) : 0};
+    if (max_rate_packets > 0 && (rate == 0 || rate > max_rate_packets))
+        rate = max_rate_packets;
+    pacing->set_rate(rate);
+}
+
+// 令牌用完时, 到有新令牌时再继续发送
+void wait_for_tokens(pacer::clock::time_point now)
+{
+    if (pacing_timer_armed)
+        return;
+    auto delay{std::chrono::ceil<std::chrono::milliseconds>(pacing->delay(now)).count()};
+    loop->start_timer(PACING_TIMER, delay > 0 ? delay : 1);
+    pacing_timer_armed = true;
+}
+
+// 返回对端在 SYN ACK 中同意的扩展. 旧的接收端回应不带负载, 即不同意任何扩展.
+// `probe` 为 true 时 SYN 填充到请求的数据包长度并且不分片, 几次都没有回应说明路径
+// 或对端容不下这么长的包, 改用不请求负载长度的普通 SYN.
+handshake_extensions handshake(int fd, std::uint32_t seq_num,
+                               const handshake_extensions &extensions, bool probe)
+{
+    constexpr int PROBE_ATTEMPTS{3};
+    packet_pool syn_buffer{PAYLOAD_LIMIT, 1};
+    packet_view syn{syn_buffer[0]};
+    rtp_packet syn_ack;
+    bool answered{false};
+    if (probe && extensions.payload_size)
+    {
+        std::uint16_t length{encode_extensions(extensions, syn.get_buf())};
+        length = pad_extensions(syn.get_buf(), length, *extensions.payload_size);
+        syn.make_packet(seq_num, length, SYN);
+        answered = send_and_wait_packet(PROBE_ATTEMPTS, fd, syn, seq_num + 1, SYN | ACK, *rto,
+                                        syn_ack);
+        if (!answered)
+            log_debug("长度为 ", sizeof(rtp_header) + length, " 的 SYN 没有回应, 不协商负载长度");
+    }
+    if (!answered)
+    {
+        // 没有扩展时负载为空, 与原协议的 SYN 完全相同
+        handshake_extensions requested{extensions};
+        if (probe)
+            requested.payload_size.reset();
+        syn.make_packet(seq_num, encode_extensions(requested, syn.get_buf()), SYN);
+        send_and_wait_packet(50, fd, syn, seq_num + 1, SYN | ACK, *rto, syn_ack);
+    }
     send_and_wait<2>(50, fd, {seq_num + 1, 0, ACK});
+    return decode_extensions(syn_ack.get_buf(), syn_ack.get_length());
+}
+
+// 握手之前就失败时没有统计
+void write_summary(const transfer_options &options)
+{
+    if (options.stats.empty() || !metrics)
+        return;
+    try
+    {
+        stats_sink sink{options.stats};
+        write_stats(sink, *metrics, "sender");
+    }
+    catch (exceptions)
+    {
+    }
 }
 
 void terminate_connection(int fd, std::uint32_t fin_seq_num)
 {
-    send_and_wait_header(50, fd, {fin_seq_num, 0, FIN}, {fin_seq_num, 0, FIN | ACK});
+    if (!file_checksum)
+    {
+        send_and_wait_header(50, fd, {fin_seq_num, 0, FIN}, {fin_seq_num, 0, FIN | ACK}, *rto);
+        return;
+    }
+    // 续传时 FIN 带整个文件的校验和, 接收端读回整个文件核对后在 FIN ACK 中回应结果
+    rtp_packet fin, fin_ack;
+    std::memcpy(fin.get_buf(), &*file_checksum, sizeof(std::uint32_t));
+    fin.make_packet(fin_seq_num, sizeof(std::uint32_t), FIN);
+    send_and_wait_packet(50, fd, fin, fin_seq_num, FIN | ACK, *rto, fin_ack);
+    if (fin_ack.get_length() < 1 || fin_ack.get_buf()[0] == 0)
+        logs::error("接收端核对整个文件失败, 请重新发送");
+    log_debug("接收端核对整个文件一致");
 }
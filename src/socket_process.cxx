@@ -1,7 +1,14 @@
 #include "socket_process.hxx"
 #include "error_process.hxx"
 #include "file_process.hxx"
+#include "rtp_header.hxx"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <climits>
+#include <cstring>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <string_view>
 #include <sys/socket.h>
 #include <sys/time.h>
 
@@ -11,7 +18,7 @@ static addrinfo *get_addr_info(const char *host, const char *service,
 static void set_socket_option(int s, int level, int optname, const void *optval,
                               int opt_len);
 
-static int open_receiver_socket(const char *port);
+static int open_receiver_socket(const char *port, bool reuse_port);
 
 static int open_sender_socket(const char *hostname, const char *port);
 
@@ -45,9 +52,101 @@ namespace socket_process
                           sizeof(timeval));
     }
 
-    int open_receiver_socket(const char *port)
+    void set_recv_timeout(int socket, std::chrono::microseconds timeout)
     {
-        int ret{::open_receiver_socket(port)};
+        timeval optval{static_cast<time_t>(timeout.count() / 1000'000),
+                       static_cast<suseconds_t>(timeout.count() % 1000'000)};
+        set_socket_option(socket, SOL_SOCKET, SO_RCVTIMEO, &optval, sizeof(timeval));
+    }
+
+    void set_max_pacing_rate(int socket, std::uint64_t bytes_per_second)
+    {
+        set_socket_option(socket, SOL_SOCKET, SO_MAX_PACING_RATE, &bytes_per_second,
+                          sizeof(bytes_per_second));
+    }
+
+    static int family_of(int socket)
+    {
+        sockaddr_storage address{};
+        socklen_t length{sizeof(address)};
+        if (getsockname(socket, reinterpret_cast<sockaddr *>(&address), &length) == -1)
+            error_process::unix_error("`getsockname()` 错误: ");
+        return address.ss_family;
+    }
+
+    std::size_t payload_size_for_mtu(int socket, std::size_t mtu)
+    {
+        constexpr std::size_t UDP_HEADER{8};
+        std::size_t ip_header{family_of(socket) == AF_INET6 ? 40u : 20u};
+        std::size_t overhead{ip_header + UDP_HEADER + sizeof(rtp_header)};
+        return std::min(mtu > overhead ? mtu - overhead : 0, PAYLOAD_LIMIT);
+    }
+
+    void enlarge_buffers(int socket, std::size_t bytes)
+    {
+        for (int optname : {SO_RCVBUF, SO_SNDBUF})
+        {
+            int size;
+            socklen_t length{sizeof(size)};
+            // 内核返回的是设定值的两倍
+            if (getsockopt(socket, SOL_SOCKET, optname, &size, &length) == 0 &&
+                static_cast<std::size_t>(size) / 2 >= bytes)
+                continue;
+            size = static_cast<int>(std::min<std::size_t>(bytes, INT_MAX));
+            setsockopt(socket, SOL_SOCKET, optname, &size, sizeof(size));
+        }
+    }
+
+    std::size_t path_mtu(int socket)
+    {
+        int mtu;
+        socklen_t length{sizeof(mtu)};
+        bool v6{family_of(socket) == AF_INET6};
+        if (getsockopt(socket, v6 ? IPPROTO_IPV6 : IPPROTO_IP, v6 ? IPV6_MTU : IP_MTU, &mtu,
+                       &length) == -1)
+            return 0;
+        return static_cast<std::size_t>(mtu);
+    }
+
+    void set_dont_fragment(int socket, bool dont_fragment)
+    {
+        if (family_of(socket) == AF_INET6)
+        {
+            int value{dont_fragment ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT};
+            set_socket_option(socket, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &value, sizeof(value));
+        }
+        else
+        {
+            int value{dont_fragment ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT};
+            set_socket_option(socket, IPPROTO_IP, IP_MTU_DISCOVER, &value, sizeof(value));
+        }
+    }
+
+    std::string host_of(const socket_address &address)
+    {
+        char host[INET6_ADDRSTRLEN]{};
+        if (address.storage.ss_family == AF_INET)
+            inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in *>(&address.storage)->sin_addr,
+                      host, sizeof(host));
+        else if (address.storage.ss_family == AF_INET6)
+            inet_ntop(AF_INET6,
+                      &reinterpret_cast<const sockaddr_in6 *>(&address.storage)->sin6_addr, host,
+                      sizeof(host));
+        return host;
+    }
+
+    std::uint16_t port_of(const socket_address &address)
+    {
+        if (address.storage.ss_family == AF_INET)
+            return ntohs(reinterpret_cast<const sockaddr_in *>(&address.storage)->sin_port);
+        if (address.storage.ss_family == AF_INET6)
+            return ntohs(reinterpret_cast<const sockaddr_in6 *>(&address.storage)->sin6_port);
+        return 0;
+    }
+
+    int open_receiver_socket(const char *port, bool reuse_port)
+    {
+        int ret{::open_receiver_socket(port, reuse_port)};
         if (ret < 0)
             error_process::unix_error("`open_receiver_socket()` 错误: ");
         return ret;
@@ -62,6 +161,32 @@ namespace socket_process
     }
 }
 
+const sockaddr *socket_address::get() const
+{
+    return reinterpret_cast<const sockaddr *>(&storage);
+}
+
+bool socket_address::operator==(const socket_address &other) const
+{
+    return length == other.length && std::memcmp(&storage, &other.storage, length) == 0;
+}
+
+std::size_t socket_address_hash::operator()(const socket_address &address) const
+{
+    return std::hash<std::string_view>{}(
+        {reinterpret_cast<const char *>(&address.storage), address.length});
+}
+
+std::ostream &operator<<(std::ostream &os, const socket_address &address)
+{
+    if (address.storage.ss_family == AF_INET6)
+        os << '[' << socket_process::host_of(address) << ']';
+    else
+        os << socket_process::host_of(address);
+    os << ':' << socket_process::port_of(address);
+    return os;
+}
+
 static addrinfo *get_addr_info(const char *host, const char *service,
                                const addrinfo *hints)
 {
@@ -83,8 +208,9 @@ static void set_socket_option(int s, int level, int optname, const void *optval,
 }
 
 static constexpr int SO_REUSEADDR_OPTVAL{1};
+static constexpr int SO_REUSEPORT_OPTVAL{1};
 
-static int open_receiver_socket(const char *port)
+static int open_receiver_socket(const char *port, bool reuse_port)
 {
     addrinfo hint{AI_PASSIVE | AI_ADDRCONFIG | AI_NUMERICSERV,
                   AF_UNSPEC,
@@ -107,6 +233,9 @@ static int open_receiver_socket(const char *port)
             {
                 set_socket_option(receiver_fd, SOL_SOCKET, SO_REUSEADDR,
                                   &SO_REUSEADDR_OPTVAL, sizeof(int));
+                if (reuse_port)
+                    set_socket_option(receiver_fd, SOL_SOCKET, SO_REUSEPORT,
+                                      &SO_REUSEPORT_OPTVAL, sizeof(int));
 
                 socket_process::set_100ms_recv_timeout(receiver_fd);
                 if (bind(receiver_fd, ptr->ai_addr, ptr->ai_addrlen) == 0)
@@ -1,14 +1,57 @@
 #ifndef SOCKET_PROCESS_HXX
 #define SOCKET_PROCESS_HXX
 
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <sys/socket.h>
+
+// 对端地址. 只有前 `length` 个字节有意义, 比较与哈希都只看这部分.
+struct socket_address
+{
+    sockaddr_storage storage{};
+    socklen_t length{0};
+
+    const sockaddr *get() const;
+    bool operator==(const socket_address &other) const;
+};
+
+struct socket_address_hash
+{
+    std::size_t operator()(const socket_address &address) const;
+};
+
 namespace socket_process
 {
-    int open_receiver_socket(const char *port);
+    // `reuse_port` 为 true 时打开 `SO_REUSEPORT`, 多个套接字可以绑定同一个端口,
+    // 内核按四元组把各个流分给它们
+    int open_receiver_socket(const char *port, bool reuse_port = false);
     int open_sender_socket(const char *host_name, const char *port);
     void set_100ms_recv_timeout(int socket);
     void set_2s_recv_timeout(int socket);
     void set_5s_recv_timeout(int socket);
     void set_no_recv_timeout(int socket);
+    void set_recv_timeout(int socket, std::chrono::microseconds timeout);
+    // 让内核按不超过 `bytes_per_second` 的速率发送. 只在 fq 队列规则下生效.
+    void set_max_pacing_rate(int socket, std::uint64_t bytes_per_second);
+    // IP 报文最长 `mtu` 字节时数据包的最大负载: 减去 IP 包头 (按套接字的地址族)、
+    // UDP 包头与 `rtp_header`, 不超过 `PAYLOAD_LIMIT`
+    std::size_t payload_size_for_mtu(int socket, std::size_t mtu);
+    // 把收发缓冲区至少扩大到 `bytes` 字节, 使一个窗口的长包不至于在内核中被丢弃.
+    // 受 `net.core.rmem_max` / `wmem_max` 限制, 失败时保持原样.
+    void enlarge_buffers(int socket, std::size_t bytes);
+    // 已连接的套接字的路径 MTU (内核记录的值), 拿不到时返回 0
+    std::size_t path_mtu(int socket);
+    // 为 true 时发出的报文都置 DF 位, 超过已知路径 MTU 的报文 `send()` 直接失败;
+    // 为 false 时允许分片
+    void set_dont_fragment(int socket, bool dont_fragment);
+    // 地址的数字形式与端口
+    std::string host_of(const socket_address &address);
+    std::uint16_t port_of(const socket_address &address);
 }
 
+std::ostream &operator<<(std::ostream &os, const socket_address &address);
+
 #endif
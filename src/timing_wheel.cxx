@@ -0,0 +1,91 @@
+#include "timing_wheel.hxx"
+#include <algorithm>
+
+timing_wheel::timing_wheel(std::size_t n_ids)
+    : m_epoch{clock::now()}, m_slots(SLOTS), m_deadlines(n_ids, NONE)
+{
+}
+
+std::int64_t timing_wheel::to_tick_ceil(clock::time_point time) const
+{
+    return std::max<std::int64_t>(std::chrono::ceil<tick>(time - m_epoch).count(), 0);
+}
+
+std::int64_t timing_wheel::to_tick_floor(clock::time_point time) const
+{
+    return std::chrono::floor<tick>(time - m_epoch).count();
+}
+
+timing_wheel::clock::time_point timing_wheel::to_time(std::int64_t tick) const
+{
+    return m_epoch + timing_wheel::tick{tick};
+}
+
+timing_wheel::clock::time_point timing_wheel::schedule(std::size_t id,
+                                                       clock::time_point deadline)
+{
+    // 已经扫过的刻度不会再被扫到, 放到下一个刻度
+    std::int64_t tick{std::max(to_tick_ceil(deadline), m_current)};
+    if (m_deadlines[id] == NONE)
+        m_n_pending++;
+    m_deadlines[id] = tick;
+    m_slots[tick % SLOTS].push_back({id, tick});
+    return to_time(tick);
+}
+
+void timing_wheel::cancel(std::size_t id)
+{
+    if (m_deadlines[id] == NONE)
+        return;
+    m_deadlines[id] = NONE;
+    m_n_pending--;
+}
+
+void timing_wheel::expire(clock::time_point now, std::vector<std::size_t> &expired)
+{
+    std::int64_t now_tick{to_tick_floor(now)};
+    if (now_tick < m_current)
+        return;
+
+    // 超过一圈时每个槽只需扫一次
+    std::int64_t last{std::min(now_tick, m_current + std::int64_t(SLOTS) - 1)};
+    for (std::int64_t t{m_current}; t <= last; t++)
+    {
+        std::vector<entry> &slot{m_slots[t % SLOTS]};
+        std::size_t kept{0};
+        for (const entry &e : slot)
+        {
+            if (m_deadlines[e.id] != e.tick)
+                continue;
+            if (e.tick <= now_tick)
+            {
+                m_deadlines[e.id] = NONE;
+                m_n_pending--;
+                expired.push_back(e.id);
+                continue;
+            }
+            slot[kept++] = e;
+        }
+        slot.resize(kept);
+    }
+    m_current = now_tick + 1;
+}
+
+std::optional<timing_wheel::clock::time_point> timing_wheel::next_deadline() const
+{
+    if (m_n_pending == 0)
+        return std::nullopt;
+
+    // 一圈之内的定时器按刻度顺序就能找到
+    for (std::int64_t t{m_current}; t < m_current + std::int64_t(SLOTS); t++)
+        for (const entry &e : m_slots[t % SLOTS])
+            if (e.tick == t && m_deadlines[e.id] == t)
+                return to_time(t);
+
+    // 都在一圈以外, 只能找最小值
+    std::int64_t earliest{NONE};
+    for (std::int64_t tick : m_deadlines)
+        if (tick != NONE && (earliest == NONE || tick < earliest))
+            earliest = tick;
+    return to_time(earliest);
+}
@@ -0,0 +1,56 @@
+#ifndef TIMING_WHEEL_HXX
+#define TIMING_WHEEL_HXX
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+// 哈希时间轮. 每个编号 (例如窗口槽位) 最多挂一个定时器, 到期时间按 1 ms 向上取整
+// 后放入 `到期刻度 % SLOTS` 号槽. 取消与重设都不去槽里删除旧项, 而是让它失效,
+// 槽被扫到时再清理, 因此两者都是 O(1).
+class timing_wheel
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using tick = std::chrono::milliseconds;
+
+    static constexpr std::size_t SLOTS{1024};
+
+private:
+    struct entry
+    {
+        std::size_t id;
+        std::int64_t tick;
+    };
+
+    static constexpr std::int64_t NONE{-1};
+
+    clock::time_point m_epoch;
+    std::vector<std::vector<entry>> m_slots;
+    // 每个编号当前的到期刻度, 槽中刻度与之不符的项已失效
+    std::vector<std::int64_t> m_deadlines;
+    // 下一个还没扫过的刻度
+    std::int64_t m_current{0};
+    std::size_t m_n_pending{0};
+
+    std::int64_t to_tick_ceil(clock::time_point time) const;
+    std::int64_t to_tick_floor(clock::time_point time) const;
+    clock::time_point to_time(std::int64_t tick) const;
+
+public:
+    explicit timing_wheel(std::size_t n_ids);
+
+    // 设定 `id` 的定时器, 覆盖之前的设定. 返回取整后的实际到期时间.
+    clock::time_point schedule(std::size_t id, clock::time_point deadline);
+    void cancel(std::size_t id);
+
+    // 把在 `now` 之前到期的编号追加到 `expired`, 这些定时器随之解除
+    void expire(clock::time_point now, std::vector<std::size_t> &expired);
+
+    // 最早的到期时间. 没有定时器时为空.
+    std::optional<clock::time_point> next_deadline() const;
+};
+
+#endif
@@ -6,43 +6,9 @@
 #include <cstdint>
 #include <cstring>
 #include <iostream>
+#include <sched.h>
 #include <sys/timerfd.h>
 
-static std::uint32_t crc32_for_byte(std::uint32_t r)
-{
-    for (int i{0}; i < 8; i++)
-        r = (r & 1 ? 0 : 0xEDB88320U) ^ r >> 1;
-    return r ^ 0xFF000000U;
-}
-
-static void crc32(const void *data, std::size_t n_bytes, std::uint32_t *crc)
-{
-    static std::uint32_t table[0x100];
-    if (table[0] == 0)
-    {
-        for (std::size_t i{0}; i < 0x100; i++)
-            table[i] = crc32_for_byte(i);
-    }
-    for (std::size_t i{0}; i < n_bytes; i++)
-        *crc = table[(std::uint8_t)*crc ^ ((std::uint8_t *)data)[i]] ^ *crc >> 8;
-}
-
-// Computes checksum for `n_bytes` of data
-//
-// Hint 1: Before computing the checksum, you should set everything up
-// and set the "checksum" field to 0. And when checking if a packet
-// has the correct check sum, don't forget to set the "checksum" field
-// back to 0 before invoking this function.
-//
-// Hint 2: `len + sizeof(rtp_header_t)` is the real length of a rtp
-// data packet.
-std::uint32_t compute_checksum(const void *pkt, std::size_t n_bytes)
-{
-    std::uint32_t crc{0};
-    crc32(pkt, n_bytes, &crc);
-    return crc;
-}
-
 std::pair<std::size_t, mode_type> parse_window_size_and_mode(const char *window_size_str,
                                                              const char *mode_str)
 {
@@ -87,29 +53,78 @@ std::ostream &operator<<(std::ostream &os, const mode_type &mode)
     return os;
 }
 
-void send_and_wait_header(int attempt_times, int fd, const rtp_header &send_header,
-                          const rtp_header &wait_header)
+// 不匹配的包多半是之前遗留的 (例如窗口末尾成批的重复 ACK), 收到时不重发也不算一次尝试.
+// 最多忽略这么多个, 以免对端一直发不相干的包时永远等下去.
+constexpr int IGNORED_REPLIES_MAX{1 << 16};
+
+template <typename Buffer, typename Match>
+static bool send_and_wait_until(int attempt_times, int fd, const rtp_header &send_header,
+                                rto_estimator &rto, Buffer &buffer, Match match)
 {
     int times{0};
-    rtp_header header_buffer;
+    int n_ignored{0};
+    bool resend{true};
+    auto send_time{rto_estimator::clock::now()};
     for (times = 1; times <= attempt_times; times++)
     {
-        if (send_header.send(fd) == -1)
-            error_process::unix_error("`send()` 错误: ");
-        log_debug(SEND_HEADER_LOG, send_header);
+        socket_process::set_recv_timeout(fd, rto.timeout());
+        if (resend)
+        {
+            send_time = rto_estimator::clock::now();
+            if (send_header.send(fd) == -1)
+                error_process::unix_error("`send()` 错误: ");
+            log_debug(SEND_HEADER_LOG, send_header);
+        }
+        resend = true;
 
-        if (header_buffer.recv(fd) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        ssize_t n_bytes{buffer.recv(fd)};
+        if (n_bytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
         {
+            rto.backoff();
             log_debug("接收失败. 当前尝试次数: ", times);
             continue;
         }
-        log_debug(RECV_HEADER_LOG, header_buffer);
-        if (header_buffer == wait_header)
+        log_debug(RECV_HEADER_LOG, static_cast<const rtp_header &>(buffer));
+        if (match(buffer, n_bytes))
+        {
+            // Karn 算法: 重发过的请求分不清回应的是哪一次, 不采样
+            if (times == 1)
+                rto.sample(rto_estimator::clock::now() - send_time);
             break;
+        }
         log_debug("包不合法. 当前尝试次数: ", times);
+        if (n_ignored++ < IGNORED_REPLIES_MAX)
+        {
+            times--;
+            resend = false;
+        }
     }
     if (times > 50)
         logs::error("超出尝试次数.");
+    return times <= attempt_times;
+}
+
+void send_and_wait_header(int attempt_times, int fd, const rtp_header &send_header,
+                          const rtp_header &wait_header, rto_estimator &rto)
+{
+    rtp_header header_buffer;
+    send_and_wait_until(attempt_times, fd, send_header, rto, header_buffer,
+                        [&](const rtp_header &header, ssize_t) { return header == wait_header; });
+}
+
+bool send_and_wait_packet(int attempt_times, int fd, const rtp_header &send_header,
+                          std::uint32_t wait_seq_num, std::uint8_t wait_flag,
+                          rto_estimator &rto, rtp_packet &reply)
+{
+    return send_and_wait_until(attempt_times, fd, send_header, rto, reply,
+                        [&](packet_view packet, ssize_t n_bytes)
+                        {
+                            return n_bytes >= static_cast<ssize_t>(sizeof(rtp_header)) &&
+                                   static_cast<std::size_t>(n_bytes) >=
+                                       sizeof(rtp_header) + packet.get_length() &&
+                                   packet.get_seq_num() == wait_seq_num &&
+                                   packet.get_flag() == wait_flag && packet.is_valid();
+                        });
 }
 
 static void send_and_wait_helper(int attempt_times, int fd, const rtp_header &send_header)
@@ -151,3 +166,16 @@ void start_timer(int timer_fd, std::int64_t time)
     if (timerfd_settime(timer_fd, 0, &spec, NULL) == -1)
         error_process::unix_error("`timerfd_settime()` 错误: ");
 }
+
+void set_cpu_affinity(const std::vector<int> &cpus, std::size_t index)
+{
+    if (cpus.empty())
+        return;
+    int cpu{cpus[index % cpus.size()]};
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        error_process::unix_error("`sched_setaffinity()` 错误: ");
+    log_debug("绑定到 CPU ", cpu);
+}
@@ -1,11 +1,15 @@
 #ifndef TOOLS_HXX
 #define TOOLS_HXX
 
+#include "checksum.hxx"
+#include "logger.hxx"
+#include "rto.hxx"
 #include "rtp_header.hxx"
 #include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <iostream>
+#include <vector>
 
 enum class exceptions
 {
@@ -21,36 +25,57 @@ enum class mode_type
 
 std::ostream &operator<<(std::ostream &os, const mode_type &mode);
 
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
 #define log_debug(...) ::logs::debug(__VA_ARGS__)
+#else
+#define log_debug(...) ((void)0)
+#endif
 
 namespace logs
 {
     template <typename... V> void info(V... args)
     {
-        ((std::cout << "\033[32;1m[INFO]\033[0m ") << ... << args) << '\n';
+        if constexpr (LOG_LEVEL <= LOG_LEVEL_INFO)
+        {
+            ((begin_line() << "\033[32;1m[INFO]\033[0m ") << ... << args) << '\n';
+            end_line(false);
+        }
     }
 
     template <typename... V> void debug(V... args)
     {
-        ((std::cout << "\033[32;1m[DEBUG]\033[0m ") << ... << args) << '\n';
+        if constexpr (LOG_LEVEL <= LOG_LEVEL_DEBUG)
+        {
+            ((begin_line() << "\033[32;1m[DEBUG]\033[0m ") << ... << args) << '\n';
+            end_line(false);
+        }
     }
 
+    // 关闭错误日志时仍然抛出异常
     template <typename... V> void error(V... args)
     {
-        ((std::cout << "\033[32;31m[ERROR]\033[0m ") << ... << args) << '\n';
+        if constexpr (LOG_LEVEL <= LOG_LEVEL_ERROR)
+        {
+            ((begin_line() << "\033[32;31m[ERROR]\033[0m ") << ... << args) << '\n';
+            end_line(true);
+        }
         log_debug("抛出 `exceptions::GENERAL_EXCEPTION`, 开始栈回溯");
         throw exceptions::general_exception;
     }
 }
 
-std::uint32_t compute_checksum(const void *pkt, std::size_t n_bytes);
-
 std::pair<std::size_t, mode_type> parse_window_size_and_mode(const char *window_size,
                                                              const char *mode);
 
 // 此函数会尝试发送 `send_header`，然后等待 `wait_header`.
+// 每次等待 `rto` 给出的超时, 超时后退避; 第一次就成功时用这次往返采样.
 void send_and_wait_header(int attempt_times, int fd, const rtp_header &send_header,
-                          const rtp_header &wait_header);
+                          const rtp_header &wait_header, rto_estimator &rto);
+// 同上, 但等待的回应可以带负载 (例如握手扩展): 只要求 `seq_num` 与 `flag` 相符且
+// 校验和正确. 回应存入 `reply`. 少于 50 次的尝试都没有回应时返回 false.
+bool send_and_wait_packet(int attempt_times, int fd, const rtp_header &send_header,
+                          std::uint32_t wait_seq_num, std::uint8_t wait_flag,
+                          rto_estimator &rto, rtp_packet &reply);
 // 此函数会尝试发送 `send_header`，然后等待 `wait_seconds` 秒内没有新的接收.
 // wait_seconds 只能是 2 或者 5
 template <int wait_seconds>
@@ -58,6 +83,9 @@ void send_and_wait(int attempt_times, int fd, const rtp_header &send_header);
 
 void start_timer(int timer_fd, std::int64_t time);
 
+// 把调用线程绑定到 `cpus[index % cpus.size()]`. `cpus` 为空时什么也不做.
+void set_cpu_affinity(const std::vector<int> &cpus, std::size_t index);
+
 constexpr char SEND_HEADER_LOG[]{"\033[33m发送包\033[0m:\n"};
 constexpr char RECV_HEADER_LOG[]{"\033[33m接收包\033[0m:\n"};
 #endif
@@ -0,0 +1,638 @@
+#include "uring_loop.hxx"
+#include "error_process.hxx"
+#include "file_process.hxx"
+#include "rtp_header.hxx"
+#include "tools.hxx"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    constexpr unsigned SQ_ENTRIES{256};
+    constexpr unsigned CQ_ENTRIES{4096};
+    // 提供给内核的接收缓冲区最多的个数与占用的总字节数. 个数必须是 2 的幂.
+    constexpr unsigned BUFFERS_COUNT_MAX{1024};
+    constexpr std::size_t BUFFERS_BYTES_MAX{16 << 20};
+    constexpr unsigned SEND_SLOTS_COUNT{1024};
+    constexpr std::uint16_t BUFFER_GROUP{0};
+    // 不属于任何接收缓冲区编号的池中缓冲区
+    constexpr std::uint16_t NO_BUFFER{0xffff};
+
+    // `user_data` 的高 8 位是操作类型, 其余位是操作的参数
+    enum class op_kind : std::uint64_t
+    {
+        recv = 1,
+        send,
+        timeout,
+        write,
+        poll,
+        ignore
+    };
+
+    std::uint64_t make_user_data(op_kind kind, std::uint64_t arg)
+    {
+        return static_cast<std::uint64_t>(kind) << 56 | arg;
+    }
+
+    int io_uring_setup(unsigned entries, io_uring_params *params)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+    {
+        return static_cast<int>(
+            syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+    }
+
+    // 与内核共享的环的头尾指针需要 acquire / release 语义
+    template <typename T> T load_acquire(T &value)
+    {
+        return std::atomic_ref<T>{value}.load(std::memory_order_acquire);
+    }
+
+    template <typename T> void store_release(T &value, T desired)
+    {
+        std::atomic_ref<T>{value}.store(desired, std::memory_order_release);
+    }
+
+    class ring_mapping
+    {
+    private:
+        void *m_addr{MAP_FAILED};
+        std::size_t m_size{0};
+
+    public:
+        ring_mapping &operator=(const ring_mapping &) = delete;
+        ring_mapping(const ring_mapping &) = delete;
+
+        ring_mapping() = default;
+        ~ring_mapping()
+        {
+            if (m_addr != MAP_FAILED)
+                munmap(m_addr, m_size);
+        }
+
+        // `fd` 为 -1 时映射匿名内存
+        bool map(std::size_t size, int fd, off_t offset)
+        {
+            int flags{fd >= 0 ? MAP_SHARED | MAP_POPULATE : MAP_PRIVATE | MAP_ANONYMOUS};
+            m_size = size;
+            m_addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+            return m_addr != MAP_FAILED;
+        }
+
+        char *get() const { return static_cast<char *>(m_addr); }
+    };
+
+    class uring_loop : public event_loop
+    {
+    private:
+        struct send_slot
+        {
+            msghdr msg;
+            iovec iovs[2];
+            rtp_header header;
+            socket_address destination;
+        };
+
+        struct timer_state
+        {
+            __kernel_timespec time;
+            std::uint32_t generation{0};
+            bool armed{false};
+        };
+
+        int m_socket_fd;
+        file_process::fd_wrapper m_ring_wrapper{-1};
+        io_uring_params m_params{};
+        ring_mapping m_sq_mapping;
+        ring_mapping m_cq_mapping;
+        ring_mapping m_sqes_mapping;
+
+        unsigned *m_sq_head{nullptr};
+        unsigned *m_sq_tail{nullptr};
+        unsigned m_sq_mask{0};
+        io_uring_sqe *m_sqes{nullptr};
+        // 已填好但还没有告诉内核的 SQE 的尾部
+        unsigned m_sqe_tail{0};
+
+        unsigned *m_cq_head{nullptr};
+        unsigned *m_cq_tail{nullptr};
+        unsigned m_cq_mask{0};
+        io_uring_cqe *m_cqes{nullptr};
+
+        // 接收缓冲区的个数, 由负载长度决定
+        unsigned m_buffers_count;
+        // 已交给内核 (或即将随下一次提交交给内核) 的缓冲区个数
+        unsigned m_buffers_in_ring{0};
+        // 等待通过 `IORING_OP_PROVIDE_BUFFERS` 还给内核的缓冲区
+        std::vector<std::uint16_t> m_recycled_buffers;
+        // 内核的缓冲区编号对应的池中的缓冲区, 以及反过来的对应关系.
+        // `take()` 把一个编号换成新的缓冲区, 下次交给内核时用新的地址.
+        packet_pool m_pool;
+        std::vector<packet_pool::handle> m_buffer_handles;
+        std::vector<std::uint16_t> m_handle_buffers;
+        // 缓冲区的引用计数: 交给主循环的一轮算一次, 每个未完成的写操作各算一次
+        std::vector<unsigned> m_buffer_refs;
+        bool m_recv_armed{false};
+        bool m_multishot{true};
+        bool m_closing{false};
+
+        // 已经收到但还没有交给主循环的包, 以及本轮交给主循环的包
+        std::vector<std::uint16_t> m_incoming_buffers;
+        std::vector<std::size_t> m_incoming_lengths;
+        std::vector<std::uint16_t> m_delivered_buffers;
+        std::vector<packet_pool::handle> m_delivered_handles;
+        std::vector<std::size_t> m_delivered_lengths;
+
+        std::vector<send_slot> m_slots;
+        std::vector<std::uint32_t> m_free_slots;
+        socket_address m_destination;
+        std::size_t m_writes_in_flight{0};
+
+        timer_state m_timers[TIMERS_MAX];
+        unsigned m_pending_expired{0};
+        // `watch_readable()` 提交的单次 `IORING_OP_POLL_ADD`
+        bool m_poll_armed{false};
+        bool m_pending_readable{false};
+
+        io_uring_sqe *get_sqe()
+        {
+            while (m_sqe_tail - load_acquire(*m_sq_head) == m_params.sq_entries)
+            {
+                submit(0);
+                reap();
+            }
+            io_uring_sqe *sqe{&m_sqes[m_sqe_tail & m_sq_mask]};
+            std::memset(sqe, 0, sizeof(*sqe));
+            m_sqe_tail++;
+            return sqe;
+        }
+
+        // 提交所有 SQE, 并等待至少 `min_complete` 个完成事件
+        void submit(unsigned min_complete)
+        {
+            store_release(*m_sq_tail, m_sqe_tail);
+            unsigned to_submit{m_sqe_tail - load_acquire(*m_sq_head)};
+            if (to_submit == 0 && min_complete == 0)
+                return;
+            if (io_uring_enter(m_ring_wrapper.get_file_descriptor(), to_submit, min_complete,
+                               min_complete > 0 ? IORING_ENTER_GETEVENTS : 0) == -1)
+            {
+                // 完成队列溢出时内核拒绝提交, 调用者收割之后会重试
+                if (errno == EINTR || errno == EBUSY || errno == EAGAIN)
+                    return;
+                error_process::unix_error("`io_uring_enter()` 错误: ");
+            }
+        }
+
+        void reap()
+        {
+            // 处理过程中可能因提交队列已满而再次收割, 所以每次都重新读取头部
+            for (unsigned head{*m_cq_head}; head != load_acquire(*m_cq_tail); head = *m_cq_head)
+            {
+                io_uring_cqe cqe{m_cqes[head & m_cq_mask]};
+                store_release(*m_cq_head, head + 1);
+                handle(cqe);
+            }
+            provide_recycled();
+            arm_recv();
+        }
+
+        void handle(const io_uring_cqe &cqe)
+        {
+            auto kind{static_cast<op_kind>(cqe.user_data >> 56)};
+            std::uint64_t arg{cqe.user_data & ((std::uint64_t{1} << 56) - 1)};
+            switch (kind)
+            {
+            case op_kind::recv:
+                if (!(cqe.flags & IORING_CQE_F_MORE))
+                    m_recv_armed = false;
+                if (cqe.flags & IORING_CQE_F_BUFFER)
+                {
+                    auto bid{static_cast<std::uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT)};
+                    m_buffers_in_ring--;
+                    m_buffer_refs[bid] = 1;
+                    m_incoming_buffers.push_back(bid);
+                    m_incoming_lengths.push_back(cqe.res < 0 ? 0 : cqe.res);
+                }
+                if (cqe.res >= 0 || cqe.res == -ENOBUFS || cqe.res == -EINTR ||
+                    cqe.res == -EAGAIN || cqe.res == -ECANCELED)
+                    break;
+                if (cqe.res == -EINVAL && m_multishot)
+                {
+                    log_debug("内核不支持多发接收, 改为逐个提交接收请求");
+                    m_multishot = false;
+                    break;
+                }
+                error_process::posix_error(-cqe.res, "接收包时发生了问题: ");
+                break;
+            case op_kind::send:
+                m_free_slots.push_back(static_cast<std::uint32_t>(arg));
+                if (cqe.res < 0)
+                    error_process::posix_error(-cqe.res, "发送包失败: ");
+                break;
+            case op_kind::timeout: {
+                timer_state &timer{m_timers[arg >> 32]};
+                if (!timer.armed || timer.generation != static_cast<std::uint32_t>(arg))
+                    break;
+                timer.armed = false;
+                if (cqe.res == -ETIME)
+                    m_pending_expired |= 1U << (arg >> 32);
+                break;
+            }
+            case op_kind::write:
+                m_writes_in_flight--;
+                if (cqe.res < 0)
+                    error_process::posix_error(-cqe.res, "写文件错误: ");
+                release_buffer(static_cast<std::uint16_t>(arg));
+                break;
+            case op_kind::poll:
+                // 出错时也唤醒, 由调用者读出错误
+                m_poll_armed = false;
+                m_pending_readable = true;
+                break;
+            case op_kind::ignore:
+                break;
+            }
+        }
+
+        // 提交一个 `IORING_OP_PROVIDE_BUFFERS`, 把编号从 `first` 开始的 `count` 个缓冲区交给内核
+        void provide_buffers(std::uint16_t first, std::uint16_t count)
+        {
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+            sqe->fd = count;
+            sqe->addr = reinterpret_cast<std::uint64_t>(m_pool.data(m_buffer_handles[first]));
+            sqe->len = static_cast<std::uint32_t>(m_pool.buffer_size());
+            sqe->off = first;
+            sqe->buf_group = BUFFER_GROUP;
+            sqe->user_data = make_user_data(op_kind::ignore, 0);
+        }
+
+        // 把攒下的缓冲区还给内核, 编号与地址都连续的合并为一个请求
+        void provide_recycled()
+        {
+            if (m_recycled_buffers.empty())
+                return;
+            std::vector<std::uint16_t> recycled;
+            recycled.swap(m_recycled_buffers);
+            std::sort(recycled.begin(), recycled.end());
+            for (std::size_t i{0}, j{0}; i < recycled.size(); i = j)
+            {
+                for (j = i + 1; j < recycled.size() && recycled[j] == recycled[j - 1] + 1 &&
+                                m_pool.data(m_buffer_handles[recycled[j]]) ==
+                                    m_pool.data(m_buffer_handles[recycled[j - 1]]) +
+                                        m_pool.buffer_size();
+                     j++)
+                    ;
+                provide_buffers(recycled[i], static_cast<std::uint16_t>(j - i));
+            }
+        }
+
+        void release_buffer(std::uint16_t bid)
+        {
+            if (--m_buffer_refs[bid] == 0)
+            {
+                m_recycled_buffers.push_back(bid);
+                m_buffers_in_ring++;
+            }
+        }
+
+        void arm_recv()
+        {
+            // 没有空闲缓冲区时提交也只会得到 `-ENOBUFS`, 等写操作归还缓冲区后再提交
+            if (m_recv_armed || m_closing || m_buffers_in_ring == 0)
+                return;
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = m_socket_fd;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = BUFFER_GROUP;
+            sqe->ioprio = m_multishot ? IORING_RECV_MULTISHOT : 0;
+            sqe->user_data = make_user_data(op_kind::recv, 0);
+            m_recv_armed = true;
+        }
+
+        void cancel_timer(int timer)
+        {
+            timer_state &state{m_timers[timer]};
+            if (!state.armed)
+                return;
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = make_user_data(op_kind::timeout,
+                                       std::uint64_t(timer) << 32 | state.generation);
+            sqe->user_data = make_user_data(op_kind::ignore, 0);
+            state.armed = false;
+        }
+
+        std::uint32_t take_slot()
+        {
+            while (m_free_slots.empty())
+            {
+                submit(1);
+                reap();
+            }
+            std::uint32_t slot{m_free_slots.back()};
+            m_free_slots.pop_back();
+            return slot;
+        }
+
+    public:
+        uring_loop(int socket_fd, const transfer_options &options, std::size_t payload_size)
+            : m_socket_fd{socket_fd},
+              m_buffers_count{static_cast<unsigned>(std::clamp<std::size_t>(
+                  std::bit_floor(BUFFERS_BYTES_MAX / (sizeof(rtp_header) + payload_size)), 64,
+                  BUFFERS_COUNT_MAX))},
+              m_pool{payload_size, m_buffers_count, options.hugepages},
+              m_buffer_handles(m_buffers_count),
+              m_handle_buffers(m_pool.capacity(), NO_BUFFER), m_buffer_refs(m_buffers_count),
+              m_slots(SEND_SLOTS_COUNT)
+        {
+            // 新建的池中先取出的缓冲区地址相邻, 开始时可以一次交给内核
+            for (unsigned bid{0}; bid < m_buffers_count; bid++)
+            {
+                m_buffer_handles[bid] = m_pool.acquire();
+                m_handle_buffers[m_buffer_handles[bid]] = static_cast<std::uint16_t>(bid);
+            }
+            m_free_slots.reserve(SEND_SLOTS_COUNT);
+            for (std::uint32_t i{0}; i < SEND_SLOTS_COUNT; i++)
+                m_free_slots.push_back(SEND_SLOTS_COUNT - 1 - i);
+        }
+
+        ~uring_loop() override
+        {
+            // 取消多发接收并等待已提交的发送与写操作完成, 之后套接字与缓冲区才能交还
+            m_closing = true;
+            try
+            {
+                if (m_recv_armed)
+                {
+                    io_uring_sqe *sqe{get_sqe()};
+                    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                    sqe->fd = -1;
+                    sqe->addr = make_user_data(op_kind::recv, 0);
+                    sqe->user_data = make_user_data(op_kind::ignore, 0);
+                }
+                while (m_recv_armed || m_writes_in_flight > 0 ||
+                       m_free_slots.size() < SEND_SLOTS_COUNT)
+                {
+                    submit(1);
+                    reap();
+                }
+            }
+            catch (...)
+            {
+                log_debug("关闭 io_uring 时发生错误");
+            }
+        }
+
+        // 建立环并注册接收缓冲区. 失败时返回 false.
+        bool setup()
+        {
+            m_params.flags = IORING_SETUP_CQSIZE;
+            m_params.cq_entries = CQ_ENTRIES;
+            m_ring_wrapper.open(io_uring_setup(SQ_ENTRIES, &m_params));
+            if (!m_ring_wrapper.is_valid())
+            {
+                log_debug("`io_uring_setup()` 失败: ", std::strerror(errno));
+                return false;
+            }
+            int ring_fd{m_ring_wrapper.get_file_descriptor()};
+
+            std::size_t sq_size{m_params.sq_off.array + m_params.sq_entries * sizeof(unsigned)};
+            std::size_t cq_size{m_params.cq_off.cqes +
+                                m_params.cq_entries * sizeof(io_uring_cqe)};
+            bool single_mmap{(m_params.features & IORING_FEAT_SINGLE_MMAP) != 0};
+            if (single_mmap)
+                sq_size = cq_size = std::max(sq_size, cq_size);
+            if (!m_sq_mapping.map(sq_size, ring_fd, IORING_OFF_SQ_RING) ||
+                (!single_mmap && !m_cq_mapping.map(cq_size, ring_fd, IORING_OFF_CQ_RING)) ||
+                !m_sqes_mapping.map(m_params.sq_entries * sizeof(io_uring_sqe), ring_fd,
+                                    IORING_OFF_SQES))
+            {
+                log_debug("映射 io_uring 失败: ", std::strerror(errno));
+                return false;
+            }
+
+            char *sq{m_sq_mapping.get()};
+            char *cq{single_mmap ? sq : m_cq_mapping.get()};
+            m_sq_head = reinterpret_cast<unsigned *>(sq + m_params.sq_off.head);
+            m_sq_tail = reinterpret_cast<unsigned *>(sq + m_params.sq_off.tail);
+            m_sq_mask = *reinterpret_cast<unsigned *>(sq + m_params.sq_off.ring_mask);
+            m_sqe_tail = *m_sq_tail;
+            // SQE 与提交数组一一对应, 之后不必再改动提交数组
+            auto *array{reinterpret_cast<unsigned *>(sq + m_params.sq_off.array)};
+            for (unsigned i{0}; i < m_params.sq_entries; i++)
+                array[i] = i;
+            m_sqes = reinterpret_cast<io_uring_sqe *>(m_sqes_mapping.get());
+            m_cq_head = reinterpret_cast<unsigned *>(cq + m_params.cq_off.head);
+            m_cq_tail = reinterpret_cast<unsigned *>(cq + m_params.cq_off.tail);
+            m_cq_mask = *reinterpret_cast<unsigned *>(cq + m_params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe *>(cq + m_params.cq_off.cqes);
+
+            // 注册缓冲区环 (`IORING_REGISTER_PBUF_RING`) 在部分内核上接收时只会得到
+            // `-ENOBUFS`, 所以使用更早就有的 `IORING_OP_PROVIDE_BUFFERS`, 并确认它可用
+            provide_buffers(0, static_cast<std::uint16_t>(m_buffers_count));
+            submit(1);
+            if (*m_cq_head == load_acquire(*m_cq_tail))
+            {
+                log_debug("提供接收缓冲区没有完成");
+                return false;
+            }
+            int res{m_cqes[*m_cq_head & m_cq_mask].res};
+            store_release(*m_cq_head, *m_cq_head + 1);
+            if (res < 0)
+            {
+                log_debug("提供接收缓冲区失败: ", std::strerror(-res));
+                return false;
+            }
+            m_buffers_in_ring = m_buffers_count;
+            arm_recv();
+            return true;
+        }
+
+        void push(const rtp_header &packet) override
+        {
+            push(packet, reinterpret_cast<const char *>(&packet) + sizeof(rtp_header));
+        }
+
+        // 包头复制到发送槽中, 负载在发送完成前必须保持有效
+        void push(const rtp_header &header, const void *payload) override
+        {
+            std::uint32_t slot_index{take_slot()};
+            send_slot &slot{m_slots[slot_index]};
+            slot.header = header;
+            slot.iovs[0] = {&slot.header, sizeof(rtp_header)};
+            slot.iovs[1] = {const_cast<void *>(payload), header.get_length()};
+            slot.msg = {};
+            slot.msg.msg_iov = slot.iovs;
+            slot.msg.msg_iovlen = header.get_length() > 0 ? 2 : 1;
+            if (m_destination.length > 0)
+            {
+                slot.destination = m_destination;
+                slot.msg.msg_name = &slot.destination.storage;
+                slot.msg.msg_namelen = slot.destination.length;
+            }
+
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = m_socket_fd;
+            sqe->addr = reinterpret_cast<std::uint64_t>(&slot.msg);
+            sqe->len = 1;
+            sqe->user_data = make_user_data(op_kind::send, slot_index);
+        }
+
+        void push_copy(const rtp_header &header) override { push(header, nullptr); }
+
+        void flush() override { submit(0); }
+
+        void set_destination(const socket_address &destination) override
+        {
+            m_destination = destination;
+        }
+
+        void watch_readable(int fd) override
+        {
+            if (m_poll_armed)
+                return;
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = fd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = make_user_data(op_kind::poll, 0);
+            m_poll_armed = true;
+        }
+
+        void start_timer(int timer, std::chrono::microseconds time) override
+        {
+            cancel_timer(timer);
+            timer_state &state{m_timers[timer]};
+            state.generation++;
+            state.time = {time.count() / 1000'000, time.count() % 1000'000 * 1000};
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = reinterpret_cast<std::uint64_t>(&state.time);
+            sqe->len = 1;
+            sqe->user_data =
+                make_user_data(op_kind::timeout, std::uint64_t(timer) << 32 | state.generation);
+            state.armed = true;
+            m_pending_expired &= ~(1U << timer);
+        }
+
+        void stop_timer(int timer) override
+        {
+            cancel_timer(timer);
+            m_timers[timer].generation++;
+            m_pending_expired &= ~(1U << timer);
+        }
+
+        void write_file(int fd, const void *data, std::size_t n_bytes, off_t offset) override
+        {
+            // 不在接收缓冲区中的数据直接同步写出
+            packet_pool::handle h{m_pool.find(data)};
+            if (h == packet_pool::NO_HANDLE || h >= m_handle_buffers.size() ||
+                m_handle_buffers[h] == NO_BUFFER)
+            {
+                if (pwrite(fd, data, n_bytes, offset) != static_cast<ssize_t>(n_bytes))
+                    error_process::unix_error("`pwrite()` 错误: ");
+                return;
+            }
+            std::uint16_t bid{m_handle_buffers[h]};
+            m_buffer_refs[bid]++;
+            m_writes_in_flight++;
+
+            io_uring_sqe *sqe{get_sqe()};
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<std::uint64_t>(data);
+            sqe->len = static_cast<std::uint32_t>(n_bytes);
+            sqe->off = static_cast<std::uint64_t>(offset);
+            sqe->user_data = make_user_data(op_kind::write, bid);
+        }
+
+        void drain() override
+        {
+            submit(0);
+            while (m_writes_in_flight > 0)
+            {
+                submit(1);
+                reap();
+            }
+        }
+
+        void wait() override
+        {
+            for (std::uint16_t bid : m_delivered_buffers)
+                release_buffer(bid);
+            m_delivered_buffers.clear();
+            m_delivered_lengths.clear();
+            provide_recycled();
+
+            submit(0);
+            reap();
+            while (m_incoming_buffers.empty() && m_pending_expired == 0 && !m_pending_readable)
+            {
+                submit(1);
+                reap();
+            }
+
+            m_delivered_buffers.swap(m_incoming_buffers);
+            m_delivered_lengths.swap(m_incoming_lengths);
+            m_n_packets = m_delivered_buffers.size();
+            m_delivered_handles.resize(m_n_packets);
+            for (std::size_t i{0}; i < m_n_packets; i++)
+                m_delivered_handles[i] = m_buffer_handles[m_delivered_buffers[i]];
+            m_expired_timers = m_pending_expired;
+            m_pending_expired = 0;
+            m_pending_readable = false;
+        }
+
+        packet_view operator[](std::size_t i) override { return m_pool[m_delivered_handles[i]]; }
+
+        std::size_t length(std::size_t i) const override { return m_delivered_lengths[i]; }
+
+        // 多发接收 (`IORING_OP_RECV`) 不带来源地址
+        const socket_address *source(std::size_t) const override { return nullptr; }
+
+        packet_pool &pool() override { return m_pool; }
+
+        // 缓冲区编号换成池中新的缓冲区, 本轮结束后随编号一起还给内核
+        packet_pool::handle take(std::size_t i) override
+        {
+            std::uint16_t bid{m_delivered_buffers[i]};
+            packet_pool::handle taken{m_delivered_handles[i]};
+            packet_pool::handle fresh{m_pool.acquire()};
+            if (fresh >= m_handle_buffers.size())
+                m_handle_buffers.resize(m_pool.capacity(), NO_BUFFER);
+            m_handle_buffers[taken] = NO_BUFFER;
+            m_handle_buffers[fresh] = bid;
+            m_buffer_handles[bid] = fresh;
+            return taken;
+        }
+    };
+}
+
+std::unique_ptr<event_loop> make_uring_loop(int socket_fd, const transfer_options &options,
+                                            std::size_t payload_size)
+{
+    auto loop{std::make_unique<uring_loop>(socket_fd, options, payload_size)};
+    if (!loop->setup())
+        return nullptr;
+    return loop;
+}
@@ -0,0 +1,13 @@
+#ifndef URING_LOOP_HXX
+#define URING_LOOP_HXX
+
+#include "event_loop.hxx"
+#include "options.hxx"
+#include <memory>
+
+// 基于 io_uring 的事件循环: 多发接收 + 预先提供给内核的缓冲区, 定时器也由 io_uring 完成.
+// 每个缓冲区放得下负载为 `payload_size` 的包. 内核不支持所需的功能时返回空指针.
+std::unique_ptr<event_loop> make_uring_loop(int socket_fd, const transfer_options &options,
+                                            std::size_t payload_size);
+
+#endif